@@ -1,14 +1,23 @@
+#include <ctype.h>
+#include <stdarg.h>
+#include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 
 #include "cJSON.h"
 #include "driver/gpio.h"
 #include "esp_event.h"
-#include "esp_https_ota.h"
+#include "esp_heap_caps.h"
 #include "esp_http_client.h"
 #include "esp_log.h"
+#include "esp_mac.h"
 #include "esp_netif.h"
+#include "esp_ota_ops.h"
 #include "esp_app_desc.h"
+#include "esp_partition.h"
+#include "esp_random.h"
 #include "esp_system.h"
 #include "esp_timer.h"
 #include "esp_wifi.h"
@@ -21,8 +30,27 @@
 #include "freertos/task.h"
 #include "lwip/inet.h"
 #include "lwip/netdb.h"
+#include "lwip/sockets.h"
+#include "mbedtls/sha256.h"
 #include "soc/gpio_struct.h"
 
+#if CONFIG_SNIFFER_ENABLE_MQTT
+#include "mqtt_client.h"
+#endif
+#if CONFIG_SNIFFER_ENABLE_HTTPD
+#include "esp_http_server.h"
+#endif
+
+#if __has_include("esp32/rom/miniz.h")
+#include "esp32/rom/miniz.h"
+#define HAS_ROM_MINIZ 1
+#elif __has_include("rom/miniz.h")
+#include "rom/miniz.h"
+#define HAS_ROM_MINIZ 1
+#else
+#define HAS_ROM_MINIZ 0
+#endif
+
 #if __has_include("esp_crt_bundle.h")
 #include "esp_crt_bundle.h"
 #define HAS_CRT_BUNDLE 1
@@ -39,9 +67,19 @@
 #define WIFI_SSID CONFIG_SNIFFER_WIFI_SSID
 #define WIFI_PASS CONFIG_SNIFFER_WIFI_PASSWORD
 #define OTA_URL CONFIG_SNIFFER_OTA_FIRMWARE_URL
+#define OTA_MANIFEST_URL CONFIG_SNIFFER_OTA_MANIFEST_URL
+#define OTA_PATCH_URL CONFIG_SNIFFER_OTA_PATCH_URL
+#define OTA_DEFLATE_URL CONFIG_SNIFFER_OTA_DEFLATE_URL
 
 #define MAX_FRAME_BITS 64
 #define EVENT_QUEUE_LEN 256
+#define PIPE_FRAME_SLOTS 16
+#define PIPE_READING_SLOTS 16
+#define PIPE_FRAME_IDLE 0x01
+#define PIPE_FRAME_CYCLE_END 0x02
+#define PIPE_CAPTURE_STACK 3072
+#define PIPE_DECODE_STACK 4096
+#define PIPE_PUBLISH_STACK 4096
 #define MAX_MUX_SLOTS 8
 #define MUX_DIGIT_STALE_US (500LL * 1000LL)
 #define CROSS_FRAME_PAIR_US (20LL * 1000LL)
@@ -51,19 +89,168 @@
 #define PAUSE_SHORT_US 6000
 #define PAUSE_MID_US 11000
 #define PAUSE_LONG_US 18000
+#define BIT_EVENT_IDLE 0xFF
+#define DECODE_CACHE_SLOTS 32
+#define DECODE_NVS_NS "decode"
+#define DECODE_NVS_KEY_PROFILE "profile"
+#define DECODE_PROFILE_VERSION 1
+#define DECODE_LOCK_PCT 90
+#define DECODE_QUALITY_WINDOW 256
+#define DECODE_RELEARN_MISS_PCT 25
+#define LAYOUT_DIRECT 1
+#define LAYOUT_MUX 2
+#define LAYOUT_SINGLE 3
+// kind:2 | pos:3 | order:1 | mode:2; pos/order locate the (segment, selector)
+// pair of a mux frame, mode indexes active_low | bit_reversed << 1.
+#define LAYOUT_MAKE(kind, pos, order, mode) ((uint8_t)(((kind) << 6) | ((pos) << 3) | ((order) << 2) | (mode)))
+#define LAYOUT_KIND(l) (((l) >> 6) & 0x3)
+#define LAYOUT_POS(l) (((l) >> 3) & 0x7)
+#define LAYOUT_ORDER(l) (((l) >> 2) & 0x1)
+#define LAYOUT_MODE(l) ((l) & 0x3)
 #define MAX_CYCLE_BYTES 96
+#define STAB_DIGITS 4
+#define INDICATOR_MAX 16
+#define INDICATOR_NAME_MAX 12
+#define INDICATOR_EVENTS 16
+#define INDICATOR_JSON_MAX 256
+#define CAPTURE_SLOTS 8
+#define CAPTURE_CHUNK_MAX 1200
+#define CAPTURE_HDR_BYTES 20
+#define CAPTURE_MAGIC 0x4353
+#define CAPTURE_VERSION 1
+#define CAPTURE_REC_FRAME 0x01
+#define CAPTURE_FLAG_TRIGGER 0x01
+#define CAPTURE_FRAME_WORST(nbits) (2 + 5 + (size_t)(nbits) * 5 + (size_t)((nbits) + 7) / 8)
+#define CAPTURE_FLUSH_US 200000
+#define CAPTURE_RETRY_MS 5000
+#define CAPTURE_TASK_STACK 4096
+#define TRIGGER_RING_BYTES (CONFIG_SNIFFER_TRIGGER_RING_KB * 1024)
+#define TRIGGER_REC_HDR 10
+#define TRIGGER_REC_MAX (TRIGGER_REC_HDR + CAPTURE_FRAME_WORST(MAX_FRAME_BITS))
+#define TRIGGER_SPEC_MAX 48
+#define GLYPH_NONE 0x0F
+#define GLYPH_MAX_FIX 1
+#define STAB_WINDOW CONFIG_SNIFFER_STAB_WINDOW
+#define STAB_AGREE (CONFIG_SNIFFER_STAB_AGREE < STAB_WINDOW ? CONFIG_SNIFFER_STAB_AGREE : STAB_WINDOW)
+#define STAB_HIST_MASK ((1ULL << (4 * STAB_WINDOW)) - 1)
+#define STAB_VOTE_EXACT 2
+#define STAB_VOTE_FIXED 1
+// Weighted votes a digit needs; capped so a run of corrected frames filling
+// the whole window still publishes, at half the confidence.
+#define STAB_NEED (STAB_AGREE * STAB_VOTE_EXACT < STAB_WINDOW ? STAB_AGREE * STAB_VOTE_EXACT : STAB_WINDOW)
 
 #define TELEGRAM_POLL_TIMEOUT_S 5
 #define TELEGRAM_RESP_MAX 2048
+#define TELEGRAM_API_URL CONFIG_SNIFFER_TELEGRAM_API_URL
+#define JSON_ARENA_BYTES (TELEGRAM_RESP_MAX * 4)
+// Any task that may call telegram_send_text() runs the TLS handshake on its own stack.
+#define TELEGRAM_SEND_STACK 8192
+#define TELEMETRY_MAX_TASKS 24
+#define TELEMETRY_TASK_HEADROOM 4
+#define TELEMETRY_TASK_STACK TELEGRAM_SEND_STACK
+#define TG_CMD_ARG_MAX 64
+#define TG_CMD_QUEUE_LEN 8
+#define TG_CMD_WORKER_STACK TELEGRAM_SEND_STACK
 #define STATUS_STALE_US (15LL * 1000LL * 1000LL)
 #define OTA_HTTP_RX_BUFFER 8192
 #define OTA_HTTP_TX_BUFFER 1024
 #define OTA_HTTP_TIMEOUT_MS 30000
+#define OTA_TASK_STACK 8192
+#define OTA_PROGRESS_STEP_PCT 25
+#define OTA_CHUNK_BYTES 4096
+#define OTA_MANIFEST_MAX 512
+#define OTA_MAX_REDIRECTS 5
+#define OTA_INFLATE_DICT_BYTES 4096
+#define OTA_INFLATE_IN_BYTES 1024
+#define OTA_PATCH_MAGIC 0x31504453u
+#define OTA_PATCH_OLD_BYTES 256
+#define OTA_PATCH_OUT_BYTES 1024
+#define PUSH_ENABLED (CONFIG_SNIFFER_ENABLE_PUSH || CONFIG_SNIFFER_ENABLE_MQTT || CONFIG_SNIFFER_ENABLE_RLOG)
+#define FRAME_TIMING_ENABLED (CONFIG_SNIFFER_CAPTURE_STREAM || CONFIG_SNIFFER_ENABLE_TRIGGER)
+#define PUSH_QUEUE_LEN 8
+#define PUSH_TASK_STACK TELEGRAM_SEND_STACK
+#define PUSH_MIN_INTERVAL_US ((int64_t)CONFIG_SNIFFER_PUSH_MIN_INTERVAL_MS * 1000LL)
+#define MQTT_TOPIC_MAX 96
+#define MQTT_PAYLOAD_MAX 1536
+// /metrics worst case: fixed counters plus each enabled section at full width.
+#define METRICS_JSON_CORE 1792
+#if CONFIG_SNIFFER_ENABLE_TELEMETRY
+#define METRICS_JSON_TELEMETRY (64 + TELEMETRY_MAX_TASKS * (configMAX_TASK_NAME_LEN + 16))
+#else
+#define METRICS_JSON_TELEMETRY 0
+#endif
+#if CONFIG_SNIFFER_ENABLE_TELEGRAM
+#define METRICS_JSON_CMD 512
+#else
+#define METRICS_JSON_CMD 0
+#endif
+#if CONFIG_SNIFFER_CAPTURE_STREAM
+#define METRICS_JSON_CAPTURE 192
+#else
+#define METRICS_JSON_CAPTURE 0
+#endif
+#if CONFIG_SNIFFER_ENABLE_TRIGGER
+#define METRICS_JSON_TRIGGER 128
+#else
+#define METRICS_JSON_TRIGGER 0
+#endif
+#if CONFIG_SNIFFER_STABILISER
+#define METRICS_JSON_STABILISER 160
+#else
+#define METRICS_JSON_STABILISER 0
+#endif
+#if CONFIG_SNIFFER_DECODE_LEARN
+#define METRICS_JSON_PROFILE 192
+#else
+#define METRICS_JSON_PROFILE 0
+#endif
+#if CONFIG_SNIFFER_ENABLE_RLOG
+#define METRICS_JSON_RLOG 256
+#else
+#define METRICS_JSON_RLOG 0
+#endif
+#define METRICS_JSON_SECTIONS (METRICS_JSON_CMD + METRICS_JSON_CAPTURE + METRICS_JSON_TRIGGER + METRICS_JSON_STABILISER)
+#define METRICS_JSON_MAX (METRICS_JSON_CORE + METRICS_JSON_TELEMETRY + METRICS_JSON_SECTIONS + METRICS_JSON_PROFILE + METRICS_JSON_RLOG)
+#define STREAM_KEEPALIVE_MS 15000
+#define STREAM_EVENT_MAX (192 + INDICATOR_JSON_MAX)
+#define HISTORY_BLOCK_BYTES 256
+#define HISTORY_BLOCKS ((CONFIG_SNIFFER_HISTORY_RING_KB * 1024) / HISTORY_BLOCK_BYTES)
+#define HISTORY_RECORD_MAX 16
+#define HISTORY_RECENT_MAX 5
+#define HISTORY_DEFAULT_RANGE_MS (3600LL * 1000LL)
+#define HISTORY_HAS_VALUE 0x08
+#define HISTORY_RANK_MASK 0x07
+#define RLOG_MAGIC 0x31474C52U
+#define RLOG_SECTOR_BYTES 4096
+#define RLOG_PAGE_BYTES 256
+#define RLOG_RECORD_BYTES 16
+#define RLOG_PAGE_RECORDS (RLOG_PAGE_BYTES / RLOG_RECORD_BYTES)
+#define RLOG_SECTOR_SLOTS (RLOG_SECTOR_BYTES / RLOG_RECORD_BYTES)
+#define RLOG_MAX_SECTORS 256
+#define RLOG_FLAG_HAS_VALUE 0x01
+#define RLOG_FLAG_CORRECTED 0x02
+#define RLOG_NVS_NS "rlog"
+#define RLOG_NVS_KEY_BOOT "boot"
 
 #define WIFI_CONNECTED_BIT BIT0
+#define WIFI_NVS_NS "wifi"
+#define WIFI_NVS_KEY_FAST "fast"
+#define WIFI_CONNECT_TIMEOUT_MS 15000
+#define DNS_READY_POLL_MS 50
+#define DNS_CACHE_HOSTS 6
+#define DNS_HOST_MAX 64
+#define DNS_CACHE_TTL_US ((int64_t)CONFIG_SNIFFER_DNS_CACHE_TTL_S * 1000000LL)
+#define DNS_REFRESH_PERIOD_MS 30000
+#define DNS_NVS_NS "dns"
+#define DNS_NVS_KEY_LKG "lkg"
+#define HTTP_URL_MAX 1024
+#define NET_BACKOFF_BASE_MS 1000
+#define TELEGRAM_SEND_ATTEMPTS 3
+#define TELEGRAM_SEND_MAX_WAIT_MS 10000
 #define TELEGRAM_NVS_NS "telegram"
 #define TELEGRAM_NVS_KEY_OFFSET "next_offset"
 
+// bit is 0/1 for a clock edge, BIT_EVENT_IDLE for the idle timer's marker.
 typedef struct {
     uint8_t bit;
     int64_t ts_us;
@@ -75,10 +262,428 @@ typedef struct {
     size_t cap;
 } http_resp_buf_t;
 
+// Bump allocator for the cJSON tree of one getUpdates response. Only the
+// owning task allocates from it; everyone else (and the owner on overflow)
+// falls through to malloc, and frees inside the buffer are no-ops.
+typedef struct {
+    uint8_t *base;
+    size_t cap;
+    size_t used;
+    size_t peak;
+    uint32_t overflows;
+    uint32_t resets;
+    TaskHandle_t owner;
+} json_arena_t;
+
+typedef struct {
+    size_t largest;
+    size_t largest_min;
+} heap_track_t;
+
+typedef struct {
+    char name[configMAX_TASK_NAME_LEN];
+    uint32_t stack_free;
+    int16_t cpu_pct;  // share of all cores over the last period, -1 = no run-time stats
+} telemetry_task_t;
+
+typedef struct {
+    int64_t sampled_us;
+    uint32_t internal_free;
+    uint32_t psram_free;
+    uint32_t largest;
+    uint32_t alerts;
+    uint8_t ntasks;
+    uint16_t more;  // tasks sampled but not listed in tasks[]
+    telemetry_task_t tasks[TELEMETRY_MAX_TASKS];
+} telemetry_t;
+
+// Last run-time counter per task, to turn the totals into a per-period share.
+typedef struct {
+    TaskHandle_t handle;
+    uint32_t runtime;
+    bool armed;
+} telemetry_prev_t;
+
+typedef struct {
+    char host[DNS_HOST_MAX];
+    uint32_t addr;
+    int64_t resolved_us;
+    int64_t used_us;
+} dns_cache_entry_t;
+
+typedef struct {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t refreshes;
+    uint32_t failures;
+    uint32_t stale_served;
+} dns_cache_stats_t;
+
+// One per remote service. CLOSED: calls go through, failures back off with
+// jitter. OPEN: after too many consecutive failures every call is refused
+// until the cooldown ends. HALF_OPEN: one probe is in flight; its result
+// closes or reopens the breaker.
+typedef enum {
+    NET_GUARD_CLOSED = 0,
+    NET_GUARD_OPEN,
+    NET_GUARD_HALF_OPEN,
+} net_guard_state_t;
+
+typedef struct {
+    const char *name;
+    net_guard_state_t state;
+    uint32_t failures;
+    int64_t next_us;
+    uint32_t trips;
+    uint32_t rejected;
+    uint32_t throttled;
+} net_guard_t;
+
+// Kept alive between requests; Host/SNI stay on the name while the socket
+// goes to the cached address.
+typedef struct {
+    esp_http_client_handle_t handle;
+    char host[DNS_HOST_MAX];
+    char ip[16];
+    http_resp_buf_t resp;
+} http_conn_t;
+
+typedef struct {
+    char decoded[16];
+    char status[24];
+    int64_t frame_us;
+} push_msg_t;
+
+typedef struct {
+    volatile uint32_t isr_events;
+    volatile uint32_t isr_dropped;
+    uint32_t frames;
+    uint32_t frames_misaligned;
+    uint32_t frame_overflows;
+    uint32_t decode_ok;
+    uint32_t decode_partial;
+    uint32_t decode_unknown;
+    uint32_t queue_peak;
+    uint32_t ota_dropped;
+    uint32_t ota_queue_peak;
+    uint32_t idle_flushes;
+    uint32_t idle_flush_last_us;
+    uint32_t idle_flush_max_us;
+    uint32_t corrected_frames;
+    uint32_t corrected_bits;
+} capture_metrics_t;
+
+// One named lamp/icon: a bit of a frame byte (optionally only frames of one
+// mux slot) or of the cycle buffer. Parsed once from SNIFFER_INDICATORS.
+typedef struct {
+    char name[INDICATOR_NAME_MAX];
+    uint8_t byte;
+    uint8_t mask;
+    int8_t slot;
+    bool invert;
+    bool cycle;
+} indicator_t;
+
+typedef struct {
+    uint8_t index;
+    bool on;
+    int64_t t_us;
+} indicator_event_t;
+
+// Raw capture stream (docs/capture-format.md). decode_task encodes frames
+// straight into a pool slot; only slot indices cross to capture_task, which
+// hands the slot memory to the socket as is.
+typedef struct {
+    uint16_t len;
+    uint8_t data[CAPTURE_CHUNK_MAX];
+} capture_chunk_t;
+
+typedef struct {
+    QueueHandle_t free_q;
+    QueueHandle_t full_q;
+    int cur;
+    int64_t opened_us;
+    uint32_t seq;
+    uint32_t pending_drops;
+    uint32_t frames;
+    uint32_t dropped;
+    uint32_t chunks;
+    uint32_t bytes;
+    uint32_t discarded;
+    uint32_t send_errors;
+    uint32_t connects;
+} capture_stream_t;
+
+// Edge timing of one frame. sniffer_task fills it in the frame's pipeline
+// slot; decode_task's encoders read it through s_frame_timing.
+typedef struct {
+    int64_t ts_us;
+    uint8_t gap;
+    uint32_t bit_dt[MAX_FRAME_BITS];
+} frame_timing_t;
+
+// Trigger capture. decode_task appends every frame, encoded as in the
+// capture stream, to the live ring. When the armed condition hits, the frames
+// from pre_ms before to post_ms after it stay in that buffer (the slot) and
+// recording moves to the other one. Ring record: u16 len, i64 first edge
+// time, frame record.
+typedef enum {
+    TRIGGER_OFF = 0,
+    TRIGGER_STATUS,
+    TRIGGER_PATTERN,
+    TRIGGER_VALUE,
+    TRIGGER_GAP,
+} trigger_kind_t;
+
+typedef enum {
+    TRIGGER_IDLE = 0,
+    TRIGGER_ARMED,
+    TRIGGER_POST,
+    TRIGGER_HELD,
+} trigger_state_t;
+
+typedef struct {
+    trigger_kind_t kind;
+    int8_t rank_min;
+    int8_t rank_max;
+    uint8_t nbits;
+    uint8_t gap;
+    uint64_t pattern;
+    uint64_t mask;
+    char value[16];
+    uint32_t pre_ms;
+    uint32_t post_ms;
+    char spec[TRIGGER_SPEC_MAX];
+} trigger_cond_t;
+
+typedef struct {
+    uint8_t buf;
+    uint32_t start;
+    uint32_t trig_pos;
+    uint32_t bytes;
+    uint32_t frames;
+    int64_t trig_us;
+    int64_t first_us;
+    int64_t last_us;
+    bool truncated;
+    char spec[TRIGGER_SPEC_MAX];
+} trigger_slot_t;
+
+typedef struct {
+    // Guarded by s_state_mutex: the httpd side arms and releases.
+    trigger_cond_t pending;
+    volatile uint32_t pending_seq;
+    volatile bool slot_ready;
+    trigger_slot_t slot;
+    // decode_task only.
+    trigger_cond_t cond;
+    uint32_t cond_seq;
+    trigger_state_t state;
+    uint8_t live;
+    uint32_t head;
+    uint32_t tail;
+    uint32_t used;
+    uint32_t last_pos;
+    int64_t last_us;
+    trigger_slot_t win;
+    uint32_t fired;
+    uint32_t captures;
+    uint32_t truncated;
+} trigger_t;
+
+// Pipeline: sniffer_task (edges to frames) -> decode_task (frames to
+// readings) -> publish_task (shared state, history, push, SSE). Each link is
+// a single-producer/single-consumer ring: only the producer moves head and
+// only the consumer moves tail, so neither side locks. A full ring drops the
+// new item rather than block the stage before it.
+typedef struct {
+    uint8_t *slots;
+    uint16_t count;
+    uint16_t size;
+    uint32_t head;
+    uint32_t tail;
+    uint32_t peak;
+    uint32_t dropped;
+    TaskHandle_t consumer;
+} spsc_ring_t;
+
+// nbits 0 carries only flags (a cycle that ended with no frame pending).
+typedef struct {
+    uint8_t bits[MAX_FRAME_BITS];
+    uint8_t nbits;
+    uint8_t gap_after;
+    uint8_t flags;
+    int64_t last_ts_us;
+#if FRAME_TIMING_ENABLED
+    frame_timing_t timing;
+#endif
+} pipe_frame_t;
+
+// A decoded frame, or (reading false) an indicator update from a cycle.
+typedef struct {
+    bool reading;
+    bool publish;
+    bool repeat;
+    bool indicators;
+    int8_t rank;
+    uint8_t nbits;
+    uint32_t ind_state;
+    uint32_t ind_known;
+    int64_t frame_us;
+    char decoded[16];
+    char status[24];
+    char hex[64];
+    char raw[96];
+} pipe_reading_t;
+
+typedef struct {
+    char decoded[16];
+    char status[16];
+    int64_t frame_us;
+} mqtt_reading_t;
+
+typedef struct {
+    int64_t first_ms;
+    int64_t last_ms;
+    int64_t prev_ms;
+    int32_t prev_value;
+    uint16_t used;
+    uint16_t count;
+    uint8_t data[HISTORY_BLOCK_BYTES];
+} history_block_t;
+
+typedef struct {
+    int64_t slot;
+    int16_t min;
+    int16_t max;
+    // Fed once per published frame: an hour at tens of frames per second
+    // overflows 16-bit counts and 32-bit sums.
+    uint32_t n;
+    uint32_t bad;
+    int64_t sum;
+} history_bucket_t;
+
+typedef struct {
+    const char *name;
+    int64_t res_ms;
+    int len;
+    history_bucket_t *buckets;
+} history_tier_t;
+
+typedef struct {
+    int64_t start_ms;
+    int64_t last_ms;
+    int32_t value;
+    uint8_t rank;
+    bool has_value;
+} history_run_t;
+
+typedef struct {
+    int64_t from_ms;
+    uint32_t count;
+} history_count_ctx_t;
+
+// Reading log layout: every 4 KB sector starts with a header in slot 0,
+// followed by 255 fixed 16-byte records. See tools/rlog_dump.py.
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint32_t sector_seq;
+    uint32_t first_seq;
+    uint16_t boot;
+    uint16_t crc;
+} rlog_sector_hdr_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t seq;
+    uint32_t uptime_ms;
+    uint16_t boot;
+    int16_t value;
+    uint8_t rank;
+    uint8_t flags;
+    uint16_t crc;
+} rlog_record_t;
+
+_Static_assert(sizeof(rlog_sector_hdr_t) == RLOG_RECORD_BYTES, "rlog header size");
+_Static_assert(sizeof(rlog_record_t) == RLOG_RECORD_BYTES, "rlog record size");
+
+// Per sector, what the export's seek by seq needs; sector_seq 0 = unused.
+typedef struct {
+    uint32_t sector_seq;
+    uint32_t first_seq;
+} rlog_index_t;
+
+typedef struct {
+    uint32_t appended;
+    uint32_t program_ops;
+    uint32_t bytes_programmed;
+    uint32_t erases;
+    uint32_t crc_errors;
+    int64_t write_time_us;
+} rlog_stats_t;
+
+typedef bool (*rlog_emit_fn)(const rlog_record_t *rec, void *ctx);
+
+// Last AP that gave us an IP; lets the next boot skip the scan.
+typedef struct {
+    char ssid[32];
+    uint8_t bssid[6];
+    uint8_t channel;
+} wifi_fast_cache_t;
+
+// Boot milestones, esp_timer time in us (0 = not reached yet).
+typedef struct {
+    int64_t wifi_start_us;
+    int64_t assoc_us;
+    int64_t got_ip_us;
+    int64_t dns_us;
+    int64_t first_poll_us;
+    bool fast_connect;
+    bool static_ip;
+} boot_timing_t;
+
+typedef struct {
+    int64_t range_ms;
+    const history_tier_t *tier;
+    int32_t min;
+    int32_t max;
+    int64_t sum;
+    uint32_t n;
+    uint32_t bad;
+    uint32_t changes;
+} history_summary_t;
+
+typedef struct {
+    char candidate[16];
+    int candidate_frames;
+    char published[16];
+    bool has_published;
+    int64_t last_push_us;
+    uint32_t dropped;
+} push_state_t;
+
 static QueueHandle_t s_bit_queue;
+static QueueHandle_t s_push_queue;
 static EventGroupHandle_t s_wifi_events;
 static SemaphoreHandle_t s_state_mutex;
 static esp_netif_t *s_sta_netif;
+static wifi_fast_cache_t s_wifi_cache;
+static bool s_wifi_fast_pending;
+static SemaphoreHandle_t s_dns_mutex;
+static SemaphoreHandle_t s_net_guard_mutex;
+static SemaphoreHandle_t s_tg_send_mutex;
+static net_guard_t s_guard_telegram = {.name = "telegram"};
+static net_guard_t s_guard_ota = {.name = "ota"};
+static uint8_t s_json_arena_buf[JSON_ARENA_BYTES] __attribute__((aligned(8)));
+static json_arena_t s_json_arena = {
+    .base = s_json_arena_buf,
+    .cap = sizeof(s_json_arena_buf),
+};
+static heap_track_t s_heap;
+static telemetry_t s_telemetry;
+static dns_cache_entry_t s_dns_cache[DNS_CACHE_HOSTS];
+static dns_cache_stats_t s_dns_stats;
+static TaskHandle_t s_dns_task;
+static boot_timing_t s_boot;
 
 static char s_last_raw[96];
 static char s_last_hex[64];
@@ -92,6 +697,82 @@ static int64_t s_mux_seen_us[MAX_MUX_SLOTS];
 static bool s_prev_single_valid;
 static uint8_t s_prev_single_byte;
 static int64_t s_prev_single_ts_us;
+static uint32_t s_state_seq;
+static indicator_t s_indicators[INDICATOR_MAX];
+static int s_indicator_count;
+// Guarded by s_state_mutex, like the rest of the published state.
+static uint32_t s_indicator_state;
+static uint32_t s_indicator_known;
+static indicator_event_t s_indicator_events[INDICATOR_EVENTS];
+static int s_indicator_event_head;
+static int s_indicator_event_count;
+static uint32_t s_indicator_events_lost;
+// decode_task's running sample; publish_task commits it to s_indicator_state.
+static uint32_t s_indicator_sampled;
+static uint32_t s_indicator_sampled_known;
+static pipe_frame_t s_pipe_frames[PIPE_FRAME_SLOTS];
+static pipe_reading_t s_pipe_readings[PIPE_READING_SLOTS];
+static spsc_ring_t s_frame_ring = {
+    .slots = (uint8_t *)s_pipe_frames,
+    .count = PIPE_FRAME_SLOTS,
+    .size = sizeof(pipe_frame_t),
+};
+static spsc_ring_t s_reading_ring = {
+    .slots = (uint8_t *)s_pipe_readings,
+    .count = PIPE_READING_SLOTS,
+    .size = sizeof(pipe_reading_t),
+};
+#if CONFIG_SNIFFER_CAPTURE_STREAM
+static capture_chunk_t s_capture_chunks[CAPTURE_SLOTS];
+static capture_stream_t s_capture = {.cur = -1};
+#endif
+#if FRAME_TIMING_ENABLED
+// Timing of the frame decode_task is handling (lives in its pipeline slot copy).
+static const frame_timing_t *s_frame_timing;
+#endif
+#if CONFIG_SNIFFER_ENABLE_TRIGGER
+static uint8_t s_trigger_buf[2][TRIGGER_RING_BYTES];
+static trigger_t s_trigger;
+#endif
+static TaskHandle_t s_stream_task;
+static push_state_t s_push;
+static capture_metrics_t s_metrics;
+
+// Producer side. Never blocks; the consumer is woken by notification.
+static bool spsc_push(spsc_ring_t *r, const void *item)
+{
+    uint32_t head = r->head;
+    uint32_t depth = head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    if (depth >= r->count) {
+        r->dropped++;
+        return false;
+    }
+    memcpy(r->slots + (head % r->count) * r->size, item, r->size);
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+    if (depth + 1 > r->peak) {
+        r->peak = depth + 1;
+    }
+    if (r->consumer) {
+        xTaskNotifyGive(r->consumer);
+    }
+    return true;
+}
+
+static bool spsc_pop(spsc_ring_t *r, void *item)
+{
+    uint32_t tail = r->tail;
+    if (__atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == tail) {
+        return false;
+    }
+    memcpy(item, r->slots + (tail % r->count) * r->size, r->size);
+    __atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+static uint32_t spsc_depth(const spsc_ring_t *r)
+{
+    return __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+}
 
 static inline uint32_t IRAM_ATTR gpio_level_fast(gpio_num_t gpio_num)
 {
@@ -185,6 +866,78 @@ typedef struct {
     bool bit_reversed;
 } decode_mode_t;
 
+// Result of decoding one byte sequence that depends on nothing but the bytes.
+// A mux hit leaves mux_slot/mux_digit for decode_apply, which merges it with
+// the other slots.
+typedef struct {
+    char decoded[8];
+    const char *status;
+    int8_t mux_slot;
+    int8_t mux_digit;
+    uint8_t layout;
+    uint8_t corrected;
+} decode_core_t;
+
+// Display controllers repeat a few frame patterns endlessly; cache the pure
+// part of their decode keyed by the packed frame. ctx carries the previous
+// single byte (0x100 | byte) when a 1-byte frame is paired across frames.
+typedef struct {
+    uint64_t packed;
+    uint16_t ctx;
+    uint8_t nbits;
+    bool valid;
+    bool fast;
+    char hex[24];
+    decode_core_t core;
+    decode_core_t pair;
+} decode_cache_entry_t;
+
+// Persisted in NVS once learned; the layout every frame of this display uses.
+typedef struct {
+    uint8_t version;
+    uint8_t layout;
+    uint8_t nbytes;
+    uint8_t reserved;
+} decode_profile_t;
+
+typedef struct {
+    bool locked;
+    decode_profile_t profile;
+    uint32_t seen;
+    uint16_t layout_hits[256];
+    uint16_t len_hits[9];
+    uint16_t window;
+    uint16_t window_miss;
+    uint32_t fast;
+    uint32_t fallback;
+    uint32_t relearns;
+} decode_learner_t;
+
+// Per digit position: the last STAB_WINDOW symbols as nibbles in history,
+// and one 5-bit weighted vote counter per symbol (0-9, 10 = non-digit) in
+// votes. Bit i of fixed_hist marks the frame i places back as corrected.
+typedef struct {
+    uint64_t history[STAB_DIGITS];
+    uint64_t votes[STAB_DIGITS];
+    uint16_t fixed_hist;
+    uint8_t fill;
+    uint8_t len;
+    uint8_t confidence;
+    bool has_stable;
+    char stable[STAB_DIGITS + 1];
+    uint32_t frames;
+    uint32_t published;
+    uint32_t held;
+    uint32_t disagree;
+} stabiliser_t;
+
+static decode_cache_entry_t s_decode_cache[DECODE_CACHE_SLOTS];
+static decode_learner_t s_learn;
+static stabiliser_t s_stab;
+static uint8_t s_glyph_table[4][256];
+static uint32_t s_decode_cache_hits;
+static uint32_t s_decode_cache_misses;
+
 static uint8_t reverse_bits8(uint8_t v)
 {
     v = (uint8_t)(((v & 0xF0) >> 4) | ((v & 0x0F) << 4));
@@ -207,22 +960,63 @@ static int selector_slot_from_byte(uint8_t v, bool *active_low)
     return -1;
 }
 
-static int seg_to_digit(uint8_t seg, decode_mode_t mode)
+static uint8_t mode_index(decode_mode_t mode)
 {
-    uint8_t norm = seg & 0x7F;
-    if (mode.bit_reversed) {
-        norm = reverse_bits8(norm) & 0x7F;
-    }
-    if (mode.active_low) {
-        norm = (~norm) & 0x7F;
-    }
+    return (uint8_t)((mode.active_low ? 1 : 0) | (mode.bit_reversed ? 2 : 0));
+}
 
-    for (int i = 0; i < 10; ++i) {
-        if (norm == seg_map[i]) {
-            return i;
+static decode_mode_t mode_from_index(uint8_t index)
+{
+    decode_mode_t mode = {.active_low = (index & 1) != 0, .bit_reversed = (index & 2) != 0};
+    return mode;
+}
+
+// For every mode and raw byte: the nearest glyph (GLYPH_NONE on a tie) in
+// the low nibble and its Hamming distance in the high nibble.
+static void glyph_table_init(void)
+{
+    for (uint8_t m = 0; m < 4; ++m) {
+        decode_mode_t mode = mode_from_index(m);
+        for (int b = 0; b < 256; ++b) {
+            uint8_t norm = (uint8_t)b & 0x7F;
+            if (mode.bit_reversed) {
+                norm = reverse_bits8(norm) & 0x7F;
+            }
+            if (mode.active_low) {
+                norm = (~norm) & 0x7F;
+            }
+
+            int best = GLYPH_NONE;
+            int best_dist = 8;
+            for (int i = 0; i < 10; ++i) {
+                int dist = __builtin_popcount(norm ^ seg_map[i]);
+                if (dist < best_dist) {
+                    best = i;
+                    best_dist = dist;
+                } else if (dist == best_dist) {
+                    best = GLYPH_NONE;
+                }
+            }
+            s_glyph_table[m][b] = (uint8_t)(best | (best_dist << 4));
         }
     }
-    return -1;
+}
+
+static int seg_to_digit(uint8_t seg, decode_mode_t mode)
+{
+    uint8_t g = s_glyph_table[mode_index(mode)][seg];
+    return (g >> 4) == 0 ? (g & 0x0F) : -1;
+}
+
+// Like seg_to_digit, but also accepts a glyph up to GLYPH_MAX_FIX bits away.
+static int seg_to_digit_near(uint8_t seg, decode_mode_t mode, int *dist)
+{
+    uint8_t g = s_glyph_table[mode_index(mode)][seg];
+    if ((g & 0x0F) == GLYPH_NONE || (g >> 4) > GLYPH_MAX_FIX) {
+        return -1;
+    }
+    *dist = g >> 4;
+    return g & 0x0F;
 }
 
 static bool decode_segment_byte(uint8_t seg, int *digit, decode_mode_t *mode_used)
@@ -259,11 +1053,10 @@ static const char *mode_tag(decode_mode_t mode)
     return "al_lsb";
 }
 
-static bool build_mux_2digit(char *decoded, size_t decoded_len)
+static bool build_mux_2digit(char *decoded, size_t decoded_len, int64_t now)
 {
     int first_slot = -1;
     int second_slot = -1;
-    int64_t now = esp_timer_get_time();
 
     for (int i = 0; i < MAX_MUX_SLOTS; ++i) {
         if (!s_mux_valid[i]) {
@@ -307,6 +1100,21 @@ static int decode_status_rank(const char *status)
     return 0;
 }
 
+static bool parse_decoded_value(const char *decoded, long *value)
+{
+    if (!decoded || decoded[0] == '\0') {
+        return false;
+    }
+
+    char *end = NULL;
+    long v = strtol(decoded, &end, 10);
+    if (!end || *end != '\0') {
+        return false;
+    }
+    *value = v;
+    return true;
+}
+
 static void build_raw_string(const uint8_t *bits, int nbits, char *out, size_t out_len)
 {
     int max_bits = (int)out_len - 1;
@@ -353,10 +1161,14 @@ static void build_hex_string(const uint8_t *bytes, int nbytes, char *out, size_t
     }
 }
 
-static void decode_digits(const uint8_t *bytes, int nbytes, char *decoded, size_t decoded_len, const char **status)
+static void decode_core(const uint8_t *bytes, int nbytes, decode_core_t *out)
 {
-    snprintf(decoded, decoded_len, "unknown");
-    *status = "unknown";
+    snprintf(out->decoded, sizeof(out->decoded), "unknown");
+    out->status = "unknown";
+    out->mux_slot = -1;
+    out->mux_digit = -1;
+    out->layout = 0;
+    out->corrected = 0;
 
     if (nbytes <= 0) {
         return;
@@ -374,8 +1186,9 @@ static void decode_digits(const uint8_t *bytes, int nbytes, char *decoded, size_
             int d0 = seg_to_digit(bytes[0], modes[i]);
             int d1 = seg_to_digit(bytes[1], modes[i]);
             if (d0 >= 0 && d1 >= 0) {
-                snprintf(decoded, decoded_len, "%d%d", d0, d1);
-                *status = "ok(direct)";
+                snprintf(out->decoded, sizeof(out->decoded), "%d%d", d0, d1);
+                out->status = "ok(direct)";
+                out->layout = LAYOUT_MAKE(LAYOUT_DIRECT, 0, 0, i);
                 return;
             }
         }
@@ -398,16 +1211,11 @@ static void decode_digits(const uint8_t *bytes, int nbytes, char *decoded, size_
                 continue;
             }
 
-            s_mux_digit[slot] = digit;
-            s_mux_valid[slot] = true;
-            s_mux_seen_us[slot] = esp_timer_get_time();
-
-            if (build_mux_2digit(decoded, decoded_len)) {
-                *status = "ok(mux)";
-            } else {
-                snprintf(decoded, decoded_len, "%d?", digit);
-                *status = "partial(mux)";
-            }
+            out->mux_slot = (int8_t)slot;
+            out->mux_digit = (int8_t)digit;
+            snprintf(out->decoded, sizeof(out->decoded), "%d?", digit);
+            out->status = "partial(mux)";
+            out->layout = LAYOUT_MAKE(LAYOUT_MUX, i, p, mode_index(mode));
             ESP_LOGD(TAG, "mux slot=%d digit=%d sel=%s mode=%s", slot, digit, sel_active_low ? "active_low" : "active_high", mode_tag(mode));
             return;
         }
@@ -417,740 +1225,5544 @@ static void decode_digits(const uint8_t *bytes, int nbytes, char *decoded, size_
         int d = -1;
         decode_mode_t mode = {0};
         if (decode_segment_byte(bytes[0], &d, &mode)) {
-            snprintf(decoded, decoded_len, "%d?", d);
-            *status = "partial(single)";
+            snprintf(out->decoded, sizeof(out->decoded), "%d?", d);
+            out->status = "partial(single)";
+            out->layout = LAYOUT_MAKE(LAYOUT_SINGLE, 0, 0, mode_index(mode));
             return;
         }
     }
 
     if (nbytes >= 2) {
-        *status = "partial";
+        out->status = "partial";
         return;
     }
 }
 
-static esp_err_t telegram_http_event_handler(esp_http_client_event_t *evt)
+// Learned-layout decode: one mode, one position, no search. Returns false when
+// the frame does not fit the profile; the caller then runs decode_core.
+static bool decode_profile_core(const uint8_t *bytes, int nbytes, const decode_profile_t *profile, decode_core_t *out)
 {
-    http_resp_buf_t *buf = (http_resp_buf_t *)evt->user_data;
-
-    if (evt->event_id == HTTP_EVENT_ON_DATA && buf && evt->data && evt->data_len > 0) {
-        if (buf->len + (size_t)evt->data_len >= buf->cap) {
-            size_t available = (buf->cap > buf->len + 1) ? (buf->cap - buf->len - 1) : 0;
-            if (available > 0) {
-                memcpy(buf->data + buf->len, evt->data, available);
-                buf->len += available;
-                buf->data[buf->len] = '\0';
-            }
-            return ESP_ERR_NO_MEM;
+    if (nbytes != profile->nbytes) {
+        return false;
+    }
+    uint8_t layout = profile->layout;
+    decode_mode_t mode = mode_from_index(LAYOUT_MODE(layout));
+    int e0 = 0;
+    int e1 = 0;
+    out->mux_slot = -1;
+    out->mux_digit = -1;
+    out->layout = layout;
+    out->corrected = 0;
+
+    // The mode is known, so a glyph one bit away is a safe correction here.
+    switch (LAYOUT_KIND(layout)) {
+    case LAYOUT_DIRECT: {
+        int d0 = seg_to_digit_near(bytes[0], mode, &e0);
+        int d1 = seg_to_digit_near(bytes[1], mode, &e1);
+        if (d0 < 0 || d1 < 0 || e0 + e1 > GLYPH_MAX_FIX) {
+            return false;
         }
-
-        memcpy(buf->data + buf->len, evt->data, evt->data_len);
-        buf->len += (size_t)evt->data_len;
-        buf->data[buf->len] = '\0';
+        snprintf(out->decoded, sizeof(out->decoded), "%d%d", d0, d1);
+        out->status = (e0 + e1) ? "ok(fixed)" : "ok(direct)";
+        out->corrected = (uint8_t)(e0 + e1);
+        return true;
+    }
+    case LAYOUT_MUX: {
+        int pos = LAYOUT_POS(layout);
+        if (pos + 1 >= nbytes) {
+            return false;
+        }
+        uint8_t seg = LAYOUT_ORDER(layout) ? bytes[pos + 1] : bytes[pos];
+        uint8_t sel = LAYOUT_ORDER(layout) ? bytes[pos] : bytes[pos + 1];
+        bool sel_active_low = false;
+        int slot = selector_slot_from_byte(sel, &sel_active_low);
+        int digit = seg_to_digit_near(seg, mode, &e0);
+        if (slot < 0 || slot >= MAX_MUX_SLOTS || digit < 0) {
+            return false;
+        }
+        out->corrected = (uint8_t)e0;
+        out->mux_slot = (int8_t)slot;
+        out->mux_digit = (int8_t)digit;
+        snprintf(out->decoded, sizeof(out->decoded), "%d?", digit);
+        out->status = "partial(mux)";
+        return true;
+    }
+    case LAYOUT_SINGLE: {
+        int d = seg_to_digit_near(bytes[0], mode, &e0);
+        if (d < 0) {
+            return false;
+        }
+        out->corrected = (uint8_t)e0;
+        snprintf(out->decoded, sizeof(out->decoded), "%d?", d);
+        out->status = "partial(single)";
+        return true;
+    }
+    default:
+        return false;
     }
-
-    return ESP_OK;
 }
 
-static bool telegram_http_get(const char *url, char *out, size_t out_len)
+static bool decode_profile_valid(const decode_profile_t *profile)
 {
-    out[0] = '\0';
-    http_resp_buf_t resp = {
-        .data = out,
-        .len = 0,
-        .cap = out_len,
-    };
-
-    esp_http_client_config_t cfg = {
-        .url = url,
-        .method = HTTP_METHOD_GET,
-        .timeout_ms = (TELEGRAM_POLL_TIMEOUT_S + 5) * 1000,
-        .event_handler = telegram_http_event_handler,
-        .user_data = &resp,
-    };
-#if HAS_CRT_BUNDLE
-    cfg.crt_bundle_attach = esp_crt_bundle_attach;
-#endif
+    uint8_t kind = LAYOUT_KIND(profile->layout);
+    return profile->version == DECODE_PROFILE_VERSION && profile->nbytes >= 1 && profile->nbytes <= 8 &&
+           kind >= LAYOUT_DIRECT && kind <= LAYOUT_SINGLE && (kind != LAYOUT_DIRECT || profile->nbytes >= 2);
+}
 
-    esp_http_client_handle_t client = esp_http_client_init(&cfg);
-    if (!client) {
-        return false;
+static void decode_profile_load(void)
+{
+    nvs_handle_t nvs = 0;
+    if (nvs_open(DECODE_NVS_NS, NVS_READONLY, &nvs) != ESP_OK) {
+        return;
+    }
+    decode_profile_t profile = {0};
+    size_t len = sizeof(profile);
+    if (nvs_get_blob(nvs, DECODE_NVS_KEY_PROFILE, &profile, &len) == ESP_OK && len == sizeof(profile) &&
+        decode_profile_valid(&profile)) {
+        s_learn.profile = profile;
+        s_learn.locked = true;
+        ESP_LOGI(TAG, "decode profile loaded: layout=0x%02X nbytes=%u", profile.layout, (unsigned)profile.nbytes);
     }
+    nvs_close(nvs);
+}
 
-    esp_err_t err = esp_http_client_perform(client);
-    int status = esp_http_client_get_status_code(client);
-    esp_http_client_cleanup(client);
+// NULL erases the stored profile.
+static void decode_profile_store(const decode_profile_t *profile)
+{
+    nvs_handle_t nvs = 0;
+    if (nvs_open(DECODE_NVS_NS, NVS_READWRITE, &nvs) != ESP_OK) {
+        return;
+    }
+    esp_err_t err = profile ? nvs_set_blob(nvs, DECODE_NVS_KEY_PROFILE, profile, sizeof(*profile))
+                            : nvs_erase_key(nvs, DECODE_NVS_KEY_PROFILE);
+    if (err == ESP_OK) {
+        nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+}
 
-    return (err == ESP_OK && status == 200);
+static void decode_learn_restart(void)
+{
+    memset(s_learn.layout_hits, 0, sizeof(s_learn.layout_hits));
+    memset(s_learn.len_hits, 0, sizeof(s_learn.len_hits));
+    s_learn.seen = 0;
+    s_learn.window = 0;
+    s_learn.window_miss = 0;
 }
 
-static bool telegram_send_text(const char *chat_id, const char *text)
+// Learning: count which layout and frame length decode_core finds. Once one
+// of each covers DECODE_LOCK_PCT of the frames, lock it in. Locked: watch
+// how often frames miss the profile and start over if quality drops.
+static void decode_learn_observe(int nbytes, const decode_cache_entry_t *e)
 {
-#if CONFIG_SNIFFER_ENABLE_TELEGRAM
-    if (strlen(CONFIG_SNIFFER_TELEGRAM_BOT_TOKEN) == 0) {
-        return false;
+    decode_learner_t *l = &s_learn;
+    if (l->locked) {
+        if (e->fast) {
+            l->fast++;
+        } else {
+            l->fallback++;
+            l->window_miss++;
+        }
+        if (++l->window < DECODE_QUALITY_WINDOW) {
+            return;
+        }
+        bool poor = (uint32_t)l->window_miss * 100U > DECODE_QUALITY_WINDOW * DECODE_RELEARN_MISS_PCT;
+        l->window = 0;
+        l->window_miss = 0;
+        if (poor) {
+            ESP_LOGW(TAG, "decode profile misses too many frames, relearning");
+            l->locked = false;
+            l->relearns++;
+            decode_learn_restart();
+            decode_profile_store(NULL);
+            memset(s_decode_cache, 0, sizeof(s_decode_cache));
+        }
+        return;
     }
 
-    char url[256];
-    snprintf(url, sizeof(url), "https://api.telegram.org/bot%s/sendMessage", CONFIG_SNIFFER_TELEGRAM_BOT_TOKEN);
-
-    char body[512];
-    snprintf(body, sizeof(body), "{\"chat_id\":\"%s\",\"text\":\"%s\"}", chat_id, text);
+    l->len_hits[nbytes]++;
+    if (e->core.layout != 0) {
+        l->layout_hits[e->core.layout]++;
+    }
+    if (++l->seen < CONFIG_SNIFFER_DECODE_LEARN_FRAMES) {
+        return;
+    }
 
-    esp_http_client_config_t cfg = {
-        .url = url,
-        .method = HTTP_METHOD_POST,
-        .timeout_ms = 5000,
+    int best_layout = 0;
+    int best_len = 1;
+    for (int i = 1; i < 256; ++i) {
+        if (l->layout_hits[i] > l->layout_hits[best_layout]) {
+            best_layout = i;
+        }
+    }
+    for (int i = 2; i <= 8; ++i) {
+        if (l->len_hits[i] > l->len_hits[best_len]) {
+            best_len = i;
+        }
+    }
+    decode_profile_t profile = {
+        .version = DECODE_PROFILE_VERSION,
+        .layout = (uint8_t)best_layout,
+        .nbytes = (uint8_t)best_len,
     };
-#if HAS_CRT_BUNDLE
-    cfg.crt_bundle_attach = esp_crt_bundle_attach;
-#endif
-
-    esp_http_client_handle_t client = esp_http_client_init(&cfg);
-    if (!client) {
-        return false;
+    uint32_t need = l->seen * DECODE_LOCK_PCT / 100U;
+    if (best_layout != 0 && l->layout_hits[best_layout] >= need && l->len_hits[best_len] >= need &&
+        decode_profile_valid(&profile)) {
+        l->profile = profile;
+        l->locked = true;
+        decode_profile_store(&profile);
+        memset(s_decode_cache, 0, sizeof(s_decode_cache));
+        ESP_LOGI(TAG, "decode profile locked: layout=0x%02X nbytes=%d", best_layout, best_len);
     }
-
-    esp_http_client_set_header(client, "Content-Type", "application/json");
-    esp_http_client_set_post_field(client, body, (int)strlen(body));
-
-    esp_err_t err = esp_http_client_perform(client);
-    int status = esp_http_client_get_status_code(client);
-    esp_http_client_cleanup(client);
-
-    return (err == ESP_OK && status == 200);
-#else
-    (void)chat_id;
-    (void)text;
-    return false;
-#endif
+    decode_learn_restart();
 }
 
-static bool ota_update_from_github(char *result, size_t result_len)
+// K-of-N vote over the last STAB_WINDOW values, per digit position. Returns
+// true when every digit of this value has STAB_AGREE votes and it may be
+// published; otherwise the previous value stays. A frame that needed a bit
+// correction (ok(fixed)) counts as half a vote, so it takes more of them, or
+// exact frames alongside, to publish. Constant time per frame.
+static bool stab_accept(const char *decoded, bool corrected)
 {
-#if CONFIG_SNIFFER_ENABLE_OTA
-    if (strlen(OTA_URL) == 0) {
-        snprintf(result, result_len, "ota: URL is empty");
-        return false;
+    stabiliser_t *st = &s_stab;
+    size_t len = strlen(decoded);
+    if (len == 0 || len > STAB_DIGITS) {
+        return true;
+    }
+    if (len != st->len) {
+        memset(st->history, 0, sizeof(st->history));
+        memset(st->votes, 0, sizeof(st->votes));
+        st->fixed_hist = 0;
+        st->fill = 0;
+        st->len = (uint8_t)len;
+    }
+    st->frames++;
+    if (st->has_stable && strcmp(decoded, st->stable) != 0) {
+        st->disagree++;
     }
 
-    esp_http_client_config_t http_cfg = {
-        .url = OTA_URL,
-        .timeout_ms = OTA_HTTP_TIMEOUT_MS,
-        .buffer_size = OTA_HTTP_RX_BUFFER,
-        .buffer_size_tx = OTA_HTTP_TX_BUFFER,
-        .keep_alive_enable = true,
+    bool full = (st->fill == STAB_WINDOW);
+    unsigned evicted_weight = ((st->fixed_hist >> (STAB_WINDOW - 1)) & 1U) ? STAB_VOTE_FIXED : STAB_VOTE_EXACT;
+    unsigned weight = corrected ? STAB_VOTE_FIXED : STAB_VOTE_EXACT;
+    st->fixed_hist = (uint16_t)(((st->fixed_hist << 1) | (corrected ? 1U : 0U)) & ((1U << STAB_WINDOW) - 1));
+    int min_votes = STAB_WINDOW * STAB_VOTE_EXACT;
+    for (size_t i = 0; i < len; ++i) {
+        unsigned sym = (decoded[i] >= '0' && decoded[i] <= '9') ? (unsigned)(decoded[i] - '0') : 10U;
+        if (full) {
+            unsigned evicted = (unsigned)(st->history[i] >> (4 * (STAB_WINDOW - 1))) & 0xF;
+            st->votes[i] -= (uint64_t)evicted_weight << (5 * evicted);
+        }
+        st->history[i] = ((st->history[i] << 4) | sym) & STAB_HIST_MASK;
+        st->votes[i] += (uint64_t)weight << (5 * sym);
+        int n = (int)((st->votes[i] >> (5 * sym)) & 0x1F);
+        if (n < min_votes) {
+            min_votes = n;
+        }
+    }
+    if (!full) {
+        st->fill++;
+    }
+
+    if (min_votes < STAB_NEED) {
+        st->held++;
+        return false;
+    }
+    memcpy(st->stable, decoded, len + 1);
+    st->has_stable = true;
+    st->confidence = (uint8_t)(min_votes * 100 / (STAB_WINDOW * STAB_VOTE_EXACT));
+    st->published++;
+    return true;
+}
+
+// Side effects of a decode: a mux digit updates its slot and may complete the
+// two-digit reading together with the other, still fresh, slot. frame_us is
+// the capture time of the frame, not the (later) decode time.
+static void decode_apply(const decode_core_t *core, int64_t frame_us, char *decoded, size_t decoded_len, const char **status)
+{
+    if (core->mux_slot >= 0) {
+        s_mux_digit[core->mux_slot] = core->mux_digit;
+        s_mux_valid[core->mux_slot] = true;
+        s_mux_seen_us[core->mux_slot] = frame_us;
+        if (build_mux_2digit(decoded, decoded_len, frame_us)) {
+            *status = core->corrected ? "ok(fixed)" : "ok(mux)";
+            return;
+        }
+    }
+    snprintf(decoded, decoded_len, "%s", core->decoded);
+    *status = core->status;
+}
+
+static void decode_digits(const uint8_t *bytes, int nbytes, int64_t frame_us, char *decoded, size_t decoded_len, const char **status)
+{
+    decode_core_t core;
+    decode_core(bytes, nbytes, &core);
+    decode_apply(&core, frame_us, decoded, decoded_len, status);
+}
+
+static decode_cache_entry_t *decode_cache_get(uint64_t packed, int nbits, uint16_t ctx)
+{
+    uint64_t key = packed ^ ((uint64_t)nbits << 56) ^ ((uint64_t)ctx << 40);
+    decode_cache_entry_t *e = &s_decode_cache[(key * 0x9E3779B97F4A7C15ULL) >> 59];
+    if (e->valid && e->packed == packed && e->nbits == nbits && e->ctx == ctx) {
+        s_decode_cache_hits++;
+        return e;
+    }
+
+    s_decode_cache_misses++;
+    uint8_t bytes[8];
+    int nbytes = nbits / 8;
+    for (int b = 0; b < nbytes; ++b) {
+        bytes[b] = (uint8_t)(packed >> (8 * (nbytes - 1 - b)));
+    }
+    e->packed = packed;
+    e->nbits = (uint8_t)nbits;
+    e->ctx = ctx;
+    e->valid = true;
+    build_hex_string(bytes, nbytes, e->hex, sizeof(e->hex));
+    e->fast = s_learn.locked && decode_profile_core(bytes, nbytes, &s_learn.profile, &e->core);
+    if (!e->fast) {
+        decode_core(bytes, nbytes, &e->core);
+    }
+    if (ctx) {
+        const uint8_t pair[2] = {(uint8_t)ctx, bytes[0]};
+        decode_core(pair, 2, &e->pair);
+    }
+    return e;
+}
+
+static esp_err_t telegram_http_event_handler(esp_http_client_event_t *evt);
+
+static void *json_arena_malloc(size_t size)
+{
+    json_arena_t *a = &s_json_arena;
+    if (a->owner && a->owner == xTaskGetCurrentTaskHandle()) {
+        size_t need = (size + 7) & ~(size_t)7;
+        if (need <= a->cap - a->used) {
+            void *p = a->base + a->used;
+            a->used += need;
+            if (a->used > a->peak) {
+                a->peak = a->used;
+            }
+            return p;
+        }
+        a->overflows++;
+    }
+    return malloc(size);
+}
+
+static void json_arena_free(void *p)
+{
+    const uint8_t *b = (const uint8_t *)p;
+    if (b >= s_json_arena.base && b < s_json_arena.base + s_json_arena.cap) {
+        return;
+    }
+    free(p);
+}
+
+static void json_arena_begin(void)
+{
+    s_json_arena.used = 0;
+    s_json_arena.owner = xTaskGetCurrentTaskHandle();
+}
+
+// O(1) reset; nothing parsed inside begin/end may be used after this.
+static void json_arena_end(void)
+{
+    s_json_arena.owner = NULL;
+    s_json_arena.used = 0;
+    s_json_arena.resets++;
+}
+
+static void heap_track_sample(void)
+{
+    size_t largest = heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    s_heap.largest = largest;
+    if (s_heap.largest_min == 0 || largest < s_heap.largest_min) {
+        s_heap.largest_min = largest;
+    }
+}
+
+// Returns true if a call may go out now; otherwise *wait_ms says when to
+// come back. An expired OPEN breaker lets exactly one probe through.
+static bool net_guard_acquire(net_guard_t *g, uint32_t *wait_ms)
+{
+    int64_t now = esp_timer_get_time();
+    bool allowed = false;
+    xSemaphoreTake(s_net_guard_mutex, portMAX_DELAY);
+    if (now >= g->next_us) {
+        allowed = true;
+        // A probe that never reported back also times out after the cooldown.
+        if (g->state != NET_GUARD_CLOSED) {
+            g->state = NET_GUARD_HALF_OPEN;
+            g->next_us = now + (int64_t)CONFIG_SNIFFER_NET_BREAKER_COOLDOWN_S * 1000000LL;
+        }
+    } else {
+        g->rejected++;
+    }
+    int64_t wait_us = g->next_us - now;
+    xSemaphoreGive(s_net_guard_mutex);
+    if (wait_ms) {
+        *wait_ms = (allowed || wait_us <= 0) ? 0 : (uint32_t)(wait_us / 1000) + 1;
+    }
+    return allowed;
+}
+
+static uint32_t net_guard_wait_ms(net_guard_t *g)
+{
+    xSemaphoreTake(s_net_guard_mutex, portMAX_DELAY);
+    int64_t wait_us = g->next_us - esp_timer_get_time();
+    xSemaphoreGive(s_net_guard_mutex);
+    return wait_us > 0 ? (uint32_t)(wait_us / 1000) + 1 : 0;
+}
+
+// status is the HTTP status, or -1 when no response arrived. Client errors
+// other than 429 mean the network is fine and do not count as failures.
+static void net_guard_report(net_guard_t *g, int status, uint32_t retry_after_s)
+{
+    int64_t now = esp_timer_get_time();
+    xSemaphoreTake(s_net_guard_mutex, portMAX_DELAY);
+    if (status == 429) {
+        g->throttled++;
+        uint32_t ms = retry_after_s > 0 ? retry_after_s * 1000U : NET_BACKOFF_BASE_MS;
+        g->next_us = now + (int64_t)ms * 1000LL;
+        if (g->state == NET_GUARD_HALF_OPEN) {
+            g->state = NET_GUARD_CLOSED;
+        }
+    } else if (status >= 200 && status < 500) {
+        if (g->state != NET_GUARD_CLOSED) {
+            ESP_LOGI(TAG, "%s: circuit closed", g->name);
+        }
+        g->state = NET_GUARD_CLOSED;
+        g->failures = 0;
+        g->next_us = 0;
+    } else {
+        g->failures++;
+        if (g->state == NET_GUARD_HALF_OPEN || g->failures >= CONFIG_SNIFFER_NET_BREAKER_FAILURES) {
+            if (g->state != NET_GUARD_OPEN) {
+                g->trips++;
+                ESP_LOGW(TAG, "%s: circuit open for %d s after %u failures",
+                         g->name,
+                         CONFIG_SNIFFER_NET_BREAKER_COOLDOWN_S,
+                         (unsigned)g->failures);
+            }
+            g->state = NET_GUARD_OPEN;
+            g->next_us = now + (int64_t)CONFIG_SNIFFER_NET_BREAKER_COOLDOWN_S * 1000000LL;
+        } else {
+            // Equal jitter: half the exponential step fixed, half random.
+            uint32_t cap = (uint32_t)CONFIG_SNIFFER_NET_BACKOFF_MAX_S * 1000U;
+            uint32_t step = NET_BACKOFF_BASE_MS << (g->failures < 16 ? g->failures - 1 : 15);
+            if (step > cap || step == 0) {
+                step = cap;
+            }
+            uint32_t ms = step / 2 + esp_random() % (step / 2 + 1);
+            g->next_us = now + (int64_t)ms * 1000LL;
+        }
+    }
+    xSemaphoreGive(s_net_guard_mutex);
+}
+
+static void net_guard_init(void)
+{
+    s_net_guard_mutex = xSemaphoreCreateMutex();
+    s_tg_send_mutex = xSemaphoreCreateMutex();
+}
+
+static bool dns_resolve_ipv4(const char *host, uint32_t *addr)
+{
+    struct addrinfo hints = {
+        .ai_family = AF_INET,
+        .ai_socktype = SOCK_STREAM,
     };
+    struct addrinfo *res = NULL;
+    int err = getaddrinfo(host, "443", &hints, &res);
+    bool ok = (err == 0 && res && res->ai_addr);
+    if (ok) {
+        *addr = ((struct sockaddr_in *)res->ai_addr)->sin_addr.s_addr;
+    }
+    if (res) {
+        freeaddrinfo(res);
+    }
+    return ok;
+}
+
+// Last-known-good addresses survive reboots, so a dead resolver right after
+// boot still leaves Telegram and OTA reachable.
+static void dns_cache_persist_locked(void)
+{
+    nvs_handle_t nvs = 0;
+    if (nvs_open(DNS_NVS_NS, NVS_READWRITE, &nvs) != ESP_OK) {
+        return;
+    }
+    dns_cache_entry_t saved[DNS_CACHE_HOSTS];
+    memcpy(saved, s_dns_cache, sizeof(saved));
+    for (int i = 0; i < DNS_CACHE_HOSTS; i++) {
+        saved[i].resolved_us = 0;
+        saved[i].used_us = 0;
+    }
+    if (nvs_set_blob(nvs, DNS_NVS_KEY_LKG, saved, sizeof(saved)) == ESP_OK) {
+        nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+}
+
+static void dns_cache_init(void)
+{
+    s_dns_mutex = xSemaphoreCreateMutex();
+
+    nvs_handle_t nvs = 0;
+    if (nvs_open(DNS_NVS_NS, NVS_READONLY, &nvs) != ESP_OK) {
+        return;
+    }
+    size_t len = sizeof(s_dns_cache);
+    if (nvs_get_blob(nvs, DNS_NVS_KEY_LKG, s_dns_cache, &len) != ESP_OK || len != sizeof(s_dns_cache)) {
+        memset(s_dns_cache, 0, sizeof(s_dns_cache));
+    }
+    nvs_close(nvs);
+    for (int i = 0; i < DNS_CACHE_HOSTS; i++) {
+        s_dns_cache[i].host[DNS_HOST_MAX - 1] = '\0';
+    }
+}
+
+static dns_cache_entry_t *dns_cache_find_locked(const char *host, bool add)
+{
+    dns_cache_entry_t *victim = &s_dns_cache[0];
+    for (int i = 0; i < DNS_CACHE_HOSTS; i++) {
+        dns_cache_entry_t *e = &s_dns_cache[i];
+        if (strcmp(e->host, host) == 0) {
+            return e;
+        }
+        if (e->host[0] == '\0' || (victim->host[0] != '\0' && e->used_us < victim->used_us)) {
+            victim = e;
+        }
+    }
+    if (!add) {
+        return NULL;
+    }
+    memset(victim, 0, sizeof(*victim));
+    strncpy(victim->host, host, sizeof(victim->host) - 1);
+    return victim;
+}
+
+// Resolves outside the lock and stores the result; on failure the previous
+// address (if any) stays as last-known-good.
+static bool dns_cache_refresh(const char *host)
+{
+    uint32_t addr = 0;
+    bool ok = dns_resolve_ipv4(host, &addr);
+
+    xSemaphoreTake(s_dns_mutex, portMAX_DELAY);
+    dns_cache_entry_t *e = dns_cache_find_locked(host, ok);
+    if (ok) {
+        bool changed = (e->addr != addr);
+        e->addr = addr;
+        e->resolved_us = esp_timer_get_time();
+        s_dns_stats.refreshes++;
+        if (changed) {
+            dns_cache_persist_locked();
+        }
+    } else {
+        s_dns_stats.failures++;
+    }
+    xSemaphoreGive(s_dns_mutex);
+    return ok;
+}
+
+// Fresh entry: no DNS traffic. Stale or missing: resolve now, and if the
+// resolver is unreachable fall back to the last known-good address.
+static bool dns_cache_lookup(const char *host, uint32_t *addr)
+{
+    if (!s_dns_mutex || strlen(host) >= DNS_HOST_MAX) {
+        return false;
+    }
+
+    int64_t now = esp_timer_get_time();
+    xSemaphoreTake(s_dns_mutex, portMAX_DELAY);
+    dns_cache_entry_t *e = dns_cache_find_locked(host, false);
+    bool fresh = e && e->addr != 0 && e->resolved_us > 0 && now - e->resolved_us < DNS_CACHE_TTL_US;
+    if (e) {
+        e->used_us = now;
+    }
+    if (fresh) {
+        *addr = e->addr;
+        s_dns_stats.hits++;
+    } else {
+        s_dns_stats.misses++;
+    }
+    xSemaphoreGive(s_dns_mutex);
+    if (fresh) {
+        return true;
+    }
+
+    if (dns_cache_refresh(host)) {
+        xSemaphoreTake(s_dns_mutex, portMAX_DELAY);
+        e = dns_cache_find_locked(host, false);
+        *addr = e ? e->addr : 0;
+        if (e) {
+            e->used_us = now;
+        }
+        xSemaphoreGive(s_dns_mutex);
+        return *addr != 0;
+    }
+
+    xSemaphoreTake(s_dns_mutex, portMAX_DELAY);
+    e = dns_cache_find_locked(host, false);
+    bool stale = e && e->addr != 0;
+    if (stale) {
+        *addr = e->addr;
+        s_dns_stats.stale_served++;
+    }
+    xSemaphoreGive(s_dns_mutex);
+    if (stale) {
+        ESP_LOGW(TAG, "DNS failed for %s, using last known-good address", host);
+    }
+    return stale;
+}
+
+static void dns_refresh_task(void *arg)
+{
+    (void)arg;
+    while (1) {
+        vTaskDelay(pdMS_TO_TICKS(DNS_REFRESH_PERIOD_MS));
+        if (!s_wifi_events || (xEventGroupGetBits(s_wifi_events) & WIFI_CONNECTED_BIT) == 0) {
+            continue;
+        }
+
+        // Refresh ahead of expiry so request paths keep hitting the cache.
+        for (int i = 0; i < DNS_CACHE_HOSTS; i++) {
+            char host[DNS_HOST_MAX] = {0};
+            xSemaphoreTake(s_dns_mutex, portMAX_DELAY);
+            int64_t age = esp_timer_get_time() - s_dns_cache[i].resolved_us;
+            if (s_dns_cache[i].host[0] != '\0' && (s_dns_cache[i].resolved_us == 0 || age > DNS_CACHE_TTL_US * 3 / 4)) {
+                strncpy(host, s_dns_cache[i].host, sizeof(host) - 1);
+            }
+            xSemaphoreGive(s_dns_mutex);
+            if (host[0] != '\0') {
+                dns_cache_refresh(host);
+            }
+        }
+    }
+}
+
+static bool url_split_host(const char *url, char *host, size_t host_len, const char **rest)
+{
+    const char *p = strstr(url, "://");
+    if (!p) {
+        return false;
+    }
+    p += 3;
+    size_t n = strcspn(p, ":/?#");
+    if (n == 0 || n >= host_len) {
+        return false;
+    }
+    memcpy(host, p, n);
+    host[n] = '\0';
+    *rest = p + n;
+    return true;
+}
+
+// https://name/path -> https://a.b.c.d/path via the cache. host receives the
+// name for SNI/certificate checks and the Host header, ip the dotted address.
+static bool http_url_via_cache(const char *url, char *out, size_t out_len, char *host, size_t host_len, char ip[16])
+{
+    const char *rest = NULL;
+    uint32_t addr = 0;
+    if (!url_split_host(url, host, host_len, &rest) || !dns_cache_lookup(host, &addr)) {
+        return false;
+    }
+    esp_ip4_addr_t ip4 = {.addr = addr};
+    esp_ip4addr_ntoa(&ip4, ip, 16);
+    int n = snprintf(out, out_len, "%.*s%s%s", (int)(strstr(url, "://") + 3 - url), url, ip, rest);
+    return n > 0 && (size_t)n < out_len;
+}
+
+// Creates the client on first use and again whenever the cached address
+// changes; otherwise only the URL is swapped so the TLS session is reused.
+static esp_http_client_handle_t http_conn_prepare(http_conn_t *conn,
+                                                 const char *url,
+                                                 esp_http_client_method_t method,
+                                                 int timeout_ms)
+{
+    char ip_url[HTTP_URL_MAX];
+    char host[DNS_HOST_MAX] = {0};
+    char ip[16] = {0};
+    bool via_ip = http_url_via_cache(url, ip_url, sizeof(ip_url), host, sizeof(host), ip);
+    const char *target = via_ip ? ip_url : url;
+
+    if (conn->handle && (strcmp(conn->ip, ip) != 0 || strcmp(conn->host, host) != 0)) {
+        esp_http_client_cleanup(conn->handle);
+        conn->handle = NULL;
+    }
+
+    if (!conn->handle) {
+        memcpy(conn->host, host, sizeof(conn->host));
+        memcpy(conn->ip, ip, sizeof(conn->ip));
+
+        esp_http_client_config_t cfg = {
+            .url = target,
+            .method = method,
+            .timeout_ms = timeout_ms,
+            .event_handler = telegram_http_event_handler,
+            .user_data = &conn->resp,
+            .keep_alive_enable = true,
+            .common_name = via_ip ? conn->host : NULL,
+        };
 #if HAS_CRT_BUNDLE
-    http_cfg.crt_bundle_attach = esp_crt_bundle_attach;
+        cfg.crt_bundle_attach = esp_crt_bundle_attach;
 #endif
+        conn->handle = esp_http_client_init(&cfg);
+        if (conn->handle && via_ip) {
+            esp_http_client_set_header(conn->handle, "Host", conn->host);
+        }
+        return conn->handle;
+    }
 
-    esp_https_ota_config_t ota_cfg = {
-        .http_config = &http_cfg,
-    };
+    esp_http_client_set_url(conn->handle, target);
+    esp_http_client_set_method(conn->handle, method);
+    esp_http_client_set_timeout_ms(conn->handle, timeout_ms);
+    return conn->handle;
+}
 
-    ESP_LOGI(TAG, "OTA start: %s", OTA_URL);
-    esp_err_t err = esp_https_ota(&ota_cfg);
-    if (err == ESP_OK) {
-        snprintf(result, result_len, "ota: success, rebooting");
-        return true;
+// Runs one request on a kept-alive client and returns the HTTP status, or -1
+// if no response arrived; a transport error drops the client so the next
+// request starts from a fresh connection.
+static int http_conn_request(http_conn_t *conn,
+                              const char *url,
+                              esp_http_client_method_t method,
+                              int timeout_ms,
+                              const char *body,
+                              char *out,
+                              size_t out_len)
+{
+    esp_http_client_handle_t client = http_conn_prepare(conn, url, method, timeout_ms);
+    if (!client) {
+        return -1;
+    }
+
+    if (out && out_len > 0) {
+        out[0] = '\0';
+    }
+    conn->resp.data = out;
+    conn->resp.len = 0;
+    conn->resp.cap = out ? out_len : 0;
+    if (body) {
+        esp_http_client_set_header(client, "Content-Type", "application/json");
+        esp_http_client_set_post_field(client, body, (int)strlen(body));
+    } else {
+        esp_http_client_set_post_field(client, NULL, 0);
+    }
+
+    esp_err_t err = esp_http_client_perform(client);
+    int status = esp_http_client_get_status_code(client);
+    conn->resp.data = NULL;
+    conn->resp.cap = 0;
+    if (err != ESP_OK) {
+        esp_http_client_cleanup(client);
+        conn->handle = NULL;
+        return -1;
+    }
+    return status;
+}
+
+static esp_err_t telegram_http_event_handler(esp_http_client_event_t *evt)
+{
+    http_resp_buf_t *buf = (http_resp_buf_t *)evt->user_data;
+
+    if (evt->event_id == HTTP_EVENT_ON_DATA && buf && buf->data && evt->data && evt->data_len > 0) {
+        if (buf->len + (size_t)evt->data_len >= buf->cap) {
+            size_t available = (buf->cap > buf->len + 1) ? (buf->cap - buf->len - 1) : 0;
+            if (available > 0) {
+                memcpy(buf->data + buf->len, evt->data, available);
+                buf->len += available;
+                buf->data[buf->len] = '\0';
+            }
+            return ESP_ERR_NO_MEM;
+        }
+
+        memcpy(buf->data + buf->len, evt->data, evt->data_len);
+        buf->len += (size_t)evt->data_len;
+        buf->data[buf->len] = '\0';
+    }
+
+    return ESP_OK;
+}
+
+// getUpdates runs only on net_task, so its kept-alive client needs no lock.
+static http_conn_t s_tg_poll_conn;
+
+// 429 bodies carry {"parameters":{"retry_after":N}}.
+static uint32_t telegram_retry_after(const char *body)
+{
+    const char *p = body ? strstr(body, "\"retry_after\":") : NULL;
+    return p ? (uint32_t)strtoul(p + 14, NULL, 10) : 0;
+}
+
+static bool telegram_http_get(const char *url, char *out, size_t out_len)
+{
+    if (!net_guard_acquire(&s_guard_telegram, NULL)) {
+        return false;
+    }
+    int status = http_conn_request(&s_tg_poll_conn,
+                                   url,
+                                   HTTP_METHOD_GET,
+                                   (TELEGRAM_POLL_TIMEOUT_S + 5) * 1000,
+                                   NULL,
+                                   out,
+                                   out_len);
+    net_guard_report(&s_guard_telegram, status, status == 429 ? telegram_retry_after(out) : 0);
+    return status == 200;
+}
+
+static void json_escape(const char *in, char *out, size_t out_len)
+{
+    size_t used = 0;
+    for (; *in && used + 2 < out_len; ++in) {
+        char c = *in;
+        if (c == '"' || c == '\\') {
+            out[used++] = '\\';
+            out[used++] = c;
+        } else if (c == '\n') {
+            out[used++] = '\\';
+            out[used++] = 'n';
+        } else if ((unsigned char)c >= 0x20) {
+            out[used++] = c;
+        }
+    }
+    out[used] = '\0';
+}
+
+static bool telegram_send_text(const char *chat_id, const char *text)
+{
+#if CONFIG_SNIFFER_ENABLE_TELEGRAM
+    if (strlen(CONFIG_SNIFFER_TELEGRAM_BOT_TOKEN) == 0) {
+        return false;
     }
 
-    snprintf(result, result_len, "ota: failed (%s)", esp_err_to_name(err));
-    ESP_LOGW(TAG, "OTA failed: %s", esp_err_to_name(err));
+    // net_task, push_task and ota_task all send; they share one kept-alive client.
+    // Retries wait out the shared backoff, but never longer than
+    // TELEGRAM_SEND_MAX_WAIT_MS: an open breaker fails the send at once.
+    // The request buffers are static under s_tg_send_mutex so the TLS
+    // handshake gets the caller's whole stack.
+    static http_conn_t s_tg_send_conn;
+    static char url[256];
+    static char escaped[640];
+    static char body[768];
+    static char resp[192];
+    for (int attempt = 0; attempt < TELEGRAM_SEND_ATTEMPTS; attempt++) {
+        uint32_t wait_ms = 0;
+        while (!net_guard_acquire(&s_guard_telegram, &wait_ms)) {
+            if (wait_ms > TELEGRAM_SEND_MAX_WAIT_MS) {
+                return false;
+            }
+            vTaskDelay(pdMS_TO_TICKS(wait_ms) + 1);
+        }
+        xSemaphoreTake(s_tg_send_mutex, portMAX_DELAY);
+        snprintf(url, sizeof(url), "%s/bot%s/sendMessage", TELEGRAM_API_URL, CONFIG_SNIFFER_TELEGRAM_BOT_TOKEN);
+        json_escape(text, escaped, sizeof(escaped));
+        snprintf(body, sizeof(body), "{\"chat_id\":\"%s\",\"text\":\"%s\"}", chat_id, escaped);
+        int status = http_conn_request(&s_tg_send_conn, url, HTTP_METHOD_POST, 5000, body, resp, sizeof(resp));
+        uint32_t retry_after = status == 429 ? telegram_retry_after(resp) : 0;
+        xSemaphoreGive(s_tg_send_mutex);
+        net_guard_report(&s_guard_telegram, status, retry_after);
+        if (status == 200) {
+            return true;
+        }
+        if (status >= 400 && status < 500 && status != 429) {
+            ESP_LOGW(TAG, "telegram sendMessage http %d", status);
+            return false;
+        }
+    }
     return false;
 #else
-    snprintf(result, result_len, "ota: disabled in config");
+    (void)chat_id;
+    (void)text;
     return false;
 #endif
 }
 
-static void build_decoded_reply(char *out, size_t out_len)
+static uint16_t crc16_ccitt(const uint8_t *data, size_t len)
 {
-    char decoded[16] = {0};
-    char decode_status[24] = {0};
-    int64_t frame_us = 0;
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < len; ++i) {
+        crc ^= (uint16_t)data[i] << 8;
+        for (int b = 0; b < 8; ++b) {
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+        }
+    }
+    return crc;
+}
 
-    xSemaphoreTake(s_state_mutex, portMAX_DELAY);
-    strncpy(decoded, s_last_decoded, sizeof(decoded) - 1);
-    strncpy(decode_status, s_last_decode_status, sizeof(decode_status) - 1);
-    frame_us = s_last_frame_us;
-    xSemaphoreGive(s_state_mutex);
+#if CONFIG_SNIFFER_ENABLE_RLOG
+static const esp_partition_t *s_rlog_part;
+static SemaphoreHandle_t s_rlog_mutex;
+static rlog_index_t s_rlog_index[RLOG_MAX_SECTORS];
+static int s_rlog_nsectors;
+static int s_rlog_cur;
+static int s_rlog_slot;
+static int s_rlog_flushed_slot;
+static uint8_t s_rlog_page[RLOG_PAGE_BYTES];
+static uint32_t s_rlog_next_seq;
+static uint16_t s_rlog_boot;
+static int64_t s_rlog_pending_since_us;
+static rlog_stats_t s_rlog_stats;
+
+static bool rlog_record_valid(const rlog_record_t *rec)
+{
+    return rec->crc == crc16_ccitt((const uint8_t *)rec, offsetof(rlog_record_t, crc));
+}
+
+static bool rlog_slot_erased(const uint8_t *slot)
+{
+    for (int i = 0; i < RLOG_RECORD_BYTES; ++i) {
+        if (slot[i] != 0xFF) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static esp_err_t rlog_program(size_t offset, const void *data, size_t len)
+{
+    int64_t t0 = esp_timer_get_time();
+    esp_err_t err = esp_partition_write(s_rlog_part, offset, data, len);
+    s_rlog_stats.write_time_us += esp_timer_get_time() - t0;
+    s_rlog_stats.program_ops++;
+    s_rlog_stats.bytes_programmed += (uint32_t)len;
+    return err;
+}
+
+// Writes the unflushed tail of the current page. A partially written page
+// is completed later by programming only its still-erased slots.
+static void rlog_flush_locked(void)
+{
+    if (s_rlog_flushed_slot >= s_rlog_slot) {
+        return;
+    }
+
+    int page_first = (s_rlog_flushed_slot / RLOG_PAGE_RECORDS) * RLOG_PAGE_RECORDS;
+    size_t offset = (size_t)s_rlog_cur * RLOG_SECTOR_BYTES + (size_t)s_rlog_flushed_slot * RLOG_RECORD_BYTES;
+    const uint8_t *src = s_rlog_page + (s_rlog_flushed_slot - page_first) * RLOG_RECORD_BYTES;
+    esp_err_t err = rlog_program(offset, src, (size_t)(s_rlog_slot - s_rlog_flushed_slot) * RLOG_RECORD_BYTES);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "rlog write failed: %s", esp_err_to_name(err));
+    }
+    s_rlog_flushed_slot = s_rlog_slot;
+    s_rlog_pending_since_us = 0;
+    if ((s_rlog_slot % RLOG_PAGE_RECORDS) == 0) {
+        memset(s_rlog_page, 0xFF, sizeof(s_rlog_page));
+    }
+}
+
+static void rlog_open_sector_locked(int sector, uint32_t sector_seq)
+{
+    int64_t t0 = esp_timer_get_time();
+    esp_err_t err = esp_partition_erase_range(s_rlog_part, (size_t)sector * RLOG_SECTOR_BYTES, RLOG_SECTOR_BYTES);
+    s_rlog_stats.write_time_us += esp_timer_get_time() - t0;
+    s_rlog_stats.erases++;
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "rlog erase failed: %s", esp_err_to_name(err));
+    }
+
+    rlog_sector_hdr_t hdr = {
+        .magic = RLOG_MAGIC,
+        .sector_seq = sector_seq,
+        .first_seq = s_rlog_next_seq,
+        .boot = s_rlog_boot,
+    };
+    hdr.crc = crc16_ccitt((const uint8_t *)&hdr, offsetof(rlog_sector_hdr_t, crc));
+
+    s_rlog_index[sector].sector_seq = sector_seq;
+    s_rlog_index[sector].first_seq = s_rlog_next_seq;
+
+    // The header shares the first page with records and is written with them.
+    s_rlog_cur = sector;
+    memset(s_rlog_page, 0xFF, sizeof(s_rlog_page));
+    memcpy(s_rlog_page, &hdr, sizeof(hdr));
+    s_rlog_flushed_slot = 0;
+    s_rlog_slot = 1;
+}
+
+static uint16_t rlog_next_boot_id(void)
+{
+    nvs_handle_t nvs = 0;
+    uint32_t boot = 0;
+    if (nvs_open(RLOG_NVS_NS, NVS_READWRITE, &nvs) != ESP_OK) {
+        return 0;
+    }
+    nvs_get_u32(nvs, RLOG_NVS_KEY_BOOT, &boot);
+    boot++;
+    if (nvs_set_u32(nvs, RLOG_NVS_KEY_BOOT, boot) == ESP_OK) {
+        nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+    return (uint16_t)boot;
+}
+
+static void rlog_init(void)
+{
+    s_rlog_part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, CONFIG_SNIFFER_RLOG_PARTITION);
+    if (!s_rlog_part) {
+        ESP_LOGW(TAG, "rlog partition '%s' not found; reading log disabled", CONFIG_SNIFFER_RLOG_PARTITION);
+        return;
+    }
+    s_rlog_mutex = xSemaphoreCreateMutex();
+    if (!s_rlog_mutex) {
+        s_rlog_part = NULL;
+        return;
+    }
+
+    s_rlog_nsectors = (int)(s_rlog_part->size / RLOG_SECTOR_BYTES);
+    if (s_rlog_nsectors > RLOG_MAX_SECTORS) {
+        s_rlog_nsectors = RLOG_MAX_SECTORS;
+    }
+    s_rlog_boot = rlog_next_boot_id();
+
+    int newest = -1;
+    for (int i = 0; i < s_rlog_nsectors; ++i) {
+        rlog_sector_hdr_t hdr;
+        memset(&s_rlog_index[i], 0, sizeof(s_rlog_index[i]));
+        if (esp_partition_read(s_rlog_part, (size_t)i * RLOG_SECTOR_BYTES, &hdr, sizeof(hdr)) != ESP_OK ||
+            hdr.magic != RLOG_MAGIC || hdr.crc != crc16_ccitt((const uint8_t *)&hdr, offsetof(rlog_sector_hdr_t, crc))) {
+            continue;
+        }
+        s_rlog_index[i].sector_seq = hdr.sector_seq;
+        s_rlog_index[i].first_seq = hdr.first_seq;
+        if (newest < 0 || hdr.sector_seq > s_rlog_index[newest].sector_seq) {
+            newest = i;
+        }
+    }
+
+    if (newest < 0) {
+        s_rlog_next_seq = 1;
+        rlog_open_sector_locked(0, 1);
+        ESP_LOGI(TAG, "rlog formatted, %d sectors", s_rlog_nsectors);
+        return;
+    }
+
+    // Slots are filled in order, so the first erased slot is found by bisection.
+    s_rlog_cur = newest;
+    int lo = 1;
+    int hi = RLOG_SECTOR_SLOTS;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        uint8_t slot[RLOG_RECORD_BYTES];
+        esp_partition_read(s_rlog_part, (size_t)newest * RLOG_SECTOR_BYTES + (size_t)mid * RLOG_RECORD_BYTES, slot, sizeof(slot));
+        if (rlog_slot_erased(slot)) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    s_rlog_slot = lo;
+    s_rlog_flushed_slot = lo;
+    s_rlog_next_seq = s_rlog_index[newest].first_seq + (uint32_t)(lo - 1);
+    memset(s_rlog_page, 0xFF, sizeof(s_rlog_page));
+
+    if (s_rlog_slot >= RLOG_SECTOR_SLOTS) {
+        rlog_open_sector_locked((newest + 1) % s_rlog_nsectors, s_rlog_index[newest].sector_seq + 1);
+    }
+    ESP_LOGI(TAG, "rlog sectors=%d cur=%d slot=%d next_seq=%u boot=%u",
+             s_rlog_nsectors, s_rlog_cur, s_rlog_slot, (unsigned)s_rlog_next_seq, (unsigned)s_rlog_boot);
+}
+
+static void rlog_append_locked(rlog_record_t *rec);
+
+static void rlog_append(const push_msg_t *msg)
+{
+    if (!s_rlog_part) {
+        return;
+    }
+
+    long parsed = 0;
+    bool has_value = parse_decoded_value(msg->decoded, &parsed) && parsed >= INT16_MIN && parsed <= INT16_MAX;
+    rlog_record_t rec = {
+        .uptime_ms = (uint32_t)(msg->frame_us / 1000),
+        .boot = s_rlog_boot,
+        .value = has_value ? (int16_t)parsed : 0,
+        .rank = (uint8_t)decode_status_rank(msg->status),
+        .flags = (uint8_t)((has_value ? RLOG_FLAG_HAS_VALUE : 0) |
+                           (strcmp(msg->status, "ok(fixed)") == 0 ? RLOG_FLAG_CORRECTED : 0)),
+    };
+
+    xSemaphoreTake(s_rlog_mutex, portMAX_DELAY);
+    rlog_append_locked(&rec);
+    xSemaphoreGive(s_rlog_mutex);
+}
+
+// Assigns seq and crc, batches the record into the RAM page and programs
+// full pages; opens the next sector when this one is full.
+static void rlog_append_locked(rlog_record_t *rec)
+{
+    rec->seq = s_rlog_next_seq++;
+    rec->crc = crc16_ccitt((const uint8_t *)rec, offsetof(rlog_record_t, crc));
+    memcpy(s_rlog_page + (s_rlog_slot % RLOG_PAGE_RECORDS) * RLOG_RECORD_BYTES, rec, sizeof(*rec));
+    s_rlog_slot++;
+    s_rlog_stats.appended++;
+    if (s_rlog_pending_since_us == 0) {
+        s_rlog_pending_since_us = esp_timer_get_time();
+    }
+
+    if ((s_rlog_slot % RLOG_PAGE_RECORDS) == 0) {
+        rlog_flush_locked();
+    }
+    if (s_rlog_slot >= RLOG_SECTOR_SLOTS) {
+        rlog_open_sector_locked((s_rlog_cur + 1) % s_rlog_nsectors, s_rlog_index[s_rlog_cur].sector_seq + 1);
+    }
+}
+
+static void rlog_flush(void)
+{
+    if (!s_rlog_part) {
+        return;
+    }
+    xSemaphoreTake(s_rlog_mutex, portMAX_DELAY);
+    rlog_flush_locked();
+    xSemaphoreGive(s_rlog_mutex);
+}
+
+static void rlog_service(void)
+{
+    if (!s_rlog_part) {
+        return;
+    }
+    xSemaphoreTake(s_rlog_mutex, portMAX_DELAY);
+    if (s_rlog_pending_since_us > 0 &&
+        (esp_timer_get_time() - s_rlog_pending_since_us) >= (int64_t)CONFIG_SNIFFER_RLOG_FLUSH_S * 1000000LL) {
+        rlog_flush_locked();
+    }
+    xSemaphoreGive(s_rlog_mutex);
+}
+
+// Emits records with seq >= since_seq, oldest first. Flash is read without
+// holding the mutex; only the write position and RAM page are snapshotted.
+// The writer may erase and reuse a sector meanwhile; sector_seq rises by one
+// per sector around the ring, so a page read is kept only if its sector still
+// has the sector_seq it had when the export started.
+static void rlog_export(uint32_t since_seq, rlog_emit_fn emit, void *ctx)
+{
+    if (!s_rlog_part) {
+        return;
+    }
+
+    rlog_record_t pending[RLOG_PAGE_RECORDS];
+    int npending = 0;
+    xSemaphoreTake(s_rlog_mutex, portMAX_DELAY);
+    int cur = s_rlog_cur;
+    int cur_flushed = s_rlog_flushed_slot;
+    int page_first = (s_rlog_flushed_slot / RLOG_PAGE_RECORDS) * RLOG_PAGE_RECORDS;
+    for (int slot = s_rlog_flushed_slot; slot < s_rlog_slot; ++slot) {
+        memcpy(&pending[npending++], s_rlog_page + (slot - page_first) * RLOG_RECORD_BYTES, RLOG_RECORD_BYTES);
+    }
+
+    // Sectors are used round-robin: the oldest live one follows cur. Seek to
+    // the last sector whose first record is <= since_seq.
+    int start = cur;
+    for (int step = 1; step <= s_rlog_nsectors; ++step) {
+        int i = (cur + step) % s_rlog_nsectors;
+        if (s_rlog_index[i].sector_seq == 0) {
+            continue;
+        }
+        start = i;
+        break;
+    }
+    int lo = 0;
+    int hi = (cur - start + s_rlog_nsectors) % s_rlog_nsectors;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (s_rlog_index[(start + mid) % s_rlog_nsectors].first_seq <= since_seq) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    start = (start + lo) % s_rlog_nsectors;
+    uint32_t sector_seq = s_rlog_index[start].sector_seq;
+    xSemaphoreGive(s_rlog_mutex);
+
+    uint32_t crc_errors = 0;
+    bool stopped = false;
+    for (int sector = start; !stopped; sector = (sector + 1) % s_rlog_nsectors, ++sector_seq) {
+        int end_slot = (sector == cur) ? cur_flushed : RLOG_SECTOR_SLOTS;
+        for (int page = 0; !stopped && page * RLOG_PAGE_RECORDS < end_slot; ++page) {
+            rlog_record_t recs[RLOG_PAGE_RECORDS];
+            if (esp_partition_read(s_rlog_part, (size_t)sector * RLOG_SECTOR_BYTES + (size_t)page * RLOG_PAGE_BYTES, recs, sizeof(recs)) != ESP_OK) {
+                break;
+            }
+            xSemaphoreTake(s_rlog_mutex, portMAX_DELAY);
+            bool recycled = (s_rlog_index[sector].sector_seq != sector_seq);
+            xSemaphoreGive(s_rlog_mutex);
+            if (recycled) {
+                break;
+            }
+            for (int i = (page == 0) ? 1 : 0; i < RLOG_PAGE_RECORDS && page * RLOG_PAGE_RECORDS + i < end_slot; ++i) {
+                if (!rlog_record_valid(&recs[i])) {
+                    if (!rlog_slot_erased((const uint8_t *)&recs[i])) {
+                        crc_errors++;
+                    }
+                    continue;
+                }
+                if (recs[i].seq >= since_seq && !emit(&recs[i], ctx)) {
+                    stopped = true;
+                    break;
+                }
+            }
+        }
+        if (sector == cur) {
+            break;
+        }
+    }
+
+    for (int i = 0; !stopped && i < npending; ++i) {
+        if (pending[i].seq >= since_seq && !emit(&pending[i], ctx)) {
+            stopped = true;
+        }
+    }
+
+    if (crc_errors > 0) {
+        xSemaphoreTake(s_rlog_mutex, portMAX_DELAY);
+        s_rlog_stats.crc_errors += crc_errors;
+        xSemaphoreGive(s_rlog_mutex);
+    }
+}
+#endif
+
+#if CONFIG_SNIFFER_ENABLE_OTA
+static TaskHandle_t s_ota_task;
+static char s_ota_chat_id[32];
+static volatile int s_ota_pct;
+
+static void ota_notify(const char *text)
+{
+    if (s_ota_chat_id[0] != '\0' && !telegram_send_text(s_ota_chat_id, text)) {
+        ESP_LOGW(TAG, "telegram send failed");
+    }
+}
+
+typedef struct {
+    char version[32];
+    int size;
+    uint8_t sha256[32];
+    uint8_t app_sha256[32];
+    bool has_app_sha256;
+    uint8_t patch_base[32];
+    int patch_size;
+    bool has_patch;
+    int deflate_size;
+} ota_manifest_t;
+
+typedef enum {
+    OTA_SRC_PATCH,
+    OTA_SRC_DEFLATE,
+    OTA_SRC_FULL,
+} ota_source_t;
+
+// Everything written to the new slot goes through here: running SHA-256,
+// progress messages and the bytes-per-tick throttle.
+typedef struct {
+    const esp_partition_t *target;
+    esp_ota_handle_t handle;
+    bool open;
+    mbedtls_sha256_context sha;
+    int written;
+    int total;
+    int next_report_pct;
+    int tick_start_bytes;
+    int64_t tick_start_us;
+} ota_sink_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint32_t old_size;
+    uint32_t new_size;
+    uint32_t flags;
+    uint8_t old_sha256[32];
+    uint8_t new_sha256[32];
+} ota_patch_hdr_t;
+
+typedef struct {
+    ota_sink_t *sink;
+    const esp_partition_t *base;
+    uint32_t base_size;
+    int64_t old_pos;
+    int32_t seek;
+    int field;
+    int shift;
+    uint32_t varint;
+    uint32_t op_add;
+    uint32_t op_copy;
+    uint32_t add_left;
+    uint32_t copy_left;
+    size_t out_len;
+    uint8_t old_buf[OTA_PATCH_OLD_BYTES];
+    uint8_t out[OTA_PATCH_OUT_BYTES];
+} ota_patch_t;
+
+typedef esp_err_t (*ota_inflate_fn)(void *ctx, const uint8_t *data, size_t len);
+
+static bool hex_to_bytes(const char *hex, uint8_t *out, size_t out_len)
+{
+    if (!hex || strlen(hex) != out_len * 2) {
+        return false;
+    }
+    for (size_t i = 0; i < out_len; i++) {
+        char byte[3] = {hex[2 * i], hex[2 * i + 1], '\0'};
+        char *end = NULL;
+        out[i] = (uint8_t)strtoul(byte, &end, 16);
+        if (!end || *end != '\0') {
+            return false;
+        }
+    }
+    return true;
+}
+
+static const char *skip_version_prefix(const char *version)
+{
+    return (version[0] == 'v' || version[0] == 'V') ? version + 1 : version;
+}
+
+// Only ota_task talks to the OTA hosts, so one Location buffer is enough.
+static char s_ota_location[HTTP_URL_MAX];
+
+static esp_err_t ota_http_event_handler(esp_http_client_event_t *evt)
+{
+    if (evt->event_id == HTTP_EVENT_ON_HEADER && evt->header_key && evt->header_value &&
+        strcasecmp(evt->header_key, "Location") == 0) {
+        strncpy(s_ota_location, evt->header_value, sizeof(s_ota_location) - 1);
+        s_ota_location[sizeof(s_ota_location) - 1] = '\0';
+    }
+    return ESP_OK;
+}
+
+// GitHub release assets answer with a redirect to the CDN. Each hop gets its
+// own client so the new host goes through the DNS cache and gets its own
+// SNI name; the body is read with esp_http_client_read, not perform.
+static esp_http_client_handle_t ota_http_begin(const char *url, int64_t *content_len, esp_err_t *err)
+{
+    char hop[HTTP_URL_MAX];
+    strncpy(hop, url, sizeof(hop) - 1);
+    hop[sizeof(hop) - 1] = '\0';
+
+    for (int redirects = 0;; redirects++) {
+        char ip_url[HTTP_URL_MAX];
+        char host[DNS_HOST_MAX];
+        char ip[16];
+        bool via_ip = http_url_via_cache(hop, ip_url, sizeof(ip_url), host, sizeof(host), ip);
+        esp_http_client_config_t http_cfg = {
+            .url = via_ip ? ip_url : hop,
+            .timeout_ms = OTA_HTTP_TIMEOUT_MS,
+            .buffer_size = OTA_HTTP_RX_BUFFER,
+            .buffer_size_tx = OTA_HTTP_TX_BUFFER,
+            .keep_alive_enable = true,
+            .disable_auto_redirect = true,
+            .event_handler = ota_http_event_handler,
+            .common_name = via_ip ? host : NULL,
+        };
+#if HAS_CRT_BUNDLE
+        http_cfg.crt_bundle_attach = esp_crt_bundle_attach;
+#endif
+
+        uint32_t wait_ms = 0;
+        if (!net_guard_acquire(&s_guard_ota, &wait_ms)) {
+            ESP_LOGW(TAG, "OTA network backing off for %u ms", (unsigned)wait_ms);
+            *err = ESP_ERR_INVALID_STATE;
+            return NULL;
+        }
+        esp_http_client_handle_t client = esp_http_client_init(&http_cfg);
+        if (!client) {
+            *err = ESP_ERR_NO_MEM;
+            return NULL;
+        }
+        if (via_ip) {
+            esp_http_client_set_header(client, "Host", host);
+        }
+
+        s_ota_location[0] = '\0';
+        *err = esp_http_client_open(client, 0);
+        if (*err != ESP_OK) {
+            net_guard_report(&s_guard_ota, -1, 0);
+            esp_http_client_cleanup(client);
+            return NULL;
+        }
+        *content_len = esp_http_client_fetch_headers(client);
+        int status = esp_http_client_get_status_code(client);
+        net_guard_report(&s_guard_ota, *content_len < 0 ? -1 : status, 0);
+        if (status == 200) {
+            return client;
+        }
+
+        bool redirect = (status == HttpStatus_MovedPermanently || status == HttpStatus_Found ||
+                         status == HttpStatus_SeeOther || status == HttpStatus_TemporaryRedirect ||
+                         status == HttpStatus_PermanentRedirect);
+        esp_http_client_close(client);
+        esp_http_client_cleanup(client);
+        if (!redirect || redirects >= OTA_MAX_REDIRECTS || strncmp(s_ota_location, "http", 4) != 0) {
+            ESP_LOGW(TAG, "OTA http status %d", status);
+            *err = ESP_FAIL;
+            return NULL;
+        }
+        memcpy(hop, s_ota_location, sizeof(hop));
+    }
+}
+
+static void ota_http_end(esp_http_client_handle_t client)
+{
+    esp_http_client_close(client);
+    esp_http_client_cleanup(client);
+}
+
+// manifest.json is written by scripts/release-local.ps1 next to sniffer_esp.bin:
+// {"version":"1.0.23","size":999248,"sha256":"<file>","app_sha256":"<appended digest>",
+//  "patch_base":"<app_sha256 of the previous release>","patch_size":1204,"deflate_size":657775}
+static bool ota_fetch_manifest(ota_manifest_t *manifest, char *result, size_t result_len)
+{
+    char body[OTA_MANIFEST_MAX];
+    int64_t content_len = 0;
+    esp_err_t err = ESP_OK;
+    esp_http_client_handle_t client = ota_http_begin(OTA_MANIFEST_URL, &content_len, &err);
+    if (!client) {
+        snprintf(result, result_len, "ota: manifest unavailable (%s)", esp_err_to_name(err));
+        return false;
+    }
+    int len = 0;
+    while (len < (int)sizeof(body) - 1) {
+        int n = esp_http_client_read(client, body + len, (int)sizeof(body) - 1 - len);
+        if (n <= 0) {
+            break;
+        }
+        len += n;
+    }
+    body[len] = '\0';
+    ota_http_end(client);
+
+    cJSON *root = cJSON_Parse(body);
+    cJSON *version = root ? cJSON_GetObjectItem(root, "version") : NULL;
+    cJSON *size = root ? cJSON_GetObjectItem(root, "size") : NULL;
+    cJSON *sha256 = root ? cJSON_GetObjectItem(root, "sha256") : NULL;
+    cJSON *app_sha256 = root ? cJSON_GetObjectItem(root, "app_sha256") : NULL;
+    bool ok = cJSON_IsString(version) && version->valuestring[0] != '\0' && cJSON_IsNumber(size) &&
+              size->valuedouble > 0 && cJSON_IsString(sha256) &&
+              hex_to_bytes(sha256->valuestring, manifest->sha256, sizeof(manifest->sha256));
+    if (ok) {
+        strncpy(manifest->version, skip_version_prefix(version->valuestring), sizeof(manifest->version) - 1);
+        manifest->version[sizeof(manifest->version) - 1] = '\0';
+        manifest->size = (int)size->valuedouble;
+        manifest->has_app_sha256 = cJSON_IsString(app_sha256) &&
+                                   hex_to_bytes(app_sha256->valuestring, manifest->app_sha256, sizeof(manifest->app_sha256));
+        cJSON *patch_base = cJSON_GetObjectItem(root, "patch_base");
+        cJSON *patch_size = cJSON_GetObjectItem(root, "patch_size");
+        manifest->has_patch = cJSON_IsString(patch_base) && cJSON_IsNumber(patch_size) &&
+                              hex_to_bytes(patch_base->valuestring, manifest->patch_base, sizeof(manifest->patch_base));
+        manifest->patch_size = manifest->has_patch ? (int)patch_size->valuedouble : 0;
+        cJSON *deflate_size = cJSON_GetObjectItem(root, "deflate_size");
+        manifest->deflate_size = cJSON_IsNumber(deflate_size) ? (int)deflate_size->valuedouble : 0;
+    } else {
+        snprintf(result, result_len, "ota: manifest invalid");
+    }
+    cJSON_Delete(root);
+    return ok;
+}
+
+static bool ota_image_is_current(const ota_manifest_t *manifest, const uint8_t *running_sha)
+{
+    const esp_app_desc_t *app_desc = esp_app_get_description();
+    if (!app_desc || strcmp(skip_version_prefix(app_desc->version), manifest->version) != 0) {
+        return false;
+    }
+    // Same tag rebuilt: the digest appended by esptool tells the images apart.
+    return !manifest->has_app_sha256 || (running_sha && memcmp(running_sha, manifest->app_sha256, 32) == 0);
+}
+
+static esp_err_t ota_sink_begin(ota_sink_t *sink, const esp_partition_t *target, int total)
+{
+    memset(sink, 0, sizeof(*sink));
+    sink->target = target;
+    sink->total = total;
+    sink->next_report_pct = OTA_PROGRESS_STEP_PCT;
+    sink->tick_start_us = esp_timer_get_time();
+    mbedtls_sha256_init(&sink->sha);
+    mbedtls_sha256_starts(&sink->sha, 0);
+    esp_err_t err = esp_ota_begin(target, OTA_WITH_SEQUENTIAL_WRITES, &sink->handle);
+    sink->open = (err == ESP_OK);
+    return err;
+}
+
+static void ota_sink_abort(ota_sink_t *sink)
+{
+    if (sink->open) {
+        esp_ota_abort(sink->handle);
+        sink->open = false;
+    }
+    mbedtls_sha256_free(&sink->sha);
+}
+
+static esp_err_t ota_sink_write(ota_sink_t *sink, const uint8_t *data, size_t len)
+{
+    if (sink->written + (int)len > sink->total) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    mbedtls_sha256_update(&sink->sha, data, len);
+    esp_err_t err = esp_ota_write(sink->handle, data, len);
+    if (err != ESP_OK) {
+        return err;
+    }
+    sink->written += (int)len;
+
+    s_ota_pct = (int)((int64_t)sink->written * 100 / sink->total);
+    if (s_ota_pct >= sink->next_report_pct && s_ota_pct < 100) {
+        char progress[64];
+        snprintf(progress, sizeof(progress), "ota: %d%% (%d/%d KB)", s_ota_pct, sink->written / 1024, sink->total / 1024);
+        ota_notify(progress);
+        sink->next_report_pct = (s_ota_pct / OTA_PROGRESS_STEP_PCT + 1) * OTA_PROGRESS_STEP_PCT;
+    }
+
+    if (sink->written - sink->tick_start_bytes >= CONFIG_SNIFFER_OTA_BYTES_PER_TICK) {
+        int64_t elapsed_us = esp_timer_get_time() - sink->tick_start_us;
+        int64_t tick_us = (int64_t)CONFIG_SNIFFER_OTA_TICK_MS * 1000LL;
+        if (elapsed_us < tick_us) {
+            vTaskDelay(pdMS_TO_TICKS((tick_us - elapsed_us) / 1000) + 1);
+        }
+        sink->tick_start_bytes = sink->written;
+        sink->tick_start_us = esp_timer_get_time();
+    }
+    return ESP_OK;
+}
+
+// Checks size and hash against the manifest before the slot is closed, so a
+// bad image never becomes bootable.
+static esp_err_t ota_sink_finish(ota_sink_t *sink, const uint8_t *expected_sha)
+{
+    uint8_t digest[32];
+    mbedtls_sha256_finish(&sink->sha, digest);
+    mbedtls_sha256_free(&sink->sha);
+
+    esp_err_t err = ESP_OK;
+    if (sink->written != sink->total) {
+        err = ESP_ERR_INVALID_SIZE;
+    } else if (memcmp(digest, expected_sha, sizeof(digest)) != 0) {
+        err = ESP_ERR_INVALID_CRC;
+    }
+    if (err != ESP_OK) {
+        esp_ota_abort(sink->handle);
+    } else {
+        err = esp_ota_end(sink->handle);
+    }
+    sink->open = false;
+    return err;
+}
+
+static esp_err_t ota_stream_full(ota_sink_t *sink)
+{
+    int64_t content_len = 0;
+    esp_err_t err = ESP_OK;
+    esp_http_client_handle_t client = ota_http_begin(OTA_URL, &content_len, &err);
+    if (!client) {
+        return err;
+    }
+    if (content_len > 0 && content_len != sink->total) {
+        ota_http_end(client);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    char *chunk = malloc(OTA_CHUNK_BYTES);
+    if (!chunk) {
+        ota_http_end(client);
+        return ESP_ERR_NO_MEM;
+    }
+    while (err == ESP_OK && sink->written < sink->total) {
+        int want = sink->total - sink->written;
+        if (want > OTA_CHUNK_BYTES) {
+            want = OTA_CHUNK_BYTES;
+        }
+        int n = esp_http_client_read(client, chunk, want);
+        if (n <= 0) {
+            err = (n == 0) ? ESP_ERR_INVALID_SIZE : ESP_FAIL;
+            break;
+        }
+        err = ota_sink_write(sink, (const uint8_t *)chunk, (size_t)n);
+    }
+    free(chunk);
+    ota_http_end(client);
+    return err;
+}
+
+#if HAS_ROM_MINIZ
+// Raw deflate with a 4 KB window (zlib wbits -12): the circular output buffer
+// doubles as the inflate dictionary, so RAM stays at decompressor + 5 KB.
+static esp_err_t ota_inflate_stream(esp_http_client_handle_t client, ota_inflate_fn fn, void *ctx)
+{
+    tinfl_decompressor *inflator = malloc(sizeof(*inflator));
+    uint8_t *dict = malloc(OTA_INFLATE_DICT_BYTES);
+    uint8_t *in = malloc(OTA_INFLATE_IN_BYTES);
+    esp_err_t err = (inflator && dict && in) ? ESP_OK : ESP_ERR_NO_MEM;
+    if (err == ESP_OK) {
+        tinfl_init(inflator);
+    }
+
+    size_t in_pos = 0;
+    size_t in_len = 0;
+    size_t dict_ofs = 0;
+    bool eof = false;
+    while (err == ESP_OK) {
+        if (in_pos == in_len && !eof) {
+            int n = esp_http_client_read(client, (char *)in, OTA_INFLATE_IN_BYTES);
+            if (n < 0) {
+                err = ESP_FAIL;
+                break;
+            }
+            eof = (n == 0);
+            in_pos = 0;
+            in_len = (size_t)n;
+        }
+
+        size_t in_size = in_len - in_pos;
+        size_t out_size = OTA_INFLATE_DICT_BYTES - dict_ofs;
+        tinfl_status status = tinfl_decompress(inflator,
+                                               in + in_pos,
+                                               &in_size,
+                                               dict,
+                                               dict + dict_ofs,
+                                               &out_size,
+                                               eof ? 0 : TINFL_FLAG_HAS_MORE_INPUT);
+        in_pos += in_size;
+        if (out_size > 0) {
+            err = fn(ctx, dict + dict_ofs, out_size);
+        }
+        dict_ofs = (dict_ofs + out_size) & (OTA_INFLATE_DICT_BYTES - 1);
+
+        if (status == TINFL_STATUS_DONE) {
+            break;
+        }
+        if (status < 0 || (status == TINFL_STATUS_NEEDS_MORE_INPUT && eof)) {
+            err = ESP_ERR_INVALID_RESPONSE;
+        }
+    }
+
+    free(in);
+    free(dict);
+    free(inflator);
+    return err;
+}
+
+static esp_err_t ota_sink_feed(void *ctx, const uint8_t *data, size_t len)
+{
+    return ota_sink_write((ota_sink_t *)ctx, data, len);
+}
+
+static esp_err_t ota_stream_deflate(ota_sink_t *sink)
+{
+    int64_t content_len = 0;
+    esp_err_t err = ESP_OK;
+    esp_http_client_handle_t client = ota_http_begin(OTA_DEFLATE_URL, &content_len, &err);
+    if (!client) {
+        return err;
+    }
+    err = ota_inflate_stream(client, ota_sink_feed, sink);
+    ota_http_end(client);
+    return err;
+}
+
+static esp_err_t ota_patch_flush(ota_patch_t *patch)
+{
+    esp_err_t err = ota_sink_write(patch->sink, patch->out, patch->out_len);
+    patch->out_len = 0;
+    return err;
+}
+
+// Consumes inflated patch bytes: varint op headers, then add bytes (summed
+// with the running image at the cursor) and literal copy bytes.
+static esp_err_t ota_patch_feed(void *ctx, const uint8_t *data, size_t len)
+{
+    ota_patch_t *patch = (ota_patch_t *)ctx;
+    esp_err_t err = ESP_OK;
+
+    while (len > 0 && err == ESP_OK) {
+        size_t room = sizeof(patch->out) - patch->out_len;
+        if (patch->add_left > 0) {
+            size_t n = len;
+            if (n > patch->add_left) {
+                n = patch->add_left;
+            }
+            if (n > room) {
+                n = room;
+            }
+            if (n > sizeof(patch->old_buf)) {
+                n = sizeof(patch->old_buf);
+            }
+            if (patch->old_pos < 0 || patch->old_pos + (int64_t)n > patch->base_size) {
+                return ESP_ERR_INVALID_SIZE;
+            }
+            err = esp_partition_read(patch->base, (size_t)patch->old_pos, patch->old_buf, n);
+            for (size_t i = 0; i < n; i++) {
+                patch->out[patch->out_len + i] = (uint8_t)(patch->old_buf[i] + data[i]);
+            }
+            patch->out_len += n;
+            patch->old_pos += (int64_t)n;
+            patch->add_left -= (uint32_t)n;
+            if (patch->add_left == 0) {
+                patch->old_pos += patch->seek;
+            }
+            data += n;
+            len -= n;
+        } else if (patch->copy_left > 0) {
+            size_t n = len;
+            if (n > patch->copy_left) {
+                n = patch->copy_left;
+            }
+            if (n > room) {
+                n = room;
+            }
+            memcpy(patch->out + patch->out_len, data, n);
+            patch->out_len += n;
+            patch->copy_left -= (uint32_t)n;
+            data += n;
+            len -= n;
+        } else {
+            uint8_t b = *data++;
+            len--;
+            if (patch->shift > 28) {
+                return ESP_ERR_INVALID_RESPONSE;
+            }
+            patch->varint |= (uint32_t)(b & 0x7F) << patch->shift;
+            patch->shift += 7;
+            if (b & 0x80) {
+                continue;
+            }
+            // The op starts only once add, copy and seek have all been read.
+            if (patch->field == 0) {
+                patch->op_add = patch->varint;
+            } else if (patch->field == 1) {
+                patch->op_copy = patch->varint;
+            } else {
+                patch->seek = (int32_t)((patch->varint >> 1) ^ (0u - (patch->varint & 1u)));
+                patch->add_left = patch->op_add;
+                patch->copy_left = patch->op_copy;
+                if (patch->add_left == 0) {
+                    patch->old_pos += patch->seek;
+                }
+            }
+            patch->field = (patch->field + 1) % 3;
+            patch->varint = 0;
+            patch->shift = 0;
+        }
+
+        if (err == ESP_OK && patch->out_len == sizeof(patch->out)) {
+            err = ota_patch_flush(patch);
+        }
+    }
+    return err;
+}
+
+static esp_err_t ota_apply_patch(ota_sink_t *sink, const ota_manifest_t *manifest, const esp_partition_t *base)
+{
+    int64_t content_len = 0;
+    esp_err_t err = ESP_OK;
+    esp_http_client_handle_t client = ota_http_begin(OTA_PATCH_URL, &content_len, &err);
+    if (!client) {
+        return err;
+    }
+
+    ota_patch_hdr_t hdr;
+    int got = 0;
+    while (got < (int)sizeof(hdr)) {
+        int n = esp_http_client_read(client, (char *)&hdr + got, (int)sizeof(hdr) - got);
+        if (n <= 0) {
+            ota_http_end(client);
+            return ESP_ERR_INVALID_SIZE;
+        }
+        got += n;
+    }
+    // The base image is identified by its app digest in the manifest; the
+    // whole-file hash of the result is what gets verified in the end.
+    if (hdr.magic != OTA_PATCH_MAGIC || (int)hdr.new_size != manifest->size || hdr.old_size > base->size ||
+        memcmp(hdr.new_sha256, manifest->sha256, sizeof(hdr.new_sha256)) != 0) {
+        ota_http_end(client);
+        return ESP_ERR_INVALID_VERSION;
+    }
+
+    ota_patch_t *patch = calloc(1, sizeof(*patch));
+    if (!patch) {
+        ota_http_end(client);
+        return ESP_ERR_NO_MEM;
+    }
+    patch->sink = sink;
+    patch->base = base;
+    patch->base_size = hdr.old_size;
+
+    err = ota_inflate_stream(client, ota_patch_feed, patch);
+    if (err == ESP_OK && patch->out_len > 0) {
+        err = ota_patch_flush(patch);
+    }
+    free(patch);
+    ota_http_end(client);
+    return err;
+}
+#endif
+
+static const char *ota_source_tag(ota_source_t source)
+{
+    switch (source) {
+    case OTA_SRC_PATCH:
+        return "delta";
+    case OTA_SRC_DEFLATE:
+        return "deflate";
+    default:
+        return "full";
+    }
+}
+
+// One attempt into a fresh slot; a failed attempt leaves nothing bootable.
+static esp_err_t ota_write_from(ota_sink_t *sink,
+                                const esp_partition_t *target,
+                                const ota_manifest_t *manifest,
+                                ota_source_t source,
+                                const esp_partition_t *running)
+{
+    esp_err_t err = ota_sink_begin(sink, target, manifest->size);
+    if (err == ESP_OK) {
+#if HAS_ROM_MINIZ
+        if (source == OTA_SRC_PATCH) {
+            err = ota_apply_patch(sink, manifest, running);
+        } else if (source == OTA_SRC_DEFLATE) {
+            err = ota_stream_deflate(sink);
+        } else
+#endif
+        {
+            err = ota_stream_full(sink);
+        }
+    }
+    if (err == ESP_OK) {
+        return ota_sink_finish(sink, manifest->sha256);
+    }
+    ota_sink_abort(sink);
+    return err;
+}
+
+// Manifest first: a no-op /update costs one small request instead of the
+// whole image. Then the cheapest usable artifact is tried: a delta from the
+// running image (old bytes read from the running slot), the raw-deflated
+// image, and finally the plain image; each failure falls through to the next.
+// The SHA-256 is computed on the fly and checked against the manifest before
+// the boot partition is switched. At most CONFIG_SNIFFER_OTA_BYTES_PER_TICK
+// are flashed per CONFIG_SNIFFER_OTA_TICK_MS, so flash writes (which stall
+// non-IRAM code) never starve the capture and decode stages for long; capture
+// drops during the update are measured from the ISR counters and reported with
+// the result.
+static bool ota_update_from_github(bool force, char *result, size_t result_len)
+{
+    if (strlen(OTA_URL) == 0 || strlen(OTA_MANIFEST_URL) == 0) {
+        snprintf(result, result_len, "ota: URL is empty");
+        return false;
+    }
+
+    ota_manifest_t manifest = {0};
+    if (!ota_fetch_manifest(&manifest, result, result_len)) {
+        ESP_LOGW(TAG, "%s", result);
+        return false;
+    }
+
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    uint8_t running_sha[32];
+    bool have_running_sha = (esp_partition_get_sha256(running, running_sha) == ESP_OK);
+    if (!force && ota_image_is_current(&manifest, have_running_sha ? running_sha : NULL)) {
+        snprintf(result, result_len, "ota: already up to date (%s)", manifest.version);
+        return false;
+    }
+
+    const esp_partition_t *target = esp_ota_get_next_update_partition(NULL);
+    if (!target || (uint32_t)manifest.size > target->size) {
+        snprintf(result, result_len, "ota: image does not fit (%d bytes)", manifest.size);
+        return false;
+    }
+
+    ota_source_t sources[3];
+    int wire_size[3];
+    int nsources = 0;
+    if (HAS_ROM_MINIZ && strlen(OTA_PATCH_URL) > 0 && manifest.has_patch && have_running_sha &&
+        memcmp(running_sha, manifest.patch_base, sizeof(running_sha)) == 0) {
+        wire_size[nsources] = manifest.patch_size;
+        sources[nsources++] = OTA_SRC_PATCH;
+    }
+    if (HAS_ROM_MINIZ && strlen(OTA_DEFLATE_URL) > 0 && manifest.deflate_size > 0) {
+        wire_size[nsources] = manifest.deflate_size;
+        sources[nsources++] = OTA_SRC_DEFLATE;
+    }
+    wire_size[nsources] = manifest.size;
+    sources[nsources++] = OTA_SRC_FULL;
+
+    char start_msg[64];
+    snprintf(start_msg,
+             sizeof(start_msg),
+             "ota: %s, %d KB %s",
+             manifest.version,
+             wire_size[0] / 1024,
+             ota_source_tag(sources[0]));
+    ota_notify(start_msg);
+    ESP_LOGI(TAG, "OTA start: %s (%s, %d bytes, %s)", OTA_URL, manifest.version, manifest.size, ota_source_tag(sources[0]));
+
+    uint32_t dropped_before = s_metrics.isr_dropped;
+    s_metrics.queue_peak = 0;
+
+    ota_sink_t sink;
+    esp_err_t err = ESP_FAIL;
+    int used = 0;
+    for (; used < nsources; used++) {
+        err = ota_write_from(&sink, target, &manifest, sources[used], running);
+        if (err == ESP_OK || used + 1 == nsources) {
+            break;
+        }
+        char fallback[80];
+        snprintf(fallback,
+                 sizeof(fallback),
+                 "ota: %s failed (%s), trying %s",
+                 ota_source_tag(sources[used]),
+                 esp_err_to_name(err),
+                 ota_source_tag(sources[used + 1]));
+        ESP_LOGW(TAG, "%s", fallback);
+        ota_notify(fallback);
+    }
+    if (err == ESP_OK) {
+        err = esp_ota_set_boot_partition(target);
+    }
+
+    s_metrics.ota_dropped = s_metrics.isr_dropped - dropped_before;
+    s_metrics.ota_queue_peak = s_metrics.queue_peak;
+    if (err == ESP_OK) {
+        snprintf(result,
+                 result_len,
+                 "ota: %s ok (%s), rebooting (capture drops=%u, queue peak=%u/%d)",
+                 manifest.version,
+                 ota_source_tag(sources[used]),
+                 (unsigned)s_metrics.ota_dropped,
+                 (unsigned)s_metrics.ota_queue_peak,
+                 EVENT_QUEUE_LEN);
+        return true;
+    }
+
+    if (err == ESP_ERR_INVALID_CRC) {
+        snprintf(result, result_len, "ota: failed (sha256 mismatch)");
+    } else {
+        snprintf(result, result_len, "ota: failed (%s at %d/%d)", esp_err_to_name(err), sink.written, manifest.size);
+    }
+    ESP_LOGW(TAG, "%s", result);
+    return false;
+}
+
+static void ota_task(void *arg)
+{
+    bool force = (arg != NULL);
+    char result[128];
+    bool ok = ota_update_from_github(force, result, sizeof(result));
+    ota_notify(result);
+    ESP_LOGI(TAG, "%s", result);
+
+    if (ok) {
+#if CONFIG_SNIFFER_ENABLE_RLOG
+        rlog_flush();
+#endif
+        vTaskDelay(pdMS_TO_TICKS(1000));
+        esp_restart();
+    }
+
+    s_ota_task = NULL;
+    vTaskDelete(NULL);
+}
+#endif
+
+static bool ota_start(const char *chat_id, bool force, char *result, size_t result_len)
+{
+#if CONFIG_SNIFFER_ENABLE_OTA
+    if (s_ota_task) {
+        snprintf(result, result_len, "ota: already running (%d%%)", s_ota_pct);
+        return false;
+    }
+
+    strncpy(s_ota_chat_id, chat_id, sizeof(s_ota_chat_id) - 1);
+    s_ota_chat_id[sizeof(s_ota_chat_id) - 1] = '\0';
+    s_ota_pct = 0;
+    // Below net_task, so Telegram polling keeps running during the download.
+    if (xTaskCreate(ota_task, "ota_task", OTA_TASK_STACK, force ? (void *)1 : NULL, 3, &s_ota_task) != pdPASS) {
+        s_ota_task = NULL;
+        snprintf(result, result_len, "ota: failed (no memory for task)");
+        return false;
+    }
+    snprintf(result, result_len, "ota: checking %s", force ? "(forced)" : "manifest");
+    return true;
+#else
+    (void)chat_id;
+    (void)force;
+    snprintf(result, result_len, "ota: disabled in config");
+    return false;
+#endif
+}
+
+static void build_decoded_reply(char *out, size_t out_len)
+{
+    char decoded[16] = {0};
+    char decode_status[24] = {0};
+    int64_t frame_us = 0;
+
+    xSemaphoreTake(s_state_mutex, portMAX_DELAY);
+    strncpy(decoded, s_last_decoded, sizeof(decoded) - 1);
+    strncpy(decode_status, s_last_decode_status, sizeof(decode_status) - 1);
+    frame_us = s_last_frame_us;
+    xSemaphoreGive(s_state_mutex);
+
+    int64_t age_us = esp_timer_get_time() - frame_us;
+    if (frame_us > 0 && age_us <= STATUS_STALE_US && strncmp(decode_status, "ok(", 3) == 0) {
+        snprintf(out, out_len, "%s", decoded);
+    } else {
+        snprintf(out, out_len, "unknown");
+    }
+}
+
+static void build_fw_version_reply(char *out, size_t out_len)
+{
+    const esp_app_desc_t *app_desc = esp_app_get_description();
+    const char *fw_version = (app_desc && app_desc->version[0] != '\0') ? app_desc->version : "unknown";
+    snprintf(out, out_len, "%s", fw_version);
+}
+
+// Appends one formatted fragment only if it fits with `reserve` bytes to
+// spare for closing brackets; otherwise leaves `out` as it was.
+static bool json_append(char *out, size_t out_len, size_t *used, size_t reserve, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(out + *used, out_len - *used, fmt, ap);
+    va_end(ap);
+    if (len < 0 || *used + (size_t)len + reserve >= out_len) {
+        out[*used] = '\0';
+        return false;
+    }
+    *used += (size_t)len;
+    return true;
+}
+
+#if CONFIG_SNIFFER_ENABLE_TELEGRAM
+static void tg_cmd_append_metrics(char *out, size_t out_len, size_t *used);
+#endif
+
+static void build_metrics_json(char *out, size_t out_len)
+{
+    // Each section goes in whole or not at all, and always leaves room for the
+    // closing braces, so a full buffer drops sections instead of breaking the JSON.
+    size_t used = 0;
+    if (!json_append(out,
+                     out_len,
+                     &used,
+                     1,
+                     "{\"uptime_ms\":%lld,\"isr_events\":%u,\"isr_dropped\":%u,\"queue_free\":%u,"
+                     "\"frames\":%u,\"frames_misaligned\":%u,\"frame_overflows\":%u,"
+                     "\"decode_ok\":%u,\"decode_partial\":%u,\"decode_unknown\":%u,\"push_dropped\":%u,"
+                     "\"queue_peak\":%u,\"ota_dropped\":%u,\"ota_queue_peak\":%u,"
+                     "\"idle_flush\":{\"n\":%u,\"last_us\":%u,\"max_us\":%u},"
+                     "\"corrected\":{\"frames\":%u,\"bits\":%u},"
+                     "\"decode_cache\":{\"hits\":%u,\"misses\":%u,\"hit_pct\":%u}",
+                     (long long)(esp_timer_get_time() / 1000),
+                     (unsigned)s_metrics.isr_events,
+                     (unsigned)s_metrics.isr_dropped,
+                     s_bit_queue ? (unsigned)uxQueueSpacesAvailable(s_bit_queue) : 0U,
+                     (unsigned)s_metrics.frames,
+                     (unsigned)s_metrics.frames_misaligned,
+                     (unsigned)s_metrics.frame_overflows,
+                     (unsigned)s_metrics.decode_ok,
+                     (unsigned)s_metrics.decode_partial,
+                     (unsigned)s_metrics.decode_unknown,
+                     (unsigned)s_push.dropped,
+                     (unsigned)s_metrics.queue_peak,
+                     (unsigned)s_metrics.ota_dropped,
+                     (unsigned)s_metrics.ota_queue_peak,
+                     (unsigned)s_metrics.idle_flushes,
+                     (unsigned)s_metrics.idle_flush_last_us,
+                     (unsigned)s_metrics.idle_flush_max_us,
+                     (unsigned)s_metrics.corrected_frames,
+                     (unsigned)s_metrics.corrected_bits,
+                     (unsigned)s_decode_cache_hits,
+                     (unsigned)s_decode_cache_misses,
+                     (s_decode_cache_hits + s_decode_cache_misses) > 0
+                         ? (unsigned)((uint64_t)s_decode_cache_hits * 100U / (s_decode_cache_hits + s_decode_cache_misses))
+                         : 0U)) {
+        snprintf(out, out_len, "{}");
+        return;
+    }
+    if (s_boot.wifi_start_us > 0) {
+        json_append(out,
+                    out_len,
+                    &used,
+                    1,
+                    ",\"boot\":{\"assoc_ms\":%lld,\"ip_ms\":%lld,\"dns_ms\":%lld,\"first_poll_ms\":%lld,\"fast\":%d,\"static_ip\":%d}",
+                    (long long)(s_boot.assoc_us / 1000),
+                    (long long)(s_boot.got_ip_us / 1000),
+                    (long long)(s_boot.dns_us / 1000),
+                    (long long)(s_boot.first_poll_us / 1000),
+                    s_boot.fast_connect ? 1 : 0,
+                    s_boot.static_ip ? 1 : 0);
+    }
+    json_append(out,
+                out_len,
+                &used,
+                1,
+                ",\"heap\":{\"free\":%u,\"min_free\":%u,\"largest\":%u,\"largest_min\":%u,\"psram_free\":%u},"
+                "\"json_arena\":{\"cap\":%u,\"peak\":%u,\"overflows\":%u,\"resets\":%u}",
+                (unsigned)esp_get_free_heap_size(),
+                (unsigned)esp_get_minimum_free_heap_size(),
+                (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT),
+                (unsigned)s_heap.largest_min,
+                (unsigned)heap_caps_get_free_size(MALLOC_CAP_SPIRAM),
+                (unsigned)s_json_arena.cap,
+                (unsigned)s_json_arena.peak,
+                (unsigned)s_json_arena.overflows,
+                (unsigned)s_json_arena.resets);
+#if CONFIG_SNIFFER_ENABLE_TELEMETRY
+    // "tasks":{"net_task":[stack_free_bytes,cpu_pct],...} from the last sample.
+    xSemaphoreTake(s_state_mutex, portMAX_DELAY);
+    if (s_telemetry.sampled_us > 0 &&
+        json_append(out,
+                    out_len,
+                    &used,
+                    3,
+                    ",\"telemetry\":{\"age_ms\":%lld,\"alerts\":%u,\"more\":%u,\"tasks\":{",
+                    (long long)((esp_timer_get_time() - s_telemetry.sampled_us) / 1000),
+                    (unsigned)s_telemetry.alerts,
+                    (unsigned)s_telemetry.more)) {
+        for (int i = 0; i < s_telemetry.ntasks; i++) {
+            const telemetry_task_t *t = &s_telemetry.tasks[i];
+            if (!json_append(out,
+                             out_len,
+                             &used,
+                             3,
+                             "%s\"%s\":[%u,%d]",
+                             i == 0 ? "" : ",",
+                             t->name,
+                             (unsigned)t->stack_free,
+                             (int)t->cpu_pct)) {
+                break;
+            }
+        }
+        json_append(out, out_len, &used, 1, "}}");
+    }
+    xSemaphoreGive(s_state_mutex);
+#endif
+    const net_guard_t *guards[] = {&s_guard_telegram, &s_guard_ota};
+    static const char *const guard_states[] = {"closed", "open", "half_open"};
+    if (json_append(out, out_len, &used, 2, ",\"net\":{")) {
+        for (size_t i = 0; i < sizeof(guards) / sizeof(guards[0]); i++) {
+            const net_guard_t *g = guards[i];
+            json_append(out,
+                        out_len,
+                        &used,
+                        2,
+                        "%s\"%s\":{\"state\":\"%s\",\"failures\":%u,\"trips\":%u,\"rejected\":%u,\"throttled\":%u}",
+                        i == 0 ? "" : ",",
+                        g->name,
+                        guard_states[g->state],
+                        (unsigned)g->failures,
+                        (unsigned)g->trips,
+                        (unsigned)g->rejected,
+                        (unsigned)g->throttled);
+        }
+        json_append(out, out_len, &used, 1, "}");
+    }
+    if (s_dns_mutex) {
+        json_append(out,
+                    out_len,
+                    &used,
+                    1,
+                    ",\"dns\":{\"hits\":%u,\"misses\":%u,\"refreshes\":%u,\"failures\":%u,\"stale_served\":%u}",
+                    (unsigned)s_dns_stats.hits,
+                    (unsigned)s_dns_stats.misses,
+                    (unsigned)s_dns_stats.refreshes,
+                    (unsigned)s_dns_stats.failures,
+                    (unsigned)s_dns_stats.stale_served);
+    }
+    // Depth of each stage's input: bits (capture), frames (decode), readings (publish).
+    json_append(out,
+                out_len,
+                &used,
+                1,
+                ",\"pipeline\":{\"bits\":{\"depth\":%u,\"peak\":%u,\"cap\":%d,\"dropped\":%u},"
+                "\"frames\":{\"depth\":%u,\"peak\":%u,\"cap\":%d,\"dropped\":%u},"
+                "\"readings\":{\"depth\":%u,\"peak\":%u,\"cap\":%d,\"dropped\":%u}}",
+                s_bit_queue ? (unsigned)uxQueueMessagesWaiting(s_bit_queue) : 0U,
+                (unsigned)s_metrics.queue_peak,
+                EVENT_QUEUE_LEN,
+                (unsigned)s_metrics.isr_dropped,
+                (unsigned)spsc_depth(&s_frame_ring),
+                (unsigned)s_frame_ring.peak,
+                PIPE_FRAME_SLOTS,
+                (unsigned)s_frame_ring.dropped,
+                (unsigned)spsc_depth(&s_reading_ring),
+                (unsigned)s_reading_ring.peak,
+                PIPE_READING_SLOTS,
+                (unsigned)s_reading_ring.dropped);
+#if CONFIG_SNIFFER_ENABLE_TELEGRAM
+    tg_cmd_append_metrics(out, out_len, &used);
+#endif
+#if CONFIG_SNIFFER_CAPTURE_STREAM
+    if (s_capture.free_q) {
+        json_append(out,
+                    out_len,
+                    &used,
+                    1,
+                    ",\"capture\":{\"frames\":%u,\"dropped\":%u,\"chunks\":%u,\"bytes\":%u,\"discarded\":%u,"
+                    "\"send_errors\":%u,\"connects\":%u}",
+                    (unsigned)s_capture.frames,
+                    (unsigned)s_capture.dropped,
+                    (unsigned)s_capture.chunks,
+                    (unsigned)s_capture.bytes,
+                    (unsigned)s_capture.discarded,
+                    (unsigned)s_capture.send_errors,
+                    (unsigned)s_capture.connects);
+    }
+#endif
+#if CONFIG_SNIFFER_ENABLE_TRIGGER
+    {
+        static const char *const states[] = {"off", "armed", "post", "held"};
+        json_append(out,
+                    out_len,
+                    &used,
+                    1,
+                    ",\"trigger\":{\"state\":\"%s\",\"fired\":%u,\"captures\":%u,\"truncated\":%u,\"held\":%d}",
+                    states[s_trigger.state],
+                    (unsigned)s_trigger.fired,
+                    (unsigned)s_trigger.captures,
+                    (unsigned)s_trigger.truncated,
+                    s_trigger.slot_ready ? 1 : 0);
+    }
+#endif
+    if (s_indicator_count > 0) {
+        json_append(out,
+                    out_len,
+                    &used,
+                    1,
+                    ",\"indicators\":{\"count\":%d,\"state\":%u,\"known\":%u,\"queued\":%d,\"lost\":%u}",
+                    s_indicator_count,
+                    (unsigned)s_indicator_state,
+                    (unsigned)s_indicator_known,
+                    s_indicator_event_count,
+                    (unsigned)s_indicator_events_lost);
+    }
+#if CONFIG_SNIFFER_STABILISER
+    {
+        json_append(out,
+                    out_len,
+                    &used,
+                    1,
+                    ",\"stabiliser\":{\"k\":%d,\"n\":%d,\"frames\":%u,\"published\":%u,\"held\":%u,"
+                    "\"disagree_pct\":%u,\"confidence\":%u}",
+                    STAB_AGREE,
+                    STAB_WINDOW,
+                    (unsigned)s_stab.frames,
+                    (unsigned)s_stab.published,
+                    (unsigned)s_stab.held,
+                    s_stab.frames > 0 ? (unsigned)((uint64_t)s_stab.disagree * 100U / s_stab.frames) : 0U,
+                    (unsigned)s_stab.confidence);
+    }
+#endif
+#if CONFIG_SNIFFER_DECODE_LEARN
+    {
+        static const char *const kinds[] = {"none", "direct", "mux", "single"};
+        uint8_t layout = s_learn.profile.layout;
+        json_append(out,
+                    out_len,
+                    &used,
+                    1,
+                    ",\"decode_profile\":{\"state\":\"%s\",\"layout\":\"%s@%u%s %s\",\"nbytes\":%u,"
+                    "\"fast\":%u,\"fallback\":%u,\"relearns\":%u,\"learned\":%u}",
+                    s_learn.locked ? "locked" : "learning",
+                    kinds[LAYOUT_KIND(layout)],
+                    (unsigned)LAYOUT_POS(layout),
+                    LAYOUT_ORDER(layout) ? "r" : "",
+                    mode_tag(mode_from_index(LAYOUT_MODE(layout))),
+                    (unsigned)s_learn.profile.nbytes,
+                    (unsigned)s_learn.fast,
+                    (unsigned)s_learn.fallback,
+                    (unsigned)s_learn.relearns,
+                    (unsigned)s_learn.seen);
+    }
+#endif
+#if CONFIG_SNIFFER_ENABLE_RLOG
+    // write_amp: bytes programmed per record byte appended (headers, partial
+    // page flushes). erase_amp: bytes erased per record byte, in whole sectors.
+    if (s_rlog_part) {
+        double payload = (double)s_rlog_stats.appended * RLOG_RECORD_BYTES;
+        json_append(out,
+                    out_len,
+                    &used,
+                    1,
+                    ",\"rlog\":{\"records\":%u,\"next_seq\":%u,\"program_ops\":%u,\"erases\":%u,\"crc_errors\":%u,"
+                    "\"write_amp\":%.3f,\"erase_amp\":%.2f,\"flash_busy_ms\":%lld}",
+                    (unsigned)s_rlog_stats.appended,
+                    (unsigned)s_rlog_next_seq,
+                    (unsigned)s_rlog_stats.program_ops,
+                    (unsigned)s_rlog_stats.erases,
+                    (unsigned)s_rlog_stats.crc_errors,
+                    payload > 0 ? (double)s_rlog_stats.bytes_programmed / payload : 0.0,
+                    payload > 0 ? (double)s_rlog_stats.erases * RLOG_SECTOR_BYTES / payload : 0.0,
+                    (long long)(s_rlog_stats.write_time_us / 1000));
+    }
+#endif
+    json_append(out, out_len, &used, 0, "}");
+}
+
+#if CONFIG_SNIFFER_ENABLE_HISTORY
+// Change log: fixed blocks of delta-encoded records. Each block restarts the
+// delta base, so evicting the oldest block never needs a re-encode.
+static history_block_t s_hist_blocks[HISTORY_BLOCKS];
+static int s_hist_tail;
+static int s_hist_nblocks;
+static history_run_t s_hist_run;
+static bool s_hist_run_active;
+
+static history_bucket_t s_hist_sec[120];
+static history_bucket_t s_hist_min[120];
+static history_bucket_t s_hist_hour[48];
+static const history_tier_t s_hist_tiers[] = {
+    {.name = "1s", .res_ms = 1000LL, .len = 120, .buckets = s_hist_sec},
+    {.name = "1m", .res_ms = 60LL * 1000LL, .len = 120, .buckets = s_hist_min},
+    {.name = "1h", .res_ms = 3600LL * 1000LL, .len = 48, .buckets = s_hist_hour},
+};
+#endif
+
+static int varint_put(uint8_t *out, uint32_t v)
+{
+    int n = 0;
+    while (v >= 0x80) {
+        out[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    out[n++] = (uint8_t)v;
+    return n;
+}
+
+static int varint_get(const uint8_t *in, const uint8_t *end, uint32_t *v)
+{
+    uint32_t result = 0;
+    int n = 0;
+    for (int shift = 0; shift < 35 && in + n < end; shift += 7) {
+        uint8_t b = in[n++];
+        result |= (uint32_t)(b & 0x7F) << shift;
+        if ((b & 0x80) == 0) {
+            *v = result;
+            return n;
+        }
+    }
+    return -1;
+}
+
+static inline uint32_t zigzag_encode(int32_t v)
+{
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t zigzag_decode(uint32_t v)
+{
+    return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+static const char *rank_tag(int rank)
+{
+    static const char *const tags[] = {"unknown", "partial", "single", "mux", "ok"};
+    return (rank >= 0 && rank <= 4) ? tags[rank] : "?";
+}
+
+#if CONFIG_SNIFFER_ENABLE_HISTORY
+static void history_append_run(const history_run_t *run)
+{
+    history_block_t *blk = s_hist_nblocks ? &s_hist_blocks[(s_hist_tail + s_hist_nblocks - 1) % HISTORY_BLOCKS] : NULL;
+    uint8_t rec[HISTORY_RECORD_MAX];
+    int len = 0;
+
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        if (!blk) {
+            if (s_hist_nblocks == HISTORY_BLOCKS) {
+                s_hist_tail = (s_hist_tail + 1) % HISTORY_BLOCKS;
+                s_hist_nblocks--;
+            }
+            blk = &s_hist_blocks[(s_hist_tail + s_hist_nblocks) % HISTORY_BLOCKS];
+            s_hist_nblocks++;
+            blk->first_ms = run->start_ms;
+            blk->last_ms = run->start_ms;
+            blk->prev_ms = run->start_ms;
+            blk->prev_value = 0;
+            blk->used = 0;
+            blk->count = 0;
+        }
+
+        len = 0;
+        rec[len++] = (uint8_t)((run->rank & HISTORY_RANK_MASK) | (run->has_value ? HISTORY_HAS_VALUE : 0));
+        len += varint_put(rec + len, (uint32_t)(run->start_ms - blk->prev_ms));
+        if (run->has_value) {
+            len += varint_put(rec + len, zigzag_encode(run->value - blk->prev_value));
+        }
+        len += varint_put(rec + len, (uint32_t)(run->last_ms - run->start_ms));
+        if (blk->used + len <= HISTORY_BLOCK_BYTES) {
+            break;
+        }
+        blk = NULL;
+    }
+
+    memcpy(blk->data + blk->used, rec, (size_t)len);
+    blk->used += (uint16_t)len;
+    blk->count++;
+    blk->prev_ms = run->start_ms;
+    blk->last_ms = run->start_ms;
+    if (run->has_value) {
+        blk->prev_value = run->value;
+    }
+}
+
+// Decodes one block, calling fn for every record; returns records decoded.
+static int history_block_walk(const history_block_t *blk, void (*fn)(const history_run_t *run, void *ctx), void *ctx)
+{
+    const uint8_t *p = blk->data;
+    const uint8_t *end = blk->data + blk->used;
+    int64_t ms = blk->first_ms;
+    int32_t value = 0;
+    int n = 0;
+
+    while (p < end) {
+        history_run_t run = {0};
+        uint32_t v = 0;
+        uint8_t flags = *p++;
+        int len = varint_get(p, end, &v);
+        if (len < 0) {
+            break;
+        }
+        p += len;
+        ms += v;
+        run.start_ms = ms;
+        run.rank = flags & HISTORY_RANK_MASK;
+        run.has_value = (flags & HISTORY_HAS_VALUE) != 0;
+        if (run.has_value) {
+            len = varint_get(p, end, &v);
+            if (len < 0) {
+                break;
+            }
+            p += len;
+            value += zigzag_decode(v);
+            run.value = value;
+        }
+        len = varint_get(p, end, &v);
+        if (len < 0) {
+            break;
+        }
+        p += len;
+        run.last_ms = ms + v;
+        fn(&run, ctx);
+        n++;
+    }
+    return n;
+}
+
+static void history_rollup_add(int64_t t_ms, bool has_value, int32_t value)
+{
+    for (size_t i = 0; i < sizeof(s_hist_tiers) / sizeof(s_hist_tiers[0]); ++i) {
+        const history_tier_t *tier = &s_hist_tiers[i];
+        int64_t slot = t_ms / tier->res_ms;
+        history_bucket_t *b = &tier->buckets[slot % tier->len];
+        if (b->slot != slot) {
+            memset(b, 0, sizeof(*b));
+            b->slot = slot;
+        }
+        if (!has_value) {
+            b->bad++;
+            continue;
+        }
+        if (b->n == 0 || value < b->min) {
+            b->min = (int16_t)value;
+        }
+        if (b->n == 0 || value > b->max) {
+            b->max = (int16_t)value;
+        }
+        b->sum += value;
+        b->n++;
+    }
+}
+#endif
+
+// Caller holds s_state_mutex.
+static void history_on_frame(const char *decoded, int rank, int64_t frame_us)
+{
+#if CONFIG_SNIFFER_ENABLE_HISTORY
+    int64_t t_ms = frame_us / 1000;
+    long parsed = 0;
+    bool has_value = (rank >= 4) && parse_decoded_value(decoded, &parsed) && parsed >= INT16_MIN && parsed <= INT16_MAX;
+    int32_t value = has_value ? (int32_t)parsed : 0;
+
+    history_rollup_add(t_ms, has_value, value);
+
+    if (s_hist_run_active && s_hist_run.rank == rank && s_hist_run.has_value == has_value && s_hist_run.value == value) {
+        s_hist_run.last_ms = t_ms;
+        return;
+    }
+    if (s_hist_run_active) {
+        history_append_run(&s_hist_run);
+    }
+    s_hist_run.start_ms = t_ms;
+    s_hist_run.last_ms = t_ms;
+    s_hist_run.value = value;
+    s_hist_run.rank = (uint8_t)rank;
+    s_hist_run.has_value = has_value;
+    s_hist_run_active = true;
+#else
+    (void)decoded;
+    (void)rank;
+    (void)frame_us;
+#endif
+}
+
+static bool history_parse_range(const char *arg, int64_t *range_ms)
+{
+    while (arg && *arg == ' ') {
+        arg++;
+    }
+    if (!arg || *arg == '\0') {
+        *range_ms = HISTORY_DEFAULT_RANGE_MS;
+        return true;
+    }
+
+    char *end = NULL;
+    long n = strtol(arg, &end, 10);
+    if (!end || end == arg || n <= 0) {
+        return false;
+    }
+
+    int64_t unit_ms = 0;
+    switch (*end) {
+    case 's':
+        unit_ms = 1000LL;
+        break;
+    case 'm':
+        unit_ms = 60LL * 1000LL;
+        break;
+    case 'h':
+        unit_ms = 3600LL * 1000LL;
+        break;
+    case 'd':
+        unit_ms = 24LL * 3600LL * 1000LL;
+        break;
+    default:
+        return false;
+    }
+    *range_ms = (int64_t)n * unit_ms;
+    return true;
+}
+
+#if CONFIG_SNIFFER_ENABLE_HISTORY
+static void history_count_since(const history_run_t *run, void *ctx)
+{
+    history_count_ctx_t *count = (history_count_ctx_t *)ctx;
+    if (run->start_ms >= count->from_ms) {
+        count->count++;
+    }
+}
+
+static void history_collect_recent(const history_run_t *run, void *ctx)
+{
+    history_run_t *recent = (history_run_t *)ctx;
+    memmove(&recent[1], &recent[0], sizeof(recent[0]) * (HISTORY_RECENT_MAX - 1));
+    recent[0] = *run;
+}
+
+// Caller holds s_state_mutex. Touches only rollup buckets in range and the
+// index of change-log blocks; at most one block is decoded.
+static void history_summarize(int64_t range_ms, int64_t now_ms, history_summary_t *sum)
+{
+    memset(sum, 0, sizeof(*sum));
+    sum->range_ms = range_ms;
+
+    size_t ntiers = sizeof(s_hist_tiers) / sizeof(s_hist_tiers[0]);
+    sum->tier = &s_hist_tiers[ntiers - 1];
+    for (size_t i = 0; i < ntiers; ++i) {
+        if (range_ms <= s_hist_tiers[i].res_ms * s_hist_tiers[i].len) {
+            sum->tier = &s_hist_tiers[i];
+            break;
+        }
+    }
+
+    const history_tier_t *tier = sum->tier;
+    int64_t now_slot = now_ms / tier->res_ms;
+    int64_t nslots = (range_ms + tier->res_ms - 1) / tier->res_ms;
+    if (nslots > tier->len) {
+        nslots = tier->len;
+    }
+    for (int64_t slot = now_slot - nslots + 1; slot <= now_slot; ++slot) {
+        const history_bucket_t *b = &tier->buckets[((slot % tier->len) + tier->len) % tier->len];
+        if (slot < 0 || b->slot != slot) {
+            continue;
+        }
+        sum->bad += b->bad;
+        if (b->n == 0) {
+            continue;
+        }
+        if (sum->n == 0 || b->min < sum->min) {
+            sum->min = b->min;
+        }
+        if (sum->n == 0 || b->max > sum->max) {
+            sum->max = b->max;
+        }
+        sum->sum += b->sum;
+        sum->n += b->n;
+    }
+
+    int64_t from_ms = now_ms - range_ms;
+    int lo = 0;
+    int hi = s_hist_nblocks;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (s_hist_blocks[(s_hist_tail + mid) % HISTORY_BLOCKS].last_ms < from_ms) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    for (int i = lo; i < s_hist_nblocks; ++i) {
+        const history_block_t *blk = &s_hist_blocks[(s_hist_tail + i) % HISTORY_BLOCKS];
+        if (blk->first_ms >= from_ms) {
+            sum->changes += blk->count;
+            continue;
+        }
+        history_count_ctx_t count = {.from_ms = from_ms};
+        history_block_walk(blk, history_count_since, &count);
+        sum->changes += count.count;
+    }
+}
+
+static int history_recent(history_run_t *recent)
+{
+    memset(recent, 0, sizeof(recent[0]) * HISTORY_RECENT_MAX);
+    int n = 0;
+    if (s_hist_run_active) {
+        recent[n++] = s_hist_run;
+    }
+    for (int i = s_hist_nblocks - 1; i >= 0 && n < HISTORY_RECENT_MAX; --i) {
+        history_run_t block_recent[HISTORY_RECENT_MAX];
+        memset(block_recent, 0, sizeof(block_recent));
+        int got = history_block_walk(&s_hist_blocks[(s_hist_tail + i) % HISTORY_BLOCKS], history_collect_recent, block_recent);
+        for (int j = 0; j < got && j < HISTORY_RECENT_MAX && n < HISTORY_RECENT_MAX; ++j) {
+            recent[n++] = block_recent[j];
+        }
+    }
+    return n;
+}
+#endif
+
+static void build_history_reply(const char *arg, char *out, size_t out_len)
+{
+#if CONFIG_SNIFFER_ENABLE_HISTORY
+    int64_t range_ms = 0;
+    if (!history_parse_range(arg, &range_ms)) {
+        snprintf(out, out_len, "usage: /history [30s|15m|1h|2d]");
+        return;
+    }
+
+    int64_t now_ms = esp_timer_get_time() / 1000;
+    history_summary_t sum;
+    history_run_t recent[HISTORY_RECENT_MAX];
+    xSemaphoreTake(s_state_mutex, portMAX_DELAY);
+    history_summarize(range_ms, now_ms, &sum);
+    int nrecent = history_recent(recent);
+    xSemaphoreGive(s_state_mutex);
+
+    size_t used = 0;
+    int len = 0;
+    if (sum.n > 0) {
+        len = snprintf(out,
+                       out_len,
+                       "history %llds (%s): min=%d max=%d avg=%.1f n=%u bad=%u changes=%u\nrecent:",
+                       (long long)(range_ms / 1000),
+                       sum.tier->name,
+                       (int)sum.min,
+                       (int)sum.max,
+                       (double)sum.sum / (double)sum.n,
+                       (unsigned)sum.n,
+                       (unsigned)sum.bad,
+                       (unsigned)sum.changes);
+    } else {
+        len = snprintf(out, out_len, "history %llds: no readings, bad=%u\nrecent:", (long long)(range_ms / 1000), (unsigned)sum.bad);
+    }
+    if (len <= 0 || (size_t)len >= out_len) {
+        return;
+    }
+    used = (size_t)len;
+
+    for (int i = 0; i < nrecent; ++i) {
+        char value[12] = "-";
+        if (recent[i].has_value) {
+            snprintf(value, sizeof(value), "%d", (int)recent[i].value);
+        }
+        len = snprintf(out + used,
+                       out_len - used,
+                       "\n%s %s %llds, %llds ago",
+                       value,
+                       rank_tag(recent[i].rank),
+                       (long long)((recent[i].last_ms - recent[i].start_ms) / 1000),
+                       (long long)((now_ms - recent[i].start_ms) / 1000));
+        if (len <= 0 || (size_t)len >= out_len - used) {
+            break;
+        }
+        used += (size_t)len;
+    }
+#else
+    (void)arg;
+    snprintf(out, out_len, "history: disabled in config");
+#endif
+}
+
+// JSON form for HTTP/MQTT: summary plus per-bucket min/max/avg, oldest first.
+static void build_history_json(const char *arg, char *out, size_t out_len)
+{
+#if CONFIG_SNIFFER_ENABLE_HISTORY
+    int64_t range_ms = 0;
+    if (!history_parse_range(arg, &range_ms)) {
+        snprintf(out, out_len, "{\"error\":\"bad range\"}");
+        return;
+    }
+
+    int64_t now_ms = esp_timer_get_time() / 1000;
+    history_summary_t sum;
+    xSemaphoreTake(s_state_mutex, portMAX_DELAY);
+    history_summarize(range_ms, now_ms, &sum);
+
+    const history_tier_t *tier = sum.tier;
+    int len = snprintf(out,
+                       out_len,
+                       "{\"range_s\":%lld,\"res_s\":%lld,\"n\":%u,\"bad\":%u,\"changes\":%u",
+                       (long long)(range_ms / 1000),
+                       (long long)(tier->res_ms / 1000),
+                       (unsigned)sum.n,
+                       (unsigned)sum.bad,
+                       (unsigned)sum.changes);
+    size_t used = (len > 0 && (size_t)len < out_len) ? (size_t)len : 0;
+    if (sum.n > 0 && used > 0) {
+        len = snprintf(out + used,
+                       out_len - used,
+                       ",\"min\":%d,\"max\":%d,\"avg\":%.2f",
+                       (int)sum.min,
+                       (int)sum.max,
+                       (double)sum.sum / (double)sum.n);
+        used += (len > 0 && (size_t)len < out_len - used) ? (size_t)len : 0;
+    }
+    len = snprintf(out + used, out_len - used, ",\"buckets\":[");
+    used += (len > 0 && (size_t)len < out_len - used) ? (size_t)len : 0;
+
+    int64_t now_slot = now_ms / tier->res_ms;
+    int64_t nslots = (range_ms + tier->res_ms - 1) / tier->res_ms;
+    if (nslots > tier->len) {
+        nslots = tier->len;
+    }
+    bool first = true;
+    bool truncated = false;
+    for (int64_t slot = now_slot - nslots + 1; slot <= now_slot; ++slot) {
+        const history_bucket_t *b = &tier->buckets[((slot % tier->len) + tier->len) % tier->len];
+        if (slot < 0 || b->slot != slot || b->n == 0) {
+            continue;
+        }
+        // Reserve room for the closing "]}".
+        len = snprintf(out + used,
+                       out_len - used,
+                       "%s[%lld,%d,%d,%.1f,%u]",
+                       first ? "" : ",",
+                       (long long)((slot * tier->res_ms - now_ms) / 1000),
+                       (int)b->min,
+                       (int)b->max,
+                       (double)b->sum / (double)b->n,
+                       (unsigned)b->n);
+        if (len <= 0 || (size_t)len + 24 >= out_len - used) {
+            truncated = true;
+            break;
+        }
+        used += (size_t)len;
+        first = false;
+    }
+    xSemaphoreGive(s_state_mutex);
+
+    snprintf(out + used, out_len - used, "]%s}", truncated ? ",\"truncated\":true" : "");
+#else
+    (void)arg;
+    snprintf(out, out_len, "{\"error\":\"history disabled\"}");
+#endif
+}
+
+#if CONFIG_SNIFFER_ENABLE_TELEGRAM
+// INLINE runs on net_task between polls and must return quickly. QUEUED goes
+// to the worker pool. EXCLUSIVE is queued too, but at most one instance of the
+// command runs at a time; a second request is refused instead of piling up.
+typedef enum {
+    TG_CMD_INLINE = 0,
+    TG_CMD_QUEUED,
+    TG_CMD_EXCLUSIVE,
+} tg_cmd_mode_t;
+
+typedef struct {
+    char chat_id[32];
+    char arg[TG_CMD_ARG_MAX];
+    int64_t poll_us;
+    uint8_t cmd;
+    bool replied;
+} tg_cmd_ctx_t;
+
+typedef struct {
+    const char *name;
+    tg_cmd_mode_t mode;
+    void (*run)(tg_cmd_ctx_t *ctx);
+} tg_cmd_t;
+
+typedef struct {
+    uint32_t calls;
+    uint32_t busy;
+    uint32_t last_ms;
+    uint32_t max_ms;
+    uint64_t total_ms;
+} tg_cmd_stats_t;
+
+static uint32_t fnv1a_hash(const char *s, size_t len)
+{
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (uint8_t)s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// The first reply closes the poll-to-reply latency window for the command.
+static bool tg_cmd_reply(tg_cmd_ctx_t *ctx, const char *text);
+
+static void tg_cmd_status(tg_cmd_ctx_t *ctx)
+{
+    char reply[32];
+    build_fw_version_reply(reply, sizeof(reply));
+    tg_cmd_reply(ctx, reply);
+}
+
+static void tg_cmd_get_temp(tg_cmd_ctx_t *ctx)
+{
+    for (int i = 0; i < 10; ++i) {
+        char reply[96];
+        build_decoded_reply(reply, sizeof(reply));
+        if (!tg_cmd_reply(ctx, reply)) {
+            break;
+        }
+
+        if (i < 9) {
+            vTaskDelay(pdMS_TO_TICKS(3000));
+        }
+    }
+}
+
+static void tg_cmd_history(tg_cmd_ctx_t *ctx)
+{
+    char reply[512];
+    build_history_reply(ctx->arg, reply, sizeof(reply));
+    tg_cmd_reply(ctx, reply);
+}
+
+// ota_start only spawns ota_task, so the command itself stays inline.
+static void tg_cmd_update(tg_cmd_ctx_t *ctx)
+{
+    char reply[96];
+    ota_start(ctx->chat_id, strcmp(ctx->arg, "force") == 0, reply, sizeof(reply));
+    tg_cmd_reply(ctx, reply);
+}
+
+static const tg_cmd_t s_tg_cmds[] = {
+    {"/status", TG_CMD_INLINE, tg_cmd_status},
+    {"/get_temp", TG_CMD_EXCLUSIVE, tg_cmd_get_temp},
+    {"/history", TG_CMD_QUEUED, tg_cmd_history},
+    {"/update", TG_CMD_INLINE, tg_cmd_update},
+    {"/ota", TG_CMD_INLINE, tg_cmd_update},
+};
+
+#define TG_CMD_COUNT (sizeof(s_tg_cmds) / sizeof(s_tg_cmds[0]))
+
+static uint32_t s_tg_cmd_hash[TG_CMD_COUNT];
+static tg_cmd_stats_t s_tg_cmd_stats[TG_CMD_COUNT];
+static volatile bool s_tg_cmd_running[TG_CMD_COUNT];
+static QueueHandle_t s_tg_cmd_queue;
+
+static bool tg_cmd_reply(tg_cmd_ctx_t *ctx, const char *text)
+{
+    bool ok = telegram_send_text(ctx->chat_id, text);
+    if (!ok) {
+        ESP_LOGW(TAG, "telegram send failed");
+    }
+    if (!ctx->replied) {
+        ctx->replied = true;
+        tg_cmd_stats_t *st = &s_tg_cmd_stats[ctx->cmd];
+        uint32_t ms = (uint32_t)((esp_timer_get_time() - ctx->poll_us) / 1000);
+        st->last_ms = ms;
+        st->total_ms += ms;
+        if (ms > st->max_ms) {
+            st->max_ms = ms;
+        }
+    }
+    return ok;
+}
+
+// "/cmd@botname arg" -> table index and arg; the hash rejects most
+// non-matches before strncmp.
+static int tg_cmd_match(const char *text, const char **arg)
+{
+    size_t len = strcspn(text, " @");
+    uint32_t h = fnv1a_hash(text, len);
+    for (size_t i = 0; i < TG_CMD_COUNT; i++) {
+        if (s_tg_cmd_hash[i] == h && strlen(s_tg_cmds[i].name) == len && strncmp(s_tg_cmds[i].name, text, len) == 0) {
+            const char *p = text + len;
+            if (*p == '@') {
+                p += strcspn(p, " ");
+            }
+            while (*p == ' ') {
+                p++;
+            }
+            *arg = p;
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+static void tg_cmd_worker(void *arg)
+{
+    (void)arg;
+    tg_cmd_ctx_t ctx;
+    while (1) {
+        if (xQueueReceive(s_tg_cmd_queue, &ctx, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+        s_tg_cmds[ctx.cmd].run(&ctx);
+        s_tg_cmd_running[ctx.cmd] = false;
+    }
+}
+
+static void tg_cmd_init(void)
+{
+    for (size_t i = 0; i < TG_CMD_COUNT; i++) {
+        s_tg_cmd_hash[i] = fnv1a_hash(s_tg_cmds[i].name, strlen(s_tg_cmds[i].name));
+    }
+
+    s_tg_cmd_queue = xQueueCreate(TG_CMD_QUEUE_LEN, sizeof(tg_cmd_ctx_t));
+    if (!s_tg_cmd_queue) {
+        ESP_LOGW(TAG, "command queue allocation failed; commands run inline");
+        return;
+    }
+    for (int i = 0; i < CONFIG_SNIFFER_CMD_WORKERS; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "cmd_worker%d", i);
+        if (xTaskCreate(tg_cmd_worker, name, TG_CMD_WORKER_STACK, NULL, 4, NULL) != pdPASS) {
+            ESP_LOGW(TAG, "command worker %d allocation failed", i);
+        }
+    }
+}
+
+// "cmd":{"/status":{"n":3,"busy":0,"last_ms":410,"avg_ms":388,"max_ms":512},...}
+static void tg_cmd_append_metrics(char *out, size_t out_len, size_t *used)
+{
+    if (!json_append(out, out_len, used, 2, ",\"cmd\":{")) {
+        return;
+    }
+    bool first = true;
+    for (size_t i = 0; i < TG_CMD_COUNT; i++) {
+        const tg_cmd_stats_t *st = &s_tg_cmd_stats[i];
+        if (st->calls == 0) {
+            continue;
+        }
+        uint32_t replied = st->calls - st->busy;
+        if (!json_append(out,
+                         out_len,
+                         used,
+                         2,
+                         "%s\"%s\":{\"n\":%u,\"busy\":%u,\"last_ms\":%u,\"avg_ms\":%u,\"max_ms\":%u}",
+                         first ? "" : ",",
+                         s_tg_cmds[i].name,
+                         (unsigned)st->calls,
+                         (unsigned)st->busy,
+                         (unsigned)st->last_ms,
+                         replied > 0 ? (unsigned)(st->total_ms / replied) : 0U,
+                         (unsigned)st->max_ms)) {
+            break;
+        }
+        first = false;
+    }
+    json_append(out, out_len, used, 1, "}");
+}
+
+static void tg_cmd_dispatch(int cmd, const char *chat_id, const char *arg, int64_t poll_us)
+{
+    tg_cmd_ctx_t ctx = {
+        .poll_us = poll_us,
+        .cmd = (uint8_t)cmd,
+    };
+    strncpy(ctx.chat_id, chat_id, sizeof(ctx.chat_id) - 1);
+    strncpy(ctx.arg, arg, sizeof(ctx.arg) - 1);
+
+    const tg_cmd_t *def = &s_tg_cmds[cmd];
+    s_tg_cmd_stats[cmd].calls++;
+    if (def->mode == TG_CMD_INLINE || !s_tg_cmd_queue) {
+        def->run(&ctx);
+        return;
+    }
+
+    if (def->mode == TG_CMD_EXCLUSIVE && s_tg_cmd_running[cmd]) {
+        s_tg_cmd_stats[cmd].busy++;
+        tg_cmd_reply(&ctx, "busy: previous request still running");
+        return;
+    }
+    s_tg_cmd_running[cmd] = (def->mode == TG_CMD_EXCLUSIVE);
+    if (xQueueSend(s_tg_cmd_queue, &ctx, 0) != pdTRUE) {
+        s_tg_cmd_running[cmd] = false;
+        s_tg_cmd_stats[cmd].busy++;
+        tg_cmd_reply(&ctx, "busy: try again later");
+    }
+}
+#endif
+
+static void telegram_poll_and_respond(int64_t *next_offset)
+{
+#if CONFIG_SNIFFER_ENABLE_TELEGRAM
+    if (strlen(CONFIG_SNIFFER_TELEGRAM_BOT_TOKEN) == 0) {
+        vTaskDelay(pdMS_TO_TICKS(2000));
+        return;
+    }
+
+    char url[320];
+    snprintf(url,
+             sizeof(url),
+             "%s/bot%s/getUpdates?timeout=%d&offset=%lld",
+             TELEGRAM_API_URL,
+             CONFIG_SNIFFER_TELEGRAM_BOT_TOKEN,
+             TELEGRAM_POLL_TIMEOUT_S,
+             (long long)*next_offset);
+
+    char response[TELEGRAM_RESP_MAX];
+    if (!telegram_http_get(url, response, sizeof(response))) {
+        // Sleep out the shared backoff / open breaker instead of a fixed retry.
+        uint32_t wait_ms = net_guard_wait_ms(&s_guard_telegram);
+        vTaskDelay(pdMS_TO_TICKS(wait_ms > 0 ? wait_ms : 200) + 1);
+        return;
+    }
+    int64_t poll_us = esp_timer_get_time();
+
+    // The whole tree lives in the arena; handlers get copies of chat id/arg.
+    json_arena_begin();
+    cJSON *root = cJSON_Parse(response);
+    if (!root) {
+        json_arena_end();
+        ESP_LOGW(TAG, "telegram parse failed");
+        return;
+    }
+
+    cJSON *result = cJSON_GetObjectItem(root, "result");
+    if (!cJSON_IsArray(result)) {
+        cJSON_Delete(root);
+        json_arena_end();
+        return;
+    }
+
+    cJSON *item = NULL;
+    cJSON_ArrayForEach(item, result)
+    {
+        cJSON *update_id = cJSON_GetObjectItem(item, "update_id");
+        if (cJSON_IsNumber(update_id)) {
+            int64_t id = (int64_t)update_id->valuedouble;
+            if (id >= *next_offset) {
+                *next_offset = id + 1;
+                telegram_store_next_offset(*next_offset);
+            }
+        }
+
+        cJSON *message = cJSON_GetObjectItem(item, "message");
+        if (!cJSON_IsObject(message)) {
+            continue;
+        }
+
+        cJSON *text = cJSON_GetObjectItem(message, "text");
+        if (!cJSON_IsString(text) || !text->valuestring) {
+            continue;
+        }
+
+        const char *arg = NULL;
+        int cmd = tg_cmd_match(text->valuestring, &arg);
+        if (cmd < 0) {
+            continue;
+        }
+
+        cJSON *chat = cJSON_GetObjectItem(message, "chat");
+        cJSON *chat_id = chat ? cJSON_GetObjectItem(chat, "id") : NULL;
+        char chat_id_str[32] = {0};
+
+        if (cJSON_IsString(chat_id) && chat_id->valuestring) {
+            strncpy(chat_id_str, chat_id->valuestring, sizeof(chat_id_str) - 1);
+        } else if (cJSON_IsNumber(chat_id)) {
+            snprintf(chat_id_str, sizeof(chat_id_str), "%.0f", chat_id->valuedouble);
+        } else {
+            continue;
+        }
+
+        if (strlen(CONFIG_SNIFFER_TELEGRAM_CHAT_ID) > 0 && strcmp(chat_id_str, CONFIG_SNIFFER_TELEGRAM_CHAT_ID) != 0) {
+            continue;
+        }
+
+        tg_cmd_dispatch(cmd, chat_id_str, arg, poll_us);
+    }
+
+    cJSON_Delete(root);
+    json_arena_end();
+#else
+    (void)next_offset;
+    vTaskDelay(pdMS_TO_TICKS(2000));
+#endif
+}
+
+static bool push_value_changed(const char *published, const char *candidate)
+{
+    long prev = 0;
+    long next = 0;
+    if (parse_decoded_value(published, &prev) && parse_decoded_value(candidate, &next)) {
+        return labs(next - prev) >= CONFIG_SNIFFER_PUSH_HYSTERESIS;
+    }
+    return strcmp(published, candidate) != 0;
+}
+
+// Called from publish_task for every published reading; must never block, or
+// the reading ring backs up into decode_task.
+static void push_on_decode(const char *decoded, const char *status, int64_t frame_us)
+{
+#if PUSH_ENABLED
+    if (!s_push_queue || strncmp(status, "ok(", 3) != 0) {
+        return;
+    }
+
+    if (strcmp(decoded, s_push.candidate) != 0) {
+        strncpy(s_push.candidate, decoded, sizeof(s_push.candidate) - 1);
+        s_push.candidate[sizeof(s_push.candidate) - 1] = '\0';
+        s_push.candidate_frames = 1;
+    } else if (s_push.candidate_frames < CONFIG_SNIFFER_PUSH_DEBOUNCE_FRAMES) {
+        s_push.candidate_frames++;
+    }
+
+    if (s_push.candidate_frames < CONFIG_SNIFFER_PUSH_DEBOUNCE_FRAMES) {
+        return;
+    }
+    if (s_push.has_published) {
+        if (!push_value_changed(s_push.published, s_push.candidate)) {
+            return;
+        }
+        // Stay pending; the next frame with the same value retries.
+        if ((frame_us - s_push.last_push_us) < PUSH_MIN_INTERVAL_US) {
+            return;
+        }
+    }
+
+    push_msg_t msg = {0};
+    strncpy(msg.decoded, s_push.candidate, sizeof(msg.decoded) - 1);
+    strncpy(msg.status, status, sizeof(msg.status) - 1);
+    msg.frame_us = frame_us;
+    if (xQueueSend(s_push_queue, &msg, 0) != pdTRUE) {
+        s_push.dropped++;
+        return;
+    }
+
+    memcpy(s_push.published, s_push.candidate, sizeof(s_push.published));
+    s_push.has_published = true;
+    s_push.last_push_us = frame_us;
+#else
+    (void)decoded;
+    (void)status;
+    (void)frame_us;
+#endif
+}
+
+// Spec: "name=[c]byte.bit[@slot][!],...", e.g. "flame=0.7@1,fault=c5.3!".
+// 'c' reads the cycle buffer instead of the frame, @slot limits a frame bit
+// to frames of that mux slot, '!' marks an active-low bit.
+static void indicators_init(void)
+{
+    char spec[sizeof(CONFIG_SNIFFER_INDICATORS)];
+    strncpy(spec, CONFIG_SNIFFER_INDICATORS, sizeof(spec) - 1);
+    spec[sizeof(spec) - 1] = '\0';
+
+    char *save = NULL;
+    for (char *item = strtok_r(spec, ", ", &save); item; item = strtok_r(NULL, ", ", &save)) {
+        char *eq = strchr(item, '=');
+        if (s_indicator_count >= INDICATOR_MAX) {
+            ESP_LOGW(TAG, "indicators: more than %d, ignoring the rest", INDICATOR_MAX);
+            break;
+        }
+        if (!eq || eq == item || (size_t)(eq - item) >= INDICATOR_NAME_MAX) {
+            ESP_LOGW(TAG, "indicators: bad entry '%s'", item);
+            continue;
+        }
+
+        indicator_t ind = {.slot = -1};
+        memcpy(ind.name, item, (size_t)(eq - item));
+        char *p = eq + 1;
+        if (*p == 'c') {
+            ind.cycle = true;
+            p++;
+        }
+        char *end = NULL;
+        long byte = strtol(p, &end, 10);
+        long bit = -1;
+        if (end != p && *end == '.') {
+            p = end + 1;
+            bit = strtol(p, &end, 10);
+        }
+        if (end != p && *end == '@' && !ind.cycle) {
+            p = end + 1;
+            long slot = strtol(p, &end, 10);
+            ind.slot = (end != p && slot >= 0 && slot < MAX_MUX_SLOTS) ? (int8_t)slot : -2;
+        }
+        if (*end == '!') {
+            ind.invert = true;
+            end++;
+        }
+        if (byte < 0 || byte >= (ind.cycle ? MAX_CYCLE_BYTES : 8) || bit < 0 || bit > 7 || ind.slot == -2 || *end != '\0') {
+            ESP_LOGW(TAG, "indicators: bad entry '%s'", item);
+            continue;
+        }
+        ind.byte = (uint8_t)byte;
+        ind.mask = (uint8_t)(1U << bit);
+        s_indicators[s_indicator_count++] = ind;
+    }
+    if (s_indicator_count > 0) {
+        ESP_LOGI(TAG, "indicators: %d configured", s_indicator_count);
+    }
+}
+
+// Updates *state/*known from the indicators that read this source.
+static void indicators_sample(const uint8_t *bytes, int nbytes, bool cycle, int slot, uint32_t *state, uint32_t *known)
+{
+    for (int i = 0; i < s_indicator_count; ++i) {
+        const indicator_t *ind = &s_indicators[i];
+        if (ind->cycle != cycle || ind->byte >= nbytes || (ind->slot >= 0 && ind->slot != slot)) {
+            continue;
+        }
+        uint32_t bit = 1U << i;
+        bool on = ((bytes[ind->byte] & ind->mask) != 0) != ind->invert;
+        *state = on ? (*state | bit) : (*state & ~bit);
+        *known |= bit;
+    }
+}
+
+// Caller holds s_state_mutex. Queues one event per indicator that changed
+// (or was seen for the first time) and returns their mask.
+static uint32_t indicators_commit(uint32_t state, uint32_t known, int64_t t_us)
+{
+    uint32_t changed = ((state ^ s_indicator_state) | ~s_indicator_known) & known;
+    for (int i = 0; i < s_indicator_count; ++i) {
+        if (!(changed & (1U << i))) {
+            continue;
+        }
+        if (s_indicator_event_count == INDICATOR_EVENTS) {
+            s_indicator_event_head = (s_indicator_event_head + 1) % INDICATOR_EVENTS;
+            s_indicator_event_count--;
+            s_indicator_events_lost++;
+        }
+        indicator_event_t *ev = &s_indicator_events[(s_indicator_event_head + s_indicator_event_count) % INDICATOR_EVENTS];
+        ev->index = (uint8_t)i;
+        ev->on = (state & (1U << i)) != 0;
+        ev->t_us = t_us;
+        s_indicator_event_count++;
+    }
+    s_indicator_state = state;
+    s_indicator_known = known;
+    if (changed) {
+        s_state_seq++;
+    }
+    return changed;
+}
+
+static void indicators_log(uint32_t changed, uint32_t state)
+{
+    for (int i = 0; i < s_indicator_count; ++i) {
+        if (changed & (1U << i)) {
+            ESP_LOGI(TAG, "indicator %s=%s", s_indicators[i].name, (state & (1U << i)) ? "on" : "off");
+        }
+    }
+}
+
+// {"flame":true,...} for the indicators seen so far.
+static void indicators_json(uint32_t state, uint32_t known, char *out, size_t out_len)
+{
+    size_t used = (size_t)snprintf(out, out_len, "{");
+    for (int i = 0; i < s_indicator_count && used < out_len; ++i) {
+        if (!(known & (1U << i))) {
+            continue;
+        }
+        used += (size_t)snprintf(out + used,
+                                 out_len - used,
+                                 "%s\"%s\":%s",
+                                 used > 1 ? "," : "",
+                                 s_indicators[i].name,
+                                 (state & (1U << i)) ? "true" : "false");
+    }
+    if (used + 1 < out_len) {
+        snprintf(out + used, out_len - used, "}");
+    } else {
+        snprintf(out, out_len, "{}");
+    }
+}
+
+#if FRAME_TIMING_ENABLED
+static uint8_t *capture_put_varint(uint8_t *p, uint32_t v)
+{
+    while (v >= 0x80) {
+        *p++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+static void capture_put_le(uint8_t *p, uint64_t v, int n)
+{
+    for (int i = 0; i < n; ++i) {
+        p[i] = (uint8_t)(v >> (8 * i));
+    }
+}
+
+// Called by sniffer_task for every bit it appends to the frame slot.
+static inline void frame_note_bit(frame_timing_t *t, int index, int64_t ts_us, int64_t dt_us, gap_kind_t gap_kind)
+{
+    t->bit_dt[index] = dt_us > (int64_t)UINT32_MAX ? UINT32_MAX : (uint32_t)dt_us;
+    if (index == 0) {
+        t->ts_us = ts_us;
+        t->gap = (uint8_t)gap_kind;
+    }
+}
+
+// Writes one frame record (docs/capture-format.md); p needs
+// CAPTURE_FRAME_WORST(nbits) bytes.
+static uint8_t *capture_encode_frame(uint8_t *p, const uint8_t *bits, int nbits)
+{
+    *p++ = (uint8_t)(CAPTURE_REC_FRAME | (s_frame_timing->gap << 4));
+    p = capture_put_varint(p, (uint32_t)nbits);
+    for (int i = 0; i < nbits; ++i) {
+        p = capture_put_varint(p, s_frame_timing->bit_dt[i]);
+    }
+    uint8_t acc = 0;
+    for (int i = 0; i < nbits; ++i) {
+        acc = (uint8_t)((acc << 1) | (bits[i] & 0x01));
+        if ((i & 7) == 7) {
+            *p++ = acc;
+            acc = 0;
+        }
+    }
+    if (nbits & 7) {
+        *p++ = (uint8_t)(acc << (8 - (nbits & 7)));
+    }
+    return p;
+}
+
+static void capture_put_header(uint8_t *p, uint8_t flags, uint32_t seq, int64_t base_us, uint32_t dropped)
+{
+    capture_put_le(p, CAPTURE_MAGIC, 2);
+    p[2] = CAPTURE_VERSION;
+    p[3] = flags;
+    capture_put_le(p + 4, seq, 4);
+    capture_put_le(p + 8, (uint64_t)base_us, 8);
+    capture_put_le(p + 16, 0, 2);
+    capture_put_le(p + 18, dropped > UINT16_MAX ? UINT16_MAX : dropped, 2);
+}
+#endif
+
+#if CONFIG_SNIFFER_CAPTURE_STREAM
+static void capture_submit(void)
+{
+    if (s_capture.cur < 0) {
+        return;
+    }
+    capture_chunk_t *c = &s_capture_chunks[s_capture.cur];
+    capture_put_le(c->data + 16, c->len - CAPTURE_HDR_BYTES, 2);
+    s_capture.chunks++;
+    s_capture.bytes += c->len;
+    // full_q holds every slot, so this never fails.
+    uint8_t slot = (uint8_t)s_capture.cur;
+    xQueueSend(s_capture.full_q, &slot, 0);
+    s_capture.cur = -1;
+}
+
+static void capture_flush_due(int64_t now_us)
+{
+    if (s_capture.cur >= 0 && now_us - s_capture.opened_us >= CAPTURE_FLUSH_US) {
+        capture_submit();
+    }
+}
+
+// Never blocks: with no free slot the whole frame is dropped and counted in
+// the next chunk's header.
+static void capture_frame(const uint8_t *bits, int nbits)
+{
+    if (!s_capture.free_q || nbits <= 0) {
+        return;
+    }
+    if (s_capture.cur >= 0 && (size_t)(CAPTURE_CHUNK_MAX - s_capture_chunks[s_capture.cur].len) < CAPTURE_FRAME_WORST(nbits)) {
+        capture_submit();
+    }
+
+    int64_t now_us = esp_timer_get_time();
+    if (s_capture.cur < 0) {
+        uint8_t slot = 0;
+        if (xQueueReceive(s_capture.free_q, &slot, 0) != pdTRUE) {
+            s_capture.dropped++;
+            s_capture.pending_drops++;
+            return;
+        }
+        capture_chunk_t *c = &s_capture_chunks[slot];
+        // Base is the edge before this frame, so its first delta chains from it.
+        capture_put_header(c->data, 0, s_capture.seq++, s_frame_timing->ts_us - s_frame_timing->bit_dt[0], s_capture.pending_drops);
+        c->len = CAPTURE_HDR_BYTES;
+        s_capture.pending_drops = 0;
+        s_capture.cur = slot;
+        s_capture.opened_us = now_us;
+    }
+
+    capture_chunk_t *c = &s_capture_chunks[s_capture.cur];
+    uint8_t *p = capture_encode_frame(c->data + c->len, bits, nbits);
+    c->len = (uint16_t)(p - c->data);
+    s_capture.frames++;
+    capture_flush_due(now_us);
+}
+
+static int capture_connect(void)
+{
+    uint32_t addr = 0;
+    if (!dns_cache_lookup(CONFIG_SNIFFER_CAPTURE_HOST, &addr)) {
+        return -1;
+    }
+    int type = CONFIG_SNIFFER_CAPTURE_TCP ? SOCK_STREAM : SOCK_DGRAM;
+    int sock = socket(AF_INET, type, CONFIG_SNIFFER_CAPTURE_TCP ? IPPROTO_TCP : IPPROTO_UDP);
+    if (sock < 0) {
+        return -1;
+    }
+    struct sockaddr_in to = {
+        .sin_family = AF_INET,
+        .sin_port = htons(CONFIG_SNIFFER_CAPTURE_PORT),
+        .sin_addr.s_addr = addr,
+    };
+    struct timeval tv = {.tv_sec = 2, .tv_usec = 0};
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    if (connect(sock, (struct sockaddr *)&to, sizeof(to)) != 0) {
+        close(sock);
+        return -1;
+    }
+    s_capture.connects++;
+    return sock;
+}
+
+static bool capture_send_all(int sock, const uint8_t *data, size_t len)
+{
+    while (len > 0) {
+        int n = send(sock, data, len, 0);
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+static void capture_task(void *arg)
+{
+    (void)arg;
+    int sock = -1;
+    int64_t next_connect_us = 0;
+
+    while (1) {
+        uint8_t slot = 0;
+        if (xQueueReceive(s_capture.full_q, &slot, pdMS_TO_TICKS(1000)) != pdTRUE) {
+            continue;
+        }
+        capture_chunk_t *c = &s_capture_chunks[slot];
+
+        bool online = s_wifi_events && (xEventGroupGetBits(s_wifi_events) & WIFI_CONNECTED_BIT) != 0;
+        if (sock < 0 && online && esp_timer_get_time() >= next_connect_us) {
+            sock = capture_connect();
+            if (sock < 0) {
+                next_connect_us = esp_timer_get_time() + (int64_t)CAPTURE_RETRY_MS * 1000LL;
+            } else {
+                ESP_LOGI(TAG, "capture stream to %s:%d (%s)", CONFIG_SNIFFER_CAPTURE_HOST, CONFIG_SNIFFER_CAPTURE_PORT,
+                         CONFIG_SNIFFER_CAPTURE_TCP ? "tcp" : "udp");
+            }
+        }
+        // Nobody to send to: recycle the slot so capture keeps going.
+        if (sock < 0) {
+            s_capture.discarded++;
+        } else if (!capture_send_all(sock, c->data, c->len)) {
+            s_capture.send_errors++;
+            if (CONFIG_SNIFFER_CAPTURE_TCP) {
+                close(sock);
+                sock = -1;
+            }
+        }
+        xQueueSend(s_capture.free_q, &slot, 0);
+    }
+}
+
+static void capture_init(void)
+{
+    if (strlen(CONFIG_SNIFFER_CAPTURE_HOST) == 0) {
+        ESP_LOGW(TAG, "capture stream host is empty; capture stream disabled");
+        return;
+    }
+    QueueHandle_t free_q = xQueueCreate(CAPTURE_SLOTS, sizeof(uint8_t));
+    s_capture.full_q = xQueueCreate(CAPTURE_SLOTS, sizeof(uint8_t));
+    if (!free_q || !s_capture.full_q || xTaskCreate(capture_task, "capture_tx", CAPTURE_TASK_STACK, NULL, 3, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "capture stream allocation failed");
+        return;
+    }
+    for (uint8_t i = 0; i < CAPTURE_SLOTS; ++i) {
+        xQueueSend(free_q, &i, 0);
+    }
+    // Published last: capture_frame checks free_q to see whether streaming is on.
+    s_capture.free_q = free_q;
+}
+#endif
+
+#if CONFIG_SNIFFER_ENABLE_TRIGGER
+static void trigger_ring_read(const uint8_t *buf, uint32_t pos, void *out, uint32_t n)
+{
+    uint32_t first = TRIGGER_RING_BYTES - pos < n ? TRIGGER_RING_BYTES - pos : n;
+    memcpy(out, buf + pos, first);
+    memcpy((uint8_t *)out + first, buf, n - first);
+}
+
+static void trigger_ring_write(uint8_t *buf, uint32_t pos, const void *in, uint32_t n)
+{
+    uint32_t first = TRIGGER_RING_BYTES - pos < n ? TRIGGER_RING_BYTES - pos : n;
+    memcpy(buf + pos, in, first);
+    memcpy(buf, (const uint8_t *)in + first, n - first);
+}
+
+static void trigger_rec_header(const uint8_t *buf, uint32_t pos, uint16_t *len, int64_t *ts_us)
+{
+    uint8_t hdr[TRIGGER_REC_HDR];
+    trigger_ring_read(buf, pos, hdr, sizeof(hdr));
+    memcpy(len, hdr, sizeof(*len));
+    memcpy(ts_us, hdr + 2, sizeof(*ts_us));
+}
+
+// Spec, as a query string: one of status=misaligned|unknown|partial,
+// pattern=<hex>[&mask=<hex>], value=<reading>|*, gap=none|short|mid|long;
+// optionally pre_ms= and post_ms=. "" or "off" disarms.
+static bool trigger_parse(const char *spec, trigger_cond_t *cond)
+{
+    static const char *const gaps[] = {"none", "short", "mid", "long"};
+    memset(cond, 0, sizeof(*cond));
+    cond->pre_ms = CONFIG_SNIFFER_TRIGGER_PRE_MS;
+    cond->post_ms = CONFIG_SNIFFER_TRIGGER_POST_MS;
+    if (spec[0] == '\0' || strcmp(spec, "off") == 0) {
+        return true;
+    }
+
+    char arg[24];
+    if (httpd_query_key_value(spec, "pre_ms", arg, sizeof(arg)) == ESP_OK) {
+        cond->pre_ms = (uint32_t)strtoul(arg, NULL, 10);
+    }
+    if (httpd_query_key_value(spec, "post_ms", arg, sizeof(arg)) == ESP_OK) {
+        cond->post_ms = (uint32_t)strtoul(arg, NULL, 10);
+    }
+
+    if (httpd_query_key_value(spec, "status", arg, sizeof(arg)) == ESP_OK) {
+        cond->kind = TRIGGER_STATUS;
+        cond->rank_min = -1;
+        if (strcmp(arg, "misaligned") == 0) {
+            cond->rank_max = -1;
+        } else if (strcmp(arg, "unknown") == 0) {
+            cond->rank_max = 0;
+        } else if (strcmp(arg, "partial") == 0) {
+            cond->rank_max = 3;
+        } else {
+            return false;
+        }
+        snprintf(cond->spec, sizeof(cond->spec), "status=%s", arg);
+    } else if (httpd_query_key_value(spec, "pattern", arg, sizeof(arg)) == ESP_OK) {
+        char *end = NULL;
+        size_t digits = strlen(arg);
+        cond->kind = TRIGGER_PATTERN;
+        cond->pattern = strtoull(arg, &end, 16);
+        if (digits == 0 || digits > 16 || *end != '\0') {
+            return false;
+        }
+        cond->nbits = (uint8_t)(digits * 4);
+        cond->mask = digits == 16 ? UINT64_MAX : (1ULL << cond->nbits) - 1;
+        if (httpd_query_key_value(spec, "mask", arg, sizeof(arg)) == ESP_OK) {
+            cond->mask &= strtoull(arg, &end, 16);
+            if (*end != '\0') {
+                return false;
+            }
+        }
+        snprintf(cond->spec,
+                 sizeof(cond->spec),
+                 "pattern=%0*llX&mask=%0*llX",
+                 (int)digits,
+                 (unsigned long long)cond->pattern,
+                 (int)digits,
+                 (unsigned long long)cond->mask);
+    } else if (httpd_query_key_value(spec, "value", arg, sizeof(arg)) == ESP_OK) {
+        cond->kind = TRIGGER_VALUE;
+        if (arg[0] == '\0' || strlen(arg) >= sizeof(cond->value)) {
+            return false;
+        }
+        for (const char *c = arg; *c; ++c) {
+            if (!isalnum((unsigned char)*c) && *c != '-' && *c != '.' && *c != '*') {
+                return false;
+            }
+        }
+        strcpy(cond->value, arg);
+        snprintf(cond->spec, sizeof(cond->spec), "value=%s", arg);
+    } else if (httpd_query_key_value(spec, "gap", arg, sizeof(arg)) == ESP_OK) {
+        cond->kind = TRIGGER_GAP;
+        size_t i = 0;
+        while (i < sizeof(gaps) / sizeof(gaps[0]) && strcmp(arg, gaps[i]) != 0) {
+            ++i;
+        }
+        if (i == sizeof(gaps) / sizeof(gaps[0])) {
+            return false;
+        }
+        cond->gap = (uint8_t)i;
+        snprintf(cond->spec, sizeof(cond->spec), "gap=%s", arg);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Runs on the httpd task (or before decode_task starts). A new condition
+// also releases the slot.
+static void trigger_arm(const trigger_cond_t *cond)
+{
+    xSemaphoreTake(s_state_mutex, portMAX_DELAY);
+    s_trigger.pending = *cond;
+    s_trigger.pending_seq++;
+    s_trigger.slot_ready = false;
+    xSemaphoreGive(s_state_mutex);
+}
+
+static void trigger_init(void)
+{
+    trigger_cond_t cond;
+    if (!trigger_parse(CONFIG_SNIFFER_TRIGGER_SPEC, &cond)) {
+        ESP_LOGW(TAG, "trigger: bad spec '%s'", CONFIG_SNIFFER_TRIGGER_SPEC);
+        return;
+    }
+    if (cond.kind != TRIGGER_OFF) {
+        trigger_arm(&cond);
+        ESP_LOGI(TAG, "trigger: armed on %s", cond.spec);
+    }
+}
+
+static void trigger_finish(bool truncated)
+{
+    s_trigger.win.truncated = truncated;
+    s_trigger.win.last_us = s_trigger.last_us;
+    strncpy(s_trigger.win.spec, s_trigger.cond.spec, sizeof(s_trigger.win.spec) - 1);
+
+    xSemaphoreTake(s_state_mutex, portMAX_DELAY);
+    s_trigger.slot = s_trigger.win;
+    s_trigger.slot_ready = true;
+    xSemaphoreGive(s_state_mutex);
+
+    // The slot is free whenever a trigger can fire, so the other buffer is too.
+    s_trigger.live ^= 1;
+    s_trigger.head = 0;
+    s_trigger.tail = 0;
+    s_trigger.used = 0;
+    s_trigger.state = TRIGGER_HELD;
+    s_trigger.captures++;
+    s_trigger.truncated += truncated ? 1 : 0;
+    ESP_LOGI(TAG,
+             "trigger: captured %u frames (%u bytes) around %s%s",
+             (unsigned)s_trigger.win.frames,
+             (unsigned)s_trigger.win.bytes,
+             s_trigger.win.spec,
+             truncated ? " (ring full)" : "");
+}
+
+// Ends the post-trigger window when the bus has gone quiet.
+static void trigger_flush_due(int64_t now_us)
+{
+    if (s_trigger.state == TRIGGER_POST && now_us - s_trigger.win.trig_us > (int64_t)s_trigger.cond.post_ms * 1000LL) {
+        trigger_finish(false);
+    }
+}
+
+// Appends the frame to the live ring. Called for every frame before decoding.
+static void trigger_record(const uint8_t *bits, int nbits)
+{
+    if (s_trigger.pending_seq != s_trigger.cond_seq) {
+        xSemaphoreTake(s_state_mutex, portMAX_DELAY);
+        s_trigger.cond = s_trigger.pending;
+        s_trigger.cond_seq = s_trigger.pending_seq;
+        xSemaphoreGive(s_state_mutex);
+        s_trigger.state = s_trigger.cond.kind == TRIGGER_OFF ? TRIGGER_IDLE : TRIGGER_ARMED;
+    } else if (s_trigger.state == TRIGGER_HELD && !s_trigger.slot_ready) {
+        s_trigger.state = TRIGGER_ARMED;
+    }
+    if (s_trigger.state == TRIGGER_IDLE || nbits <= 0) {
+        return;
+    }
+
+    int64_t ts_us = s_frame_timing->ts_us;
+    trigger_flush_due(ts_us);
+
+    uint8_t rec[TRIGGER_REC_MAX];
+    uint16_t len = (uint16_t)(capture_encode_frame(rec + TRIGGER_REC_HDR, bits, nbits) - rec);
+    memcpy(rec, &len, sizeof(len));
+    memcpy(rec + 2, &ts_us, sizeof(ts_us));
+
+    uint8_t *buf = s_trigger_buf[s_trigger.live];
+    while (s_trigger.used + len > TRIGGER_RING_BYTES) {
+        if (s_trigger.state == TRIGGER_POST && s_trigger.tail == s_trigger.win.start) {
+            // Post window would overwrite the pre window: keep what we have.
+            trigger_finish(true);
+            buf = s_trigger_buf[s_trigger.live];
+            break;
+        }
+        uint16_t old_len = 0;
+        int64_t old_ts = 0;
+        trigger_rec_header(buf, s_trigger.tail, &old_len, &old_ts);
+        s_trigger.tail = (s_trigger.tail + old_len) % TRIGGER_RING_BYTES;
+        s_trigger.used -= old_len;
+    }
+    trigger_ring_write(buf, s_trigger.head, rec, len);
+    s_trigger.last_pos = s_trigger.head;
+    s_trigger.last_us = ts_us;
+    s_trigger.head = (s_trigger.head + len) % TRIGGER_RING_BYTES;
+    s_trigger.used += len;
+    if (s_trigger.state == TRIGGER_POST) {
+        s_trigger.win.bytes += len;
+        s_trigger.win.frames++;
+    }
+}
+
+// O(1) test of the frame trigger_record just stored. rank is -1 for a frame
+// that is not byte-aligned; changed_to is the new reading when it changed.
+static void trigger_check(uint64_t packed, int nbits, int rank, const char *changed_to)
+{
+    const trigger_cond_t *c = &s_trigger.cond;
+    if (s_trigger.state != TRIGGER_ARMED || s_trigger.slot_ready) {
+        return;
+    }
+    bool hit = false;
+    switch (c->kind) {
+    case TRIGGER_STATUS:
+        hit = rank >= c->rank_min && rank <= c->rank_max;
+        break;
+    case TRIGGER_PATTERN:
+        hit = nbits == c->nbits && ((packed ^ c->pattern) & c->mask) == 0;
+        break;
+    case TRIGGER_VALUE:
+        hit = changed_to && (c->value[0] == '*' || strcmp(changed_to, c->value) == 0);
+        break;
+    case TRIGGER_GAP:
+        hit = s_frame_timing->gap == c->gap;
+        break;
+    default:
+        break;
+    }
+    if (!hit) {
+        return;
+    }
+
+    // Once per capture: find where the pre window starts.
+    const uint8_t *buf = s_trigger_buf[s_trigger.live];
+    int64_t from_us = s_trigger.last_us - (int64_t)c->pre_ms * 1000LL;
+    uint32_t pos = s_trigger.tail;
+    uint32_t skipped = 0;
+    while (pos != s_trigger.last_pos) {
+        uint16_t len = 0;
+        int64_t ts_us = 0;
+        trigger_rec_header(buf, pos, &len, &ts_us);
+        if (ts_us >= from_us) {
+            break;
+        }
+        pos = (pos + len) % TRIGGER_RING_BYTES;
+        skipped += len;
+    }
+    s_trigger.win = (trigger_slot_t){
+        .buf = s_trigger.live,
+        .start = pos,
+        .trig_pos = s_trigger.last_pos,
+        .bytes = s_trigger.used - skipped,
+        .trig_us = s_trigger.last_us,
+    };
+    for (uint32_t done = 0; done < s_trigger.win.bytes; s_trigger.win.frames++) {
+        uint16_t len = 0;
+        int64_t ts_us = 0;
+        trigger_rec_header(buf, (pos + done) % TRIGGER_RING_BYTES, &len, &ts_us);
+        if (done == 0) {
+            s_trigger.win.first_us = ts_us;
+        }
+        done += len;
+    }
+    s_trigger.state = TRIGGER_POST;
+    s_trigger.fired++;
+    ESP_LOGI(TAG, "trigger: %s hit, frame bits=%d", c->spec, nbits);
+    if (c->post_ms == 0) {
+        trigger_finish(false);
+    }
+}
+#endif
+
+static void handle_frame(const uint8_t *bits, int nbits, int64_t frame_us)
+{
+#if CONFIG_SNIFFER_CAPTURE_STREAM
+    capture_frame(bits, nbits);
+#endif
+#if CONFIG_SNIFFER_ENABLE_TRIGGER
+    trigger_record(bits, nbits);
+#endif
+    s_metrics.frames++;
+    uint64_t packed = 0;
+    for (int i = 0; i < nbits; ++i) {
+        packed = (packed << 1) | (bits[i] & 0x01);
+    }
+    if (nbits < 8 || (nbits % 8) != 0) {
+        s_metrics.frames_misaligned++;
+        ESP_LOGD(TAG, "drop frame bits=%d (not byte-aligned)", nbits);
+#if CONFIG_SNIFFER_ENABLE_TRIGGER
+        trigger_check(packed, nbits, -1, NULL);
+#endif
+        return;
+    }
+
+    static uint64_t s_prev_packed;
+    static int s_prev_nbits;
+    bool repeat = (packed == s_prev_packed && nbits == s_prev_nbits);
+    s_prev_packed = packed;
+    s_prev_nbits = nbits;
+
+    int nbytes = nbits / 8;
+    bool pair_ctx = (nbytes == 1 && s_prev_single_valid && (frame_us - s_prev_single_ts_us) <= CROSS_FRAME_PAIR_US);
+    const decode_cache_entry_t *e = decode_cache_get(packed, nbits, pair_ctx ? (uint16_t)(0x100 | s_prev_single_byte) : 0);
+
+    char hex[64];
+    char decoded[16];
+    const char *status;
+    strncpy(hex, e->hex, sizeof(hex) - 1);
+    hex[sizeof(hex) - 1] = '\0';
+    decode_apply(&e->core, frame_us, decoded, sizeof(decoded), &status);
+    int corrected = e->core.corrected;
+    int mux_slot = e->core.mux_slot;
+
+    if (nbytes == 1) {
+        uint8_t byte = (uint8_t)packed;
+        if (pair_ctx) {
+            char pair_decoded[16] = {0};
+            const char *pair_status = "unknown";
+            decode_apply(&e->pair, frame_us, pair_decoded, sizeof(pair_decoded), &pair_status);
+            // At equal rank an exact decode beats a corrected one.
+            int pair_rank = decode_status_rank(pair_status);
+            int single_rank = decode_status_rank(status);
+            if (pair_rank > single_rank || (pair_rank == single_rank && corrected > 0 && e->pair.corrected == 0)) {
+                strncpy(decoded, pair_decoded, sizeof(decoded) - 1);
+                decoded[sizeof(decoded) - 1] = '\0';
+                status = pair_status;
+                corrected = e->pair.corrected;
+                mux_slot = e->pair.mux_slot;
+                snprintf(hex, sizeof(hex), "%02X %02X", s_prev_single_byte, byte);
+            }
+        }
+        s_prev_single_valid = true;
+        s_prev_single_byte = byte;
+        s_prev_single_ts_us = frame_us;
+    } else {
+        s_prev_single_valid = false;
+    }
+    if (corrected > 0) {
+        s_metrics.corrected_frames++;
+        s_metrics.corrected_bits += (uint32_t)corrected;
+    }
+#if CONFIG_SNIFFER_DECODE_LEARN
+    // Last use of e: a profile change below flushes the cache.
+    decode_learn_observe(nbytes, e);
+#endif
+
+    // Same frame as last time: its raw bit string is already in the shared state.
+    char raw[96] = "";
+    if (!repeat) {
+        build_raw_string(bits, nbits, raw, sizeof(raw));
+    }
+
+    int rank = decode_status_rank(status);
+    if (rank >= 4) {
+        s_metrics.decode_ok++;
+    } else if (rank >= 1) {
+        s_metrics.decode_partial++;
+    } else {
+        s_metrics.decode_unknown++;
+    }
+
+    bool publish = true;
+#if CONFIG_SNIFFER_STABILISER
+    // A flipped bit can still decode to a valid digit; values wait for agreement.
+    if (rank >= 4) {
+        publish = stab_accept(decoded, corrected > 0);
+    }
+#endif
+
+    pipe_reading_t r = {
+        .reading = true,
+        .publish = publish,
+        .repeat = repeat,
+        .rank = (int8_t)rank,
+        .nbits = (uint8_t)nbits,
+        .ind_state = s_indicator_sampled,
+        .ind_known = s_indicator_sampled_known,
+    };
+    if (s_indicator_count > 0) {
+        uint8_t frame_bytes[8];
+        for (int i = 0; i < nbytes; ++i) {
+            frame_bytes[i] = (uint8_t)(packed >> (8 * (nbytes - 1 - i)));
+        }
+        indicators_sample(frame_bytes, nbytes, false, mux_slot, &r.ind_state, &r.ind_known);
+        s_indicator_sampled = r.ind_state;
+        s_indicator_sampled_known = r.ind_known;
+        r.indicators = true;
+    }
+    strncpy(r.decoded, decoded, sizeof(r.decoded) - 1);
+    strncpy(r.status, status, sizeof(r.status) - 1);
+    strncpy(r.hex, hex, sizeof(r.hex) - 1);
+    strncpy(r.raw, raw, sizeof(r.raw) - 1);
+    r.frame_us = frame_us;
+
+#if CONFIG_SNIFFER_ENABLE_TRIGGER
+    // The value publish_task will hold once it gets here, for value triggers.
+    static char s_sent_decoded[16];
+    bool value_changed = publish && strcmp(s_sent_decoded, decoded) != 0;
+    if (spsc_push(&s_reading_ring, &r) && publish) {
+        strncpy(s_sent_decoded, decoded, sizeof(s_sent_decoded) - 1);
+    }
+    trigger_check(packed, nbits, rank, value_changed ? decoded : NULL);
+#else
+    spsc_push(&s_reading_ring, &r);
+#endif
+}
+
+// publish_task: everything a reading changes outside the decoder.
+static void publish_reading(const pipe_reading_t *r)
+{
+    xSemaphoreTake(s_state_mutex, portMAX_DELAY);
+    bool changed = r->publish && ((strcmp(s_last_decoded, r->decoded) != 0) || (strcmp(s_last_decode_status, r->status) != 0));
+    if (changed) {
+        s_state_seq++;
+        strncpy(s_last_decoded, r->decoded, sizeof(s_last_decoded) - 1);
+        strncpy(s_last_decode_status, r->status, sizeof(s_last_decode_status) - 1);
+        s_last_decode_ok = (strncmp(r->status, "ok(", 3) == 0);
+    }
+    uint32_t ind_changed = r->indicators ? indicators_commit(r->ind_state, r->ind_known, r->frame_us) : 0;
+    changed |= (ind_changed != 0);
+    if (r->reading) {
+        if (!r->repeat) {
+            strncpy(s_last_raw, r->raw, sizeof(s_last_raw) - 1);
+        }
+        // Pairing can change the hex of a repeated 1-byte frame.
+        strncpy(s_last_hex, r->hex, sizeof(s_last_hex) - 1);
+        s_last_frame_us = r->frame_us;
+        if (r->publish) {
+            history_on_frame(r->decoded, r->rank, r->frame_us);
+        }
+    }
+    xSemaphoreGive(s_state_mutex);
+
+    if (changed && s_stream_task) {
+        xTaskNotifyGive(s_stream_task);
+    }
+
+    if (r->reading && r->publish) {
+        push_on_decode(r->decoded, r->status, r->frame_us);
+    }
+    if (ind_changed) {
+        indicators_log(ind_changed, r->ind_state);
+    }
+    if (!r->reading) {
+        return;
+    }
+
+    ESP_LOGD(TAG,
+             "frame bits=%d raw=%s bytes=[%s] decoded=%s status=%s%s",
+             r->nbits,
+             r->repeat ? "(repeat)" : r->raw,
+             r->hex,
+             r->decoded,
+             r->status,
+             r->publish ? "" : " (held)");
+}
+
+static void publish_task(void *arg)
+{
+    (void)arg;
+    pipe_reading_t r;
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        while (spsc_pop(&s_reading_ring, &r)) {
+            publish_reading(&r);
+        }
+    }
+}
+
+static gap_kind_t classify_gap_kind(int64_t dt_us)
+{
+    if (dt_us >= PAUSE_LONG_US) {
+        return GAP_LONG;
+    }
+    if (dt_us >= PAUSE_MID_US) {
+        return GAP_MID;
+    }
+    if (dt_us >= PAUSE_SHORT_US) {
+        return GAP_SHORT;
+    }
+    return GAP_NONE;
+}
+
+static void cycle_reset(cycle_state_t *cycle)
+{
+    memset(cycle, 0, sizeof(*cycle));
+}
+
+static void cycle_add_subframe(cycle_state_t *cycle, const uint8_t *bytes, int nbytes, gap_kind_t gap_kind, int64_t ts_us)
+{
+    if (nbytes <= 0) {
+        return;
+    }
+
+    if (cycle->start_ts_us == 0) {
+        cycle->start_ts_us = ts_us;
+    }
+    cycle->last_ts_us = ts_us;
+    cycle->subframes++;
+
+    if (gap_kind == GAP_SHORT) {
+        cycle->gap_short_count++;
+    } else if (gap_kind == GAP_MID) {
+        cycle->gap_mid_count++;
+    } else if (gap_kind == GAP_LONG) {
+        cycle->gap_long_count++;
+    }
+
+    for (int i = 0; i < nbytes && cycle->nbytes < MAX_CYCLE_BYTES; ++i) {
+        cycle->bytes[cycle->nbytes++] = bytes[i];
+    }
+}
+
+static int cycle_compact_bytes(const cycle_state_t *cycle, uint8_t *out, int out_max)
+{
+    int n = 0;
+    bool has_prev = false;
+    uint8_t prev = 0;
+
+    for (int i = 0; i < cycle->nbytes && n < out_max; ++i) {
+        uint8_t b = cycle->bytes[i];
+        if (!has_prev || b != prev) {
+            out[n++] = b;
+            prev = b;
+            has_prev = true;
+        }
+    }
+    return n;
+}
+
+static void handle_cycle_decode(const cycle_state_t *cycle)
+{
+    if (!cycle || cycle->subframes == 0 || cycle->nbytes == 0) {
+        return;
+    }
+
+    uint8_t compact[32] = {0};
+    int compact_n = cycle_compact_bytes(cycle, compact, (int)(sizeof(compact) / sizeof(compact[0])));
+    if (compact_n <= 0) {
+        return;
+    }
+
+    char compact_hex[128] = {0};
+    char decoded[16] = {0};
+    const char *status = "unknown";
+    build_hex_string(compact, compact_n, compact_hex, sizeof(compact_hex));
+    decode_digits(compact, compact_n, cycle->last_ts_us, decoded, sizeof(decoded), &status);
+
+    if (s_indicator_count > 0) {
+        pipe_reading_t r = {
+            .indicators = true,
+            .ind_state = s_indicator_sampled,
+            .ind_known = s_indicator_sampled_known,
+            .frame_us = cycle->last_ts_us,
+        };
+        indicators_sample(cycle->bytes, cycle->nbytes, true, -1, &r.ind_state, &r.ind_known);
+        s_indicator_sampled = r.ind_state;
+        s_indicator_sampled_known = r.ind_known;
+        spsc_push(&s_reading_ring, &r);
+    }
+
+    ESP_LOGD(TAG,
+             "cycle subframes=%d bytes=%d gaps[s/m/l]=%d/%d/%d compact=[%s] decoded=%s status=%s",
+             cycle->subframes,
+             cycle->nbytes,
+             cycle->gap_short_count,
+             cycle->gap_mid_count,
+             cycle->gap_long_count,
+             compact_hex,
+             decoded,
+             status);
+}
+
+static int64_t effective_gap_us_from_timing(const timing_stats_t *ts)
+{
+    int64_t gap_us = FRAME_GAP_US;
+    if (ts->clk_period_ema_us > 0) {
+        int64_t auto_gap_us = ts->clk_period_ema_us * AUTO_GAP_MULTIPLIER;
+        if (auto_gap_us < AUTO_GAP_MIN_US) {
+            auto_gap_us = AUTO_GAP_MIN_US;
+        }
+        if (auto_gap_us > gap_us) {
+            gap_us = auto_gap_us;
+        }
+    }
+    return gap_us;
+}
+
+static void update_timing_stats(timing_stats_t *ts, int64_t dt_us, int64_t used_gap_us)
+{
+    if (dt_us <= 0) {
+        return;
+    }
+
+    ts->dt_count++;
+    ts->dt_sum_us += (uint64_t)dt_us;
+
+    if (ts->dt_min_us == 0 || dt_us < ts->dt_min_us) {
+        ts->dt_min_us = dt_us;
+    }
+    if (dt_us > ts->dt_max_us) {
+        ts->dt_max_us = dt_us;
+    }
+
+    if (dt_us <= used_gap_us) {
+        if (ts->clk_period_ema_us == 0) {
+            ts->clk_period_ema_us = dt_us;
+        } else {
+            ts->clk_period_ema_us = ((ts->clk_period_ema_us * 15) + dt_us) / 16;
+        }
+    } else {
+        ts->long_gap_count++;
+        if (dt_us > ts->long_gap_max_us) {
+            ts->long_gap_max_us = dt_us;
+        }
+        ESP_LOGD(TAG, "gap candidate dt=%lldus (boundary, current_gap=%lldus)", (long long)dt_us, (long long)used_gap_us);
+    }
+
+    int64_t now_us = esp_timer_get_time();
+    if (ts->last_log_ts_us == 0) {
+        ts->last_log_ts_us = now_us;
+        return;
+    }
+
+    if ((now_us - ts->last_log_ts_us) >= TIMING_LOG_PERIOD_US) {
+        uint64_t avg = ts->dt_count ? (ts->dt_sum_us / ts->dt_count) : 0;
+        ESP_LOGD(TAG,
+                 "timing dt_us min=%lld avg=%llu max=%lld ema=%lld gap=%lld long_gaps=%u long_max=%lld",
+                 (long long)ts->dt_min_us,
+                 (unsigned long long)avg,
+                 (long long)ts->dt_max_us,
+                 (long long)ts->clk_period_ema_us,
+                 (long long)effective_gap_us_from_timing(ts),
+                 ts->long_gap_count,
+                 (long long)ts->long_gap_max_us);
+        ts->dt_count = 0;
+        ts->dt_sum_us = 0;
+        ts->dt_min_us = 0;
+        ts->dt_max_us = 0;
+        ts->long_gap_count = 0;
+        ts->long_gap_max_us = 0;
+        ts->last_log_ts_us = now_us;
+    }
+}
+
+static esp_timer_handle_t s_idle_timer;
+
+// Runs on the esp_timer task once the bus has been quiet for a gap: the
+// marker wakes sniffer_task right away instead of at its next 1 s timeout, so
+// the last frame of the cycle reaches decode_task without that delay.
+static void idle_timer_cb(void *arg)
+{
+    (void)arg;
+    bit_event_t ev = {
+        .bit = BIT_EVENT_IDLE,
+        .ts_us = esp_timer_get_time(),
+    };
+    xQueueSend(s_bit_queue, &ev, 0);
+}
+
+// Edges only arm the timer when it is idle, so a busy bus costs one arm per
+// gap rather than per edge. An early marker re-arms from the latest edge.
+static void idle_timer_arm(int64_t deadline_us)
+{
+    if (!s_idle_timer) {
+        return;
+    }
+    int64_t delay_us = deadline_us - esp_timer_get_time();
+    esp_timer_stop(s_idle_timer);
+    esp_timer_start_once(s_idle_timer, delay_us > 0 ? (uint64_t)delay_us : 1);
+}
+
+// Hands the frame assembled in f to decode_task. cycle_open tracks whether
+// decode_task holds subframes of a cycle that has not ended yet.
+static void pipe_emit_frame(pipe_frame_t *f, int nbits, int64_t last_ts, gap_kind_t gap_after, uint8_t flags, bool *cycle_open)
+{
+    f->nbits = (uint8_t)nbits;
+    f->gap_after = (uint8_t)gap_after;
+    f->flags = flags;
+    f->last_ts_us = last_ts;
+    spsc_push(&s_frame_ring, f);
+    if (nbits > 0 && (nbits % 8) == 0) {
+        *cycle_open = true;
+    }
+    if (flags & PIPE_FRAME_CYCLE_END) {
+        *cycle_open = false;
+    }
+}
+
+// now_us is the marker's timestamp (current time on a plain timeout): edges
+// queued behind the marker must not count towards the idle time.
+static void sniffer_idle_flush(pipe_frame_t *cur,
+                               int *nbits,
+                               bool *cycle_open,
+                               const timing_stats_t *t,
+                               int64_t last_ts,
+                               int64_t now_us)
+{
+    int64_t idle_us = now_us - last_ts;
+    bool flush = *nbits > 0 && idle_us > effective_gap_us_from_timing(t);
+    bool cycle_end = idle_us > PAUSE_LONG_US && (*cycle_open || (flush && (*nbits % 8) == 0));
+    if (flush || cycle_end) {
+        uint8_t flags = (uint8_t)((flush ? PIPE_FRAME_IDLE : 0) | (cycle_end ? PIPE_FRAME_CYCLE_END : 0));
+        pipe_emit_frame(cur, flush ? *nbits : 0, last_ts, GAP_NONE, flags, cycle_open);
+    }
+    if (flush) {
+        *nbits = 0;
+    }
+}
+
+// Stage 1: drains s_bit_queue and cuts the edge stream into frames. Nothing
+// here waits on a lock or on a later stage.
+static void sniffer_task(void *arg)
+{
+    (void)arg;
+    bit_event_t ev;
+    pipe_frame_t cur = {0};
+    int nbits = 0;
+    int64_t last_ts = 0;
+    timing_stats_t t = {0};
+    bool cycle_open = false;
+
+    const esp_timer_create_args_t idle_args = {
+        .callback = idle_timer_cb,
+        .name = "bus_idle",
+    };
+    if (esp_timer_create(&idle_args, &s_idle_timer) != ESP_OK) {
+        ESP_LOGW(TAG, "idle timer allocation failed; idle flush falls back to 1 s polling");
+        s_idle_timer = NULL;
+    }
+
+    while (1) {
+        bool got = (xQueueReceive(s_bit_queue, &ev, pdMS_TO_TICKS(1000)) == pdTRUE);
+        if (!got || ev.bit == BIT_EVENT_IDLE) {
+            sniffer_idle_flush(&cur, &nbits, &cycle_open, &t, last_ts, got ? ev.ts_us : esp_timer_get_time());
+            if (nbits > 0) {
+                idle_timer_arm(last_ts + effective_gap_us_from_timing(&t) + 1);
+            } else if (cycle_open) {
+                idle_timer_arm(last_ts + PAUSE_LONG_US + 1);
+            }
+            continue;
+        }
+
+        uint32_t depth = (uint32_t)uxQueueMessagesWaiting(s_bit_queue) + 1;
+        if (depth > s_metrics.queue_peak) {
+            s_metrics.queue_peak = depth;
+        }
+        int64_t gap_us = effective_gap_us_from_timing(&t);
+        gap_kind_t gap_kind = GAP_NONE;
+        int64_t dt_us = 0;
+        if (last_ts > 0) {
+            dt_us = ev.ts_us - last_ts;
+            update_timing_stats(&t, dt_us, gap_us);
+            gap_us = effective_gap_us_from_timing(&t);
+            gap_kind = classify_gap_kind(dt_us);
+        }
+
+        if (nbits > 0 && (ev.ts_us - last_ts) > gap_us) {
+            pipe_emit_frame(&cur, nbits, last_ts, gap_kind, gap_kind == GAP_LONG ? PIPE_FRAME_CYCLE_END : 0, &cycle_open);
+            nbits = 0;
+        }
+
+        if (nbits < MAX_FRAME_BITS) {
+#if FRAME_TIMING_ENABLED
+            frame_note_bit(&cur.timing, nbits, ev.ts_us, dt_us, gap_kind);
+#endif
+            cur.bits[nbits++] = ev.bit;
+        } else {
+            s_metrics.frame_overflows++;
+            ESP_LOGW(TAG, "frame overflow, force flush bits=%d", nbits);
+            pipe_emit_frame(&cur, nbits, last_ts, GAP_NONE, 0, &cycle_open);
+            nbits = 0;
+        }
+        last_ts = ev.ts_us;
+        if (s_idle_timer && !esp_timer_is_active(s_idle_timer)) {
+            idle_timer_arm(last_ts + effective_gap_us_from_timing(&t) + 1);
+        }
+    }
+}
+
+static void decode_frame(const pipe_frame_t *f, cycle_state_t *cycle)
+{
+    if (f->nbits > 0) {
+#if FRAME_TIMING_ENABLED
+        s_frame_timing = &f->timing;
+#endif
+        handle_frame(f->bits, f->nbits, f->last_ts_us);
+        if ((f->nbits % 8) == 0) {
+            uint8_t frame_bytes[8] = {0};
+            int nbytes = bits_to_bytes(f->bits, f->nbits, frame_bytes, (int)(sizeof(frame_bytes) / sizeof(frame_bytes[0])));
+            cycle_add_subframe(cycle, frame_bytes, nbytes, (gap_kind_t)f->gap_after, f->last_ts_us);
+        }
+        if (f->flags & PIPE_FRAME_IDLE) {
+            // Last edge to decoded frame; ideally just over one gap.
+            uint32_t latency_us = (uint32_t)(esp_timer_get_time() - f->last_ts_us);
+            s_metrics.idle_flushes++;
+            s_metrics.idle_flush_last_us = latency_us;
+            if (latency_us > s_metrics.idle_flush_max_us) {
+                s_metrics.idle_flush_max_us = latency_us;
+            }
+        }
+    }
+    if (f->flags & PIPE_FRAME_CYCLE_END) {
+        handle_cycle_decode(cycle);
+        cycle_reset(cycle);
+    }
+}
+
+// Stage 2: frames to readings, plus the raw-frame consumers (capture stream,
+// trigger) that need the decode result or may take their time encoding.
+static void decode_task(void *arg)
+{
+    (void)arg;
+    pipe_frame_t f;
+    cycle_state_t cycle = {0};
+
+#if CONFIG_SNIFFER_DECODE_LEARN
+    decode_profile_load();
+#endif
+
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000));
+        while (spsc_pop(&s_frame_ring, &f)) {
+            decode_frame(&f, &cycle);
+        }
+#if CONFIG_SNIFFER_CAPTURE_STREAM
+        capture_flush_due(esp_timer_get_time());
+#endif
+#if CONFIG_SNIFFER_ENABLE_TRIGGER
+        trigger_flush_due(esp_timer_get_time());
+#endif
+    }
+}
+
+static bool pipeline_task(TaskFunction_t fn, const char *name, uint32_t stack, int prio, int core, TaskHandle_t *out)
+{
+#if CONFIG_FREERTOS_UNICORE
+    core = -1;
+#endif
+    if (xTaskCreatePinnedToCore(fn, name, stack, NULL, prio, out, core < 0 ? tskNO_AFFINITY : core) != pdPASS) {
+        ESP_LOGE(TAG, "%s allocation failed", name);
+        return false;
+    }
+    return true;
+}
+
+// Consumers first, so every ring has someone to notify before it fills.
+static void pipeline_start(void)
+{
+    if (!pipeline_task(publish_task,
+                       "publish_task",
+                       PIPE_PUBLISH_STACK,
+                       CONFIG_SNIFFER_PIPE_PUBLISH_PRIO,
+                       CONFIG_SNIFFER_PIPE_PUBLISH_CORE,
+                       &s_reading_ring.consumer) ||
+        !pipeline_task(decode_task,
+                       "decode_task",
+                       PIPE_DECODE_STACK,
+                       CONFIG_SNIFFER_PIPE_DECODE_PRIO,
+                       CONFIG_SNIFFER_PIPE_DECODE_CORE,
+                       &s_frame_ring.consumer)) {
+        return;
+    }
+    pipeline_task(sniffer_task,
+                  "sniffer_task",
+                  PIPE_CAPTURE_STACK,
+                  CONFIG_SNIFFER_PIPE_CAPTURE_PRIO,
+                  CONFIG_SNIFFER_PIPE_CAPTURE_CORE,
+                  NULL);
+}
+
+static void IRAM_ATTR clk_isr_handler(void *arg)
+{
+    (void)arg;
+    bit_event_t ev;
+    ev.bit = (uint8_t)gpio_level_fast((gpio_num_t)DATA_GPIO);
+    ev.ts_us = esp_timer_get_time();
+
+    BaseType_t hp_task_woken = pdFALSE;
+    s_metrics.isr_events++;
+    if (xQueueSendFromISR(s_bit_queue, &ev, &hp_task_woken) != pdTRUE) {
+        s_metrics.isr_dropped++;
+    }
+    if (hp_task_woken) {
+        portYIELD_FROM_ISR();
+    }
+}
+
+static bool ip4_addr_is_zero(const esp_ip4_addr_t *addr)
+{
+    return addr && (addr->addr == 0);
+}
+
+static void log_dns_servers(esp_netif_t *netif)
+{
+    if (!netif) {
+        return;
+    }
+
+    esp_netif_dns_info_t dns = {0};
+    char ipbuf[INET_ADDRSTRLEN] = {0};
+
+    if (esp_netif_get_dns_info(netif, ESP_NETIF_DNS_MAIN, &dns) == ESP_OK) {
+        esp_ip4addr_ntoa(&dns.ip.u_addr.ip4, ipbuf, sizeof(ipbuf));
+        ESP_LOGI(TAG, "dns main=%s", ipbuf);
+    }
+    if (esp_netif_get_dns_info(netif, ESP_NETIF_DNS_BACKUP, &dns) == ESP_OK) {
+        esp_ip4addr_ntoa(&dns.ip.u_addr.ip4, ipbuf, sizeof(ipbuf));
+        ESP_LOGI(TAG, "dns backup=%s", ipbuf);
+    }
+}
+
+static void ensure_dns_servers(esp_netif_t *netif)
+{
+    if (!netif) {
+        return;
+    }
+
+    esp_netif_dns_info_t dns_main = {0};
+    if (esp_netif_get_dns_info(netif, ESP_NETIF_DNS_MAIN, &dns_main) != ESP_OK) {
+        return;
+    }
+
+    if (!ip4_addr_is_zero(&dns_main.ip.u_addr.ip4)) {
+        return;
+    }
+
+    ESP_LOGW(TAG, "DNS main server is empty, applying fallback DNS");
+
+    esp_netif_dns_info_t dns_fallback = {
+        .ip.type = ESP_IPADDR_TYPE_V4,
+    };
+
+    IP4_ADDR(&dns_fallback.ip.u_addr.ip4, 1, 1, 1, 1);
+    ESP_ERROR_CHECK_WITHOUT_ABORT(esp_netif_set_dns_info(netif, ESP_NETIF_DNS_MAIN, &dns_fallback));
+
+    IP4_ADDR(&dns_fallback.ip.u_addr.ip4, 8, 8, 8, 8);
+    ESP_ERROR_CHECK_WITHOUT_ABORT(esp_netif_set_dns_info(netif, ESP_NETIF_DNS_BACKUP, &dns_fallback));
+}
+
+static bool wait_dns_ready(uint32_t timeout_ms)
+{
+    const TickType_t delay = pdMS_TO_TICKS(DNS_READY_POLL_MS);
+    uint32_t elapsed = 0;
+    char host[DNS_HOST_MAX];
+    const char *rest = NULL;
+    if (!url_split_host(TELEGRAM_API_URL, host, sizeof(host), &rest)) {
+        return false;
+    }
+    while (elapsed <= timeout_ms) {
+        uint32_t addr = 0;
+        if (dns_cache_lookup(host, &addr)) {
+            return true;
+        }
+
+        vTaskDelay(delay);
+        elapsed += DNS_READY_POLL_MS;
+    }
+    return false;
+}
+
+static bool wifi_cache_load(wifi_fast_cache_t *cache)
+{
+    nvs_handle_t nvs = 0;
+    if (nvs_open(WIFI_NVS_NS, NVS_READONLY, &nvs) != ESP_OK) {
+        return false;
+    }
+    size_t len = sizeof(*cache);
+    esp_err_t err = nvs_get_blob(nvs, WIFI_NVS_KEY_FAST, cache, &len);
+    nvs_close(nvs);
+    // A cache for another SSID (config changed) is as good as none.
+    return err == ESP_OK && len == sizeof(*cache) && cache->channel != 0 &&
+           strncmp(cache->ssid, WIFI_SSID, sizeof(cache->ssid)) == 0;
+}
+
+static void wifi_cache_store(const wifi_fast_cache_t *cache)
+{
+    nvs_handle_t nvs = 0;
+    esp_err_t err = nvs_open(WIFI_NVS_NS, NVS_READWRITE, &nvs);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "nvs_open(%s) failed: %s", WIFI_NVS_NS, esp_err_to_name(err));
+        return;
+    }
+    if (cache) {
+        err = nvs_set_blob(nvs, WIFI_NVS_KEY_FAST, cache, sizeof(*cache));
+    } else {
+        err = nvs_erase_key(nvs, WIFI_NVS_KEY_FAST);
+    }
+    if (err == ESP_OK) {
+        err = nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+    if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
+        ESP_LOGW(TAG, "wifi cache store failed: %s", esp_err_to_name(err));
+    }
+}
+
+static void wifi_apply_static_ip(void)
+{
+    if (strlen(CONFIG_SNIFFER_WIFI_STATIC_IP) == 0) {
+        return;
+    }
+
+    esp_netif_ip_info_t ip_info = {0};
+    if (esp_netif_str_to_ip4(CONFIG_SNIFFER_WIFI_STATIC_IP, &ip_info.ip) != ESP_OK ||
+        esp_netif_str_to_ip4(CONFIG_SNIFFER_WIFI_STATIC_NETMASK, &ip_info.netmask) != ESP_OK ||
+        esp_netif_str_to_ip4(CONFIG_SNIFFER_WIFI_STATIC_GW, &ip_info.gw) != ESP_OK) {
+        ESP_LOGW(TAG, "static IP config is invalid, using DHCP");
+        return;
+    }
+
+    esp_netif_dhcpc_stop(s_sta_netif);
+    ESP_ERROR_CHECK_WITHOUT_ABORT(esp_netif_set_ip_info(s_sta_netif, &ip_info));
+    if (strlen(CONFIG_SNIFFER_WIFI_STATIC_DNS) > 0) {
+        esp_netif_dns_info_t dns = {
+            .ip.type = ESP_IPADDR_TYPE_V4,
+        };
+        if (esp_netif_str_to_ip4(CONFIG_SNIFFER_WIFI_STATIC_DNS, &dns.ip.u_addr.ip4) == ESP_OK) {
+            ESP_ERROR_CHECK_WITHOUT_ABORT(esp_netif_set_dns_info(s_sta_netif, ESP_NETIF_DNS_MAIN, &dns));
+        }
+    }
+    s_boot.static_ip = true;
+}
+
+static void wifi_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
+{
+    (void)arg;
+
+    if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
+        esp_wifi_connect();
+    } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_CONNECTED) {
+        wifi_event_sta_connected_t *event = (wifi_event_sta_connected_t *)event_data;
+        if (s_boot.assoc_us == 0) {
+            s_boot.assoc_us = esp_timer_get_time();
+        }
+
+        wifi_fast_cache_t seen = {0};
+        memcpy(seen.ssid, event->ssid, sizeof(seen.ssid) < event->ssid_len ? sizeof(seen.ssid) : event->ssid_len);
+        memcpy(seen.bssid, event->bssid, sizeof(seen.bssid));
+        seen.channel = event->channel;
+        if (memcmp(&seen, &s_wifi_cache, sizeof(seen)) != 0) {
+            s_wifi_cache = seen;
+            wifi_cache_store(&seen);
+            ESP_LOGI(TAG, "WiFi cache: bssid " MACSTR " ch %u", MAC2STR(seen.bssid), (unsigned)seen.channel);
+        }
+        wifi_apply_static_ip();
+    } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
+        xEventGroupClearBits(s_wifi_events, WIFI_CONNECTED_BIT);
+        if (s_wifi_fast_pending) {
+            // Cached AP moved or is gone: forget it and fall back to a scan.
+            wifi_event_sta_disconnected_t *event = (wifi_event_sta_disconnected_t *)event_data;
+            ESP_LOGW(TAG, "WiFi fast connect failed (reason %u), scanning", (unsigned)event->reason);
+            s_wifi_fast_pending = false;
+            memset(&s_wifi_cache, 0, sizeof(s_wifi_cache));
+            wifi_cache_store(NULL);
+
+            wifi_config_t wifi_config = {0};
+            esp_wifi_get_config(WIFI_IF_STA, &wifi_config);
+            wifi_config.sta.bssid_set = false;
+            wifi_config.sta.channel = 0;
+            esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+        }
+        esp_wifi_connect();
+        ESP_LOGW(TAG, "WiFi disconnected, reconnecting");
+    } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
+        ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
+        ESP_LOGI(TAG,
+                 "sta ip: " IPSTR ", mask: " IPSTR ", gw: " IPSTR,
+                 IP2STR(&event->ip_info.ip),
+                 IP2STR(&event->ip_info.netmask),
+                 IP2STR(&event->ip_info.gw));
+        ensure_dns_servers(s_sta_netif);
+        log_dns_servers(s_sta_netif);
+        if (s_boot.got_ip_us == 0) {
+            s_boot.got_ip_us = esp_timer_get_time();
+            s_boot.fast_connect = s_wifi_fast_pending;
+        }
+        s_wifi_fast_pending = false;
+        xEventGroupSetBits(s_wifi_events, WIFI_CONNECTED_BIT);
+        ESP_LOGI(TAG, "WiFi connected");
+    }
+}
+
+static void wifi_init_sta(void)
+{
+    s_wifi_events = xEventGroupCreate();
+
+    ESP_ERROR_CHECK(esp_netif_init());
+    ESP_ERROR_CHECK(esp_event_loop_create_default());
+    s_sta_netif = esp_netif_create_default_wifi_sta();
+    ESP_ERROR_CHECK(s_sta_netif ? ESP_OK : ESP_FAIL);
+
+    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+    ESP_ERROR_CHECK(esp_wifi_init(&cfg));
+
+    ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &wifi_event_handler, NULL));
+    ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &wifi_event_handler, NULL));
+
+    wifi_config_t wifi_config = {0};
+    strncpy((char *)wifi_config.sta.ssid, WIFI_SSID, sizeof(wifi_config.sta.ssid) - 1);
+    strncpy((char *)wifi_config.sta.password, WIFI_PASS, sizeof(wifi_config.sta.password) - 1);
+    wifi_config.sta.threshold.authmode = WIFI_AUTH_WPA2_PSK;
 
-    int64_t age_us = esp_timer_get_time() - frame_us;
-    if (frame_us > 0 && age_us <= STATUS_STALE_US && strncmp(decode_status, "ok(", 3) == 0) {
-        snprintf(out, out_len, "%s", decoded);
-    } else {
-        snprintf(out, out_len, "unknown");
+#if CONFIG_SNIFFER_WIFI_FAST_CONNECT
+    // Known BSSID + channel: associate without scanning all channels.
+    if (wifi_cache_load(&s_wifi_cache)) {
+        wifi_config.sta.bssid_set = true;
+        memcpy(wifi_config.sta.bssid, s_wifi_cache.bssid, sizeof(wifi_config.sta.bssid));
+        wifi_config.sta.channel = s_wifi_cache.channel;
+        s_wifi_fast_pending = true;
+        ESP_LOGI(TAG, "WiFi fast connect: bssid " MACSTR " ch %u", MAC2STR(s_wifi_cache.bssid), (unsigned)s_wifi_cache.channel);
     }
+#endif
+
+    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
+    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
+    s_boot.wifi_start_us = esp_timer_get_time();
+    ESP_ERROR_CHECK(esp_wifi_start());
+
+    xEventGroupWaitBits(s_wifi_events, WIFI_CONNECTED_BIT, pdFALSE, pdTRUE, pdMS_TO_TICKS(WIFI_CONNECT_TIMEOUT_MS));
 }
 
-static void build_fw_version_reply(char *out, size_t out_len)
+#if CONFIG_SNIFFER_ENABLE_MQTT
+static esp_mqtt_client_handle_t s_mqtt;
+static volatile bool s_mqtt_connected;
+static char s_mqtt_base[MQTT_TOPIC_MAX];
+static mqtt_reading_t s_mqtt_ring[CONFIG_SNIFFER_MQTT_RING_LEN];
+static int s_mqtt_ring_head;
+static int s_mqtt_ring_count;
+static uint32_t s_mqtt_ring_overwritten;
+static int64_t s_mqtt_oldest_us;
+static int64_t s_mqtt_last_metrics_us;
+// Also carries the metrics topic, which can outgrow the other messages.
+static char s_mqtt_payload[MQTT_PAYLOAD_MAX > METRICS_JSON_MAX ? MQTT_PAYLOAD_MAX : METRICS_JSON_MAX];
+static char s_mqtt_reply[MQTT_PAYLOAD_MAX];
+
+static void mqtt_topic(char *out, size_t out_len, const char *leaf)
 {
-    const esp_app_desc_t *app_desc = esp_app_get_description();
-    const char *fw_version = (app_desc && app_desc->version[0] != '\0') ? app_desc->version : "unknown";
-    snprintf(out, out_len, "%s", fw_version);
+    snprintf(out, out_len, "%s/%s", s_mqtt_base, leaf);
 }
 
-static void send_temp_series(const char *chat_id)
+static void mqtt_event_handler(void *arg, esp_event_base_t base, int32_t event_id, void *event_data)
 {
-    for (int i = 0; i < 10; ++i) {
-        char reply[96];
-        build_decoded_reply(reply, sizeof(reply));
-        if (!telegram_send_text(chat_id, reply)) {
-            ESP_LOGW(TAG, "telegram send failed");
-            break;
+    (void)arg;
+    (void)base;
+    esp_mqtt_event_handle_t event = (esp_mqtt_event_handle_t)event_data;
+
+    if (event_id == MQTT_EVENT_CONNECTED) {
+        char topic[MQTT_TOPIC_MAX];
+        mqtt_topic(topic, sizeof(topic), "online");
+        esp_mqtt_client_publish(event->client, topic, "1", 1, 1, 1);
+        mqtt_topic(topic, sizeof(topic), "cmd/history");
+        esp_mqtt_client_subscribe(event->client, topic, 0);
+        s_mqtt_connected = true;
+        ESP_LOGI(TAG, "MQTT connected, %d readings buffered", s_mqtt_ring_count);
+    } else if (event_id == MQTT_EVENT_DISCONNECTED) {
+        s_mqtt_connected = false;
+        ESP_LOGW(TAG, "MQTT disconnected");
+    } else if (event_id == MQTT_EVENT_DATA) {
+        char topic[MQTT_TOPIC_MAX];
+        mqtt_topic(topic, sizeof(topic), "cmd/history");
+        if (event->topic_len != (int)strlen(topic) || strncmp(event->topic, topic, (size_t)event->topic_len) != 0) {
+            return;
         }
 
-        if (i < 9) {
-            vTaskDelay(pdMS_TO_TICKS(3000));
-        }
+        char arg[16] = {0};
+        int arg_len = event->data_len < (int)sizeof(arg) - 1 ? event->data_len : (int)sizeof(arg) - 1;
+        memcpy(arg, event->data, (size_t)arg_len);
+        build_history_json(arg, s_mqtt_reply, sizeof(s_mqtt_reply));
+        mqtt_topic(topic, sizeof(topic), "history");
+        esp_mqtt_client_publish(event->client, topic, s_mqtt_reply, (int)strlen(s_mqtt_reply), 0, 0);
     }
 }
 
-static void telegram_poll_and_respond(int64_t *next_offset)
+static void mqtt_start(void)
 {
-#if CONFIG_SNIFFER_ENABLE_TELEGRAM
-    if (strlen(CONFIG_SNIFFER_TELEGRAM_BOT_TOKEN) == 0) {
-        vTaskDelay(pdMS_TO_TICKS(2000));
-        return;
+    const char *device_id = CONFIG_SNIFFER_MQTT_DEVICE_ID;
+    char mac_id[16] = {0};
+    if (strlen(device_id) == 0) {
+        uint8_t mac[6] = {0};
+        esp_read_mac(mac, ESP_MAC_WIFI_STA);
+        snprintf(mac_id, sizeof(mac_id), "%02x%02x%02x", mac[3], mac[4], mac[5]);
+        device_id = mac_id;
     }
-
-    char url[320];
-    snprintf(url,
-             sizeof(url),
-             "https://api.telegram.org/bot%s/getUpdates?timeout=%d&offset=%lld",
-             CONFIG_SNIFFER_TELEGRAM_BOT_TOKEN,
-             TELEGRAM_POLL_TIMEOUT_S,
-             (long long)*next_offset);
-
-    char response[TELEGRAM_RESP_MAX];
-    if (!telegram_http_get(url, response, sizeof(response))) {
-        vTaskDelay(pdMS_TO_TICKS(1500));
-        return;
+    snprintf(s_mqtt_base, sizeof(s_mqtt_base), "%s/%s", CONFIG_SNIFFER_MQTT_TOPIC_PREFIX, device_id);
+
+    static char will_topic[MQTT_TOPIC_MAX];
+    mqtt_topic(will_topic, sizeof(will_topic), "online");
+
+    esp_mqtt_client_config_t cfg = {
+        .broker.address.uri = CONFIG_SNIFFER_MQTT_BROKER_URI,
+        .session.last_will = {
+            .topic = will_topic,
+            .msg = "0",
+            .msg_len = 1,
+            .qos = 1,
+            .retain = 1,
+        },
+        .buffer.out_size = sizeof(s_mqtt_payload) + MQTT_TOPIC_MAX + 16,
+    };
+    if (strlen(CONFIG_SNIFFER_MQTT_USERNAME) > 0) {
+        cfg.credentials.username = CONFIG_SNIFFER_MQTT_USERNAME;
+        cfg.credentials.authentication.password = CONFIG_SNIFFER_MQTT_PASSWORD;
     }
 
-    cJSON *root = cJSON_Parse(response);
-    if (!root) {
-        ESP_LOGW(TAG, "telegram parse failed");
+    s_mqtt = esp_mqtt_client_init(&cfg);
+    if (!s_mqtt) {
+        ESP_LOGE(TAG, "MQTT client init failed");
         return;
     }
+    esp_mqtt_client_register_event(s_mqtt, MQTT_EVENT_ANY, mqtt_event_handler, NULL);
+    ESP_ERROR_CHECK_WITHOUT_ABORT(esp_mqtt_client_start(s_mqtt));
+    ESP_LOGI(TAG, "MQTT broker=%s base=%s", CONFIG_SNIFFER_MQTT_BROKER_URI, s_mqtt_base);
+}
 
-    cJSON *result = cJSON_GetObjectItem(root, "result");
-    if (!cJSON_IsArray(result)) {
-        cJSON_Delete(root);
-        return;
+// Ring is only touched from push_task; the oldest reading is overwritten when full.
+static void mqtt_enqueue_reading(const push_msg_t *msg)
+{
+    int idx = (s_mqtt_ring_head + s_mqtt_ring_count) % CONFIG_SNIFFER_MQTT_RING_LEN;
+    if (s_mqtt_ring_count == CONFIG_SNIFFER_MQTT_RING_LEN) {
+        s_mqtt_ring_head = (s_mqtt_ring_head + 1) % CONFIG_SNIFFER_MQTT_RING_LEN;
+        s_mqtt_ring_overwritten++;
+    } else {
+        s_mqtt_ring_count++;
     }
 
-    cJSON *item = NULL;
-    cJSON_ArrayForEach(item, result)
-    {
-        cJSON *update_id = cJSON_GetObjectItem(item, "update_id");
-        if (cJSON_IsNumber(update_id)) {
-            int64_t id = (int64_t)update_id->valuedouble;
-            if (id >= *next_offset) {
-                *next_offset = id + 1;
-                telegram_store_next_offset(*next_offset);
-            }
-        }
+    mqtt_reading_t *r = &s_mqtt_ring[idx];
+    strncpy(r->decoded, msg->decoded, sizeof(r->decoded) - 1);
+    r->decoded[sizeof(r->decoded) - 1] = '\0';
+    strncpy(r->status, msg->status, sizeof(r->status) - 1);
+    r->status[sizeof(r->status) - 1] = '\0';
+    r->frame_us = msg->frame_us;
+    if (s_mqtt_ring_count == 1) {
+        s_mqtt_oldest_us = esp_timer_get_time();
+    }
+}
 
-        cJSON *message = cJSON_GetObjectItem(item, "message");
-        if (!cJSON_IsObject(message)) {
-            continue;
+static bool mqtt_publish_batch(void)
+{
+    int n = s_mqtt_ring_count < CONFIG_SNIFFER_MQTT_BATCH_MAX ? s_mqtt_ring_count : CONFIG_SNIFFER_MQTT_BATCH_MAX;
+    size_t used = (size_t)snprintf(s_mqtt_payload, sizeof(s_mqtt_payload), "{\"readings\":[");
+    int packed = 0;
+
+    for (int i = 0; i < n; ++i) {
+        const mqtt_reading_t *r = &s_mqtt_ring[(s_mqtt_ring_head + i) % CONFIG_SNIFFER_MQTT_RING_LEN];
+        int len = snprintf(s_mqtt_payload + used,
+                           sizeof(s_mqtt_payload) - used,
+                           "%s{\"v\":\"%s\",\"s\":\"%s\",\"t_ms\":%lld}",
+                           (i == 0) ? "" : ",",
+                           r->decoded,
+                           r->status,
+                           (long long)(r->frame_us / 1000));
+        // Keep room for the closing bracket; the rest goes in the next batch.
+        if (len <= 0 || (size_t)len + 3 >= sizeof(s_mqtt_payload) - used) {
+            break;
         }
+        used += (size_t)len;
+        packed++;
+    }
+    if (packed == 0) {
+        return false;
+    }
+    used += (size_t)snprintf(s_mqtt_payload + used, sizeof(s_mqtt_payload) - used, "]}");
 
-        cJSON *text = cJSON_GetObjectItem(message, "text");
-        if (!cJSON_IsString(text) || !text->valuestring) {
-            continue;
-        }
+    char topic[MQTT_TOPIC_MAX];
+    mqtt_topic(topic, sizeof(topic), "readings");
+    if (esp_mqtt_client_publish(s_mqtt, topic, s_mqtt_payload, (int)used, 1, 0) < 0) {
+        return false;
+    }
 
-        bool cmd_status = (strcmp(text->valuestring, "/status") == 0);
-        bool cmd_get_temp = (strcmp(text->valuestring, "/get_temp") == 0);
-        bool cmd_update = (strcmp(text->valuestring, "/update") == 0);
-        bool cmd_ota_legacy = (strcmp(text->valuestring, "/ota") == 0);
-        if (!cmd_status && !cmd_get_temp && !cmd_update && !cmd_ota_legacy) {
-            continue;
-        }
+    s_mqtt_ring_head = (s_mqtt_ring_head + packed) % CONFIG_SNIFFER_MQTT_RING_LEN;
+    s_mqtt_ring_count -= packed;
+    s_mqtt_oldest_us = esp_timer_get_time();
+    return true;
+}
 
-        cJSON *chat = cJSON_GetObjectItem(message, "chat");
-        cJSON *chat_id = chat ? cJSON_GetObjectItem(chat, "id") : NULL;
-        char chat_id_str[32] = {0};
+static void mqtt_publish_status(void)
+{
+    char decoded[16] = {0};
+    char decode_status[24] = {0};
+    int64_t frame_us = 0;
 
-        if (cJSON_IsString(chat_id) && chat_id->valuestring) {
-            strncpy(chat_id_str, chat_id->valuestring, sizeof(chat_id_str) - 1);
-        } else if (cJSON_IsNumber(chat_id)) {
-            snprintf(chat_id_str, sizeof(chat_id_str), "%.0f", chat_id->valuedouble);
-        } else {
-            continue;
-        }
+    xSemaphoreTake(s_state_mutex, portMAX_DELAY);
+    strncpy(decoded, s_last_decoded, sizeof(decoded) - 1);
+    strncpy(decode_status, s_last_decode_status, sizeof(decode_status) - 1);
+    frame_us = s_last_frame_us;
+    uint32_t ind_state = s_indicator_state;
+    uint32_t ind_known = s_indicator_known;
+    xSemaphoreGive(s_state_mutex);
 
-        if (strlen(CONFIG_SNIFFER_TELEGRAM_CHAT_ID) > 0 && strcmp(chat_id_str, CONFIG_SNIFFER_TELEGRAM_CHAT_ID) != 0) {
-            continue;
-        }
+    char indicators[INDICATOR_JSON_MAX];
+    indicators_json(ind_state, ind_known, indicators, sizeof(indicators));
+    char topic[MQTT_TOPIC_MAX];
+    int len = snprintf(s_mqtt_payload,
+                       sizeof(s_mqtt_payload),
+                       "{\"decoded\":\"%s\",\"status\":\"%s\",\"age_ms\":%lld,\"indicators\":%s}",
+                       decoded,
+                       decode_status,
+                       frame_us > 0 ? (long long)((esp_timer_get_time() - frame_us) / 1000) : -1LL,
+                       indicators);
+    mqtt_topic(topic, sizeof(topic), "decode");
+    esp_mqtt_client_publish(s_mqtt, topic, s_mqtt_payload, len, 0, 1);
+
+    build_metrics_json(s_mqtt_payload, sizeof(s_mqtt_payload));
+    mqtt_topic(topic, sizeof(topic), "metrics");
+    esp_mqtt_client_publish(s_mqtt, topic, s_mqtt_payload, (int)strlen(s_mqtt_payload), 0, 0);
+}
 
-        if (cmd_status) {
-            char reply[32];
-            build_fw_version_reply(reply, sizeof(reply));
-            if (!telegram_send_text(chat_id_str, reply)) {
-                ESP_LOGW(TAG, "telegram send failed");
-            }
-            continue;
+// One message per indicator change, oldest first; kept queued while offline.
+static void mqtt_publish_indicator_events(void)
+{
+    char topic[MQTT_TOPIC_MAX];
+    mqtt_topic(topic, sizeof(topic), "indicator");
+    while (s_mqtt_connected) {
+        indicator_event_t ev;
+        xSemaphoreTake(s_state_mutex, portMAX_DELAY);
+        bool have = s_indicator_event_count > 0;
+        if (have) {
+            ev = s_indicator_events[s_indicator_event_head];
         }
-
-        if (cmd_get_temp) {
-            send_temp_series(chat_id_str);
-            continue;
+        xSemaphoreGive(s_state_mutex);
+        if (!have) {
+            return;
         }
 
-        if (!telegram_send_text(chat_id_str, "ota: start (/update)")) {
-            ESP_LOGW(TAG, "telegram send failed");
+        char payload[96];
+        int len = snprintf(payload,
+                           sizeof(payload),
+                           "{\"name\":\"%s\",\"on\":%s,\"t_ms\":%lld}",
+                           s_indicators[ev.index].name,
+                           ev.on ? "true" : "false",
+                           (long long)(ev.t_us / 1000));
+        if (esp_mqtt_client_publish(s_mqtt, topic, payload, len, 1, 0) < 0) {
+            return;
         }
 
-        char ota_reply[96];
-        bool ota_ok = ota_update_from_github(ota_reply, sizeof(ota_reply));
-        if (!ota_ok && !telegram_send_text(chat_id_str, ota_reply)) {
-            ESP_LOGW(TAG, "telegram send failed");
-        }
-        if (ota_ok) {
-            if (!telegram_send_text(chat_id_str, ota_reply)) {
-                ESP_LOGW(TAG, "telegram send failed");
-            }
-            vTaskDelay(pdMS_TO_TICKS(1000));
-            esp_restart();
+        // The producer only drops from the head when full; skip ours only if it is still there.
+        xSemaphoreTake(s_state_mutex, portMAX_DELAY);
+        const indicator_event_t *head = &s_indicator_events[s_indicator_event_head];
+        if (s_indicator_event_count > 0 && head->index == ev.index && head->t_us == ev.t_us) {
+            s_indicator_event_head = (s_indicator_event_head + 1) % INDICATOR_EVENTS;
+            s_indicator_event_count--;
         }
+        xSemaphoreGive(s_state_mutex);
     }
-
-    cJSON_Delete(root);
-#else
-    (void)next_offset;
-#endif
 }
 
-static void handle_frame(const uint8_t *bits, int nbits)
+static void mqtt_service(void)
 {
-    if (nbits < 8 || (nbits % 8) != 0) {
-        ESP_LOGD(TAG, "drop frame bits=%d (not byte-aligned)", nbits);
+    if (!s_mqtt || !s_mqtt_connected) {
         return;
     }
+    mqtt_publish_indicator_events();
 
-    char raw[96];
-    uint8_t bytes[8] = {0};
-    char hex[64];
-    char decoded[16];
-    const char *status;
-
-    build_raw_string(bits, nbits, raw, sizeof(raw));
-    int nbytes = bits_to_bytes(bits, nbits, bytes, (int)(sizeof(bytes) / sizeof(bytes[0])));
-    build_hex_string(bytes, nbytes, hex, sizeof(hex));
-    decode_digits(bytes, nbytes, decoded, sizeof(decoded), &status);
-
-    if (nbytes == 1) {
-        int64_t now_us = esp_timer_get_time();
-        if (s_prev_single_valid && (now_us - s_prev_single_ts_us) <= CROSS_FRAME_PAIR_US) {
-            uint8_t pair[2] = {s_prev_single_byte, bytes[0]};
-            char pair_decoded[16] = {0};
-            const char *pair_status = "unknown";
-            decode_digits(pair, 2, pair_decoded, sizeof(pair_decoded), &pair_status);
-            if (decode_status_rank(pair_status) > decode_status_rank(status)) {
-                strncpy(decoded, pair_decoded, sizeof(decoded) - 1);
-                decoded[sizeof(decoded) - 1] = '\0';
-                status = pair_status;
-                snprintf(hex, sizeof(hex), "%02X %02X", pair[0], pair[1]);
-            }
+    int64_t now = esp_timer_get_time();
+    bool due = s_mqtt_ring_count >= CONFIG_SNIFFER_MQTT_BATCH_MAX ||
+               (s_mqtt_ring_count > 0 && (now - s_mqtt_oldest_us) >= (int64_t)CONFIG_SNIFFER_MQTT_BATCH_MS * 1000LL);
+    // After a reconnect the whole backlog is due at once.
+    while (due && s_mqtt_connected && s_mqtt_ring_count > 0) {
+        if (!mqtt_publish_batch()) {
+            ESP_LOGW(TAG, "MQTT publish failed, %d readings kept", s_mqtt_ring_count);
+            break;
         }
-        s_prev_single_valid = true;
-        s_prev_single_byte = bytes[0];
-        s_prev_single_ts_us = now_us;
-    } else {
-        s_prev_single_valid = false;
     }
 
+    if ((now - s_mqtt_last_metrics_us) >= (int64_t)CONFIG_SNIFFER_MQTT_METRICS_PERIOD_S * 1000000LL) {
+        s_mqtt_last_metrics_us = now;
+        mqtt_publish_status();
+    }
+}
+#endif
+
+#if CONFIG_SNIFFER_ENABLE_HTTPD
+static SemaphoreHandle_t s_stream_mutex;
+static httpd_req_t *s_stream_clients[CONFIG_SNIFFER_HTTPD_STREAM_CLIENTS];
+static char s_stream_event[STREAM_EVENT_MAX];
+
+static int build_stream_event(char *out, size_t out_len, uint32_t *seq)
+{
+    char decoded[16] = {0};
+    char decode_status[24] = {0};
+    int64_t frame_us = 0;
+    uint32_t ind_state = 0;
+    uint32_t ind_known = 0;
+
     xSemaphoreTake(s_state_mutex, portMAX_DELAY);
-    strncpy(s_last_raw, raw, sizeof(s_last_raw) - 1);
-    strncpy(s_last_hex, hex, sizeof(s_last_hex) - 1);
-    strncpy(s_last_decoded, decoded, sizeof(s_last_decoded) - 1);
-    strncpy(s_last_decode_status, status, sizeof(s_last_decode_status) - 1);
-    s_last_decode_ok = (strncmp(status, "ok(", 3) == 0);
-    s_last_frame_us = esp_timer_get_time();
+    strncpy(decoded, s_last_decoded, sizeof(decoded) - 1);
+    strncpy(decode_status, s_last_decode_status, sizeof(decode_status) - 1);
+    frame_us = s_last_frame_us;
+    ind_state = s_indicator_state;
+    ind_known = s_indicator_known;
+    *seq = s_state_seq;
     xSemaphoreGive(s_state_mutex);
 
-    ESP_LOGD(TAG, "frame bits=%d raw=%s bytes=[%s] decoded=%s status=%s", nbits, raw, hex, decoded, status);
+    char indicators[INDICATOR_JSON_MAX];
+    indicators_json(ind_state, ind_known, indicators, sizeof(indicators));
+    return snprintf(out,
+                    out_len,
+                    "id: %u\nevent: reading\ndata: {\"decoded\":\"%s\",\"status\":\"%s\",\"frame_us\":%lld,"
+                    "\"indicators\":%s}\n\n",
+                    (unsigned)*seq,
+                    decoded,
+                    decode_status,
+                    (long long)frame_us,
+                    indicators);
 }
 
-static gap_kind_t classify_gap_kind(int64_t dt_us)
+static esp_err_t http_state_handler(httpd_req_t *req)
 {
-    if (dt_us >= PAUSE_LONG_US) {
-        return GAP_LONG;
-    }
-    if (dt_us >= PAUSE_MID_US) {
-        return GAP_MID;
-    }
-    if (dt_us >= PAUSE_SHORT_US) {
-        return GAP_SHORT;
-    }
-    return GAP_NONE;
+    char raw[96] = {0};
+    char hex[64] = {0};
+    char decoded[16] = {0};
+    char decode_status[24] = {0};
+    int64_t frame_us = 0;
+    bool decode_ok = false;
+
+    xSemaphoreTake(s_state_mutex, portMAX_DELAY);
+    strncpy(raw, s_last_raw, sizeof(raw) - 1);
+    strncpy(hex, s_last_hex, sizeof(hex) - 1);
+    strncpy(decoded, s_last_decoded, sizeof(decoded) - 1);
+    strncpy(decode_status, s_last_decode_status, sizeof(decode_status) - 1);
+    frame_us = s_last_frame_us;
+    decode_ok = s_last_decode_ok;
+    uint32_t ind_state = s_indicator_state;
+    uint32_t ind_known = s_indicator_known;
+    xSemaphoreGive(s_state_mutex);
+
+    char reply[16];
+    build_decoded_reply(reply, sizeof(reply));
+    char indicators[INDICATOR_JSON_MAX];
+    indicators_json(ind_state, ind_known, indicators, sizeof(indicators));
+
+    char body[384 + INDICATOR_JSON_MAX];
+    snprintf(body,
+             sizeof(body),
+             "{\"value\":\"%s\",\"decoded\":\"%s\",\"status\":\"%s\",\"ok\":%s,\"raw\":\"%s\",\"hex\":\"%s\","
+             "\"frame_us\":%lld,\"age_ms\":%lld,\"indicators\":%s}",
+             reply,
+             decoded,
+             decode_status,
+             decode_ok ? "true" : "false",
+             raw,
+             hex,
+             (long long)frame_us,
+             frame_us > 0 ? (long long)((esp_timer_get_time() - frame_us) / 1000) : -1LL,
+             indicators);
+
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_send(req, body, HTTPD_RESP_USE_STRLEN);
 }
 
-static void cycle_reset(cycle_state_t *cycle)
+static esp_err_t http_metrics_handler(httpd_req_t *req)
 {
-    memset(cycle, 0, sizeof(*cycle));
+    // httpd runs handlers on its own single task, so a static body is safe.
+    static char body[METRICS_JSON_MAX];
+    build_metrics_json(body, sizeof(body));
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_send(req, body, HTTPD_RESP_USE_STRLEN);
 }
 
-static void cycle_add_subframe(cycle_state_t *cycle, const uint8_t *bytes, int nbytes, gap_kind_t gap_kind, int64_t ts_us)
+static esp_err_t http_history_handler(httpd_req_t *req)
 {
-    if (nbytes <= 0) {
-        return;
+    char query[48] = {0};
+    char range[16] = {0};
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        httpd_query_key_value(query, "range", range, sizeof(range));
     }
 
-    if (cycle->start_ts_us == 0) {
-        cycle->start_ts_us = ts_us;
+    const size_t body_len = 4096;
+    char *body = malloc(body_len);
+    if (!body) {
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "no memory");
     }
-    cycle->last_ts_us = ts_us;
-    cycle->subframes++;
+    build_history_json(range, body, body_len);
+    httpd_resp_set_type(req, "application/json");
+    esp_err_t err = httpd_resp_send(req, body, HTTPD_RESP_USE_STRLEN);
+    free(body);
+    return err;
+}
 
-    if (gap_kind == GAP_SHORT) {
-        cycle->gap_short_count++;
-    } else if (gap_kind == GAP_MID) {
-        cycle->gap_mid_count++;
-    } else if (gap_kind == GAP_LONG) {
-        cycle->gap_long_count++;
+#if CONFIG_SNIFFER_ENABLE_RLOG
+typedef struct {
+    httpd_req_t *req;
+    bool csv;
+    size_t used;
+    char buf[1024];
+} rlog_http_ctx_t;
+
+static bool rlog_http_emit(const rlog_record_t *rec, void *arg)
+{
+    rlog_http_ctx_t *ctx = (rlog_http_ctx_t *)arg;
+    if (sizeof(ctx->buf) - ctx->used < 64) {
+        if (httpd_resp_send_chunk(ctx->req, ctx->buf, (ssize_t)ctx->used) != ESP_OK) {
+            return false;
+        }
+        ctx->used = 0;
     }
 
-    for (int i = 0; i < nbytes && cycle->nbytes < MAX_CYCLE_BYTES; ++i) {
-        cycle->bytes[cycle->nbytes++] = bytes[i];
+    if (!ctx->csv) {
+        memcpy(ctx->buf + ctx->used, rec, sizeof(*rec));
+        ctx->used += sizeof(*rec);
+        return true;
+    }
+
+    char value[8] = "";
+    if (rec->flags & RLOG_FLAG_HAS_VALUE) {
+        snprintf(value, sizeof(value), "%d", (int)rec->value);
     }
+    ctx->used += (size_t)snprintf(ctx->buf + ctx->used,
+                                  sizeof(ctx->buf) - ctx->used,
+                                  "%u,%u,%u,%s,%s\n",
+                                  (unsigned)rec->seq,
+                                  (unsigned)rec->boot,
+                                  (unsigned)rec->uptime_ms,
+                                  value,
+                                  (rec->flags & RLOG_FLAG_CORRECTED) ? "fixed" : rank_tag(rec->rank));
+    return true;
 }
 
-static int cycle_compact_bytes(const cycle_state_t *cycle, uint8_t *out, int out_max)
+static esp_err_t http_log_handler(httpd_req_t *req)
 {
-    int n = 0;
-    bool has_prev = false;
-    uint8_t prev = 0;
+    char query[48] = {0};
+    char since[12] = {0};
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        httpd_query_key_value(query, "since", since, sizeof(since));
+    }
 
-    for (int i = 0; i < cycle->nbytes && n < out_max; ++i) {
-        uint8_t b = cycle->bytes[i];
-        if (!has_prev || b != prev) {
-            out[n++] = b;
-            prev = b;
-            has_prev = true;
-        }
+    rlog_http_ctx_t *ctx = calloc(1, sizeof(*ctx));
+    if (!ctx) {
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "no memory");
     }
-    return n;
+    ctx->req = req;
+    ctx->csv = (strncmp(req->uri, "/log.csv", 8) == 0);
+
+    if (ctx->csv) {
+        httpd_resp_set_type(req, "text/csv");
+        ctx->used = (size_t)snprintf(ctx->buf, sizeof(ctx->buf), "seq,boot,uptime_ms,value,status\n");
+    } else {
+        httpd_resp_set_type(req, "application/octet-stream");
+    }
+    rlog_export((uint32_t)strtoul(since, NULL, 10), rlog_http_emit, ctx);
+
+    esp_err_t err = ESP_OK;
+    if (ctx->used > 0) {
+        err = httpd_resp_send_chunk(req, ctx->buf, (ssize_t)ctx->used);
+    }
+    if (err == ESP_OK) {
+        err = httpd_resp_send_chunk(req, NULL, 0);
+    }
+    free(ctx);
+    return err;
 }
+#endif
 
-static void handle_cycle_decode(const cycle_state_t *cycle)
+#if CONFIG_SNIFFER_ENABLE_TRIGGER
+static void trigger_status_json(char *out, size_t out_len)
 {
-    if (!cycle || cycle->subframes == 0 || cycle->nbytes == 0) {
+    static const char *const states[] = {"off", "armed", "post", "held"};
+    xSemaphoreTake(s_state_mutex, portMAX_DELAY);
+    trigger_cond_t cond = s_trigger.pending;
+    bool ready = s_trigger.slot_ready;
+    trigger_slot_t slot = s_trigger.slot;
+    xSemaphoreGive(s_state_mutex);
+
+    // decode_task picks up a new condition or a released slot on its next frame.
+    trigger_state_t state = s_trigger.state;
+    if (s_trigger.pending_seq != s_trigger.cond_seq) {
+        state = cond.kind == TRIGGER_OFF ? TRIGGER_IDLE : TRIGGER_ARMED;
+    } else if (state == TRIGGER_HELD && !ready) {
+        state = TRIGGER_ARMED;
+    }
+    int len = snprintf(out,
+                       out_len,
+                       "{\"state\":\"%s\",\"cond\":\"%s\",\"pre_ms\":%u,\"post_ms\":%u,\"fired\":%u,\"captures\":%u,"
+                       "\"ring\":{\"bytes\":%u,\"cap\":%u},\"slot\":",
+                       states[state],
+                       cond.spec,
+                       (unsigned)cond.pre_ms,
+                       (unsigned)cond.post_ms,
+                       (unsigned)s_trigger.fired,
+                       (unsigned)s_trigger.captures,
+                       (unsigned)s_trigger.used,
+                       (unsigned)TRIGGER_RING_BYTES);
+    if (len <= 0 || (size_t)len >= out_len) {
         return;
     }
-
-    uint8_t compact[32] = {0};
-    int compact_n = cycle_compact_bytes(cycle, compact, (int)(sizeof(compact) / sizeof(compact[0])));
-    if (compact_n <= 0) {
+    if (!ready) {
+        snprintf(out + len, out_len - (size_t)len, "null}");
         return;
     }
+    snprintf(out + len,
+             out_len - (size_t)len,
+             "{\"cond\":\"%s\",\"frames\":%u,\"bytes\":%u,\"trigger_us\":%lld,\"pre_ms\":%lld,\"post_ms\":%lld,"
+             "\"truncated\":%s}}",
+             slot.spec,
+             (unsigned)slot.frames,
+             (unsigned)slot.bytes,
+             (long long)slot.trig_us,
+             (long long)((slot.trig_us - slot.first_us) / 1000),
+             (long long)((slot.last_us - slot.trig_us) / 1000),
+             slot.truncated ? "true" : "false");
+}
 
-    char compact_hex[128] = {0};
-    char decoded[16] = {0};
-    const char *status = "unknown";
-    build_hex_string(compact, compact_n, compact_hex, sizeof(compact_hex));
-    decode_digits(compact, compact_n, decoded, sizeof(decoded), &status);
+// GET /trigger shows the engine; with a condition (see trigger_parse) it
+// re-arms, ?off=1 disarms and ?clear=1 drops the held capture.
+static esp_err_t http_trigger_handler(httpd_req_t *req)
+{
+    char query[96] = {0};
+    char flag[4] = {0};
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        trigger_cond_t cond;
+        if (httpd_query_key_value(query, "clear", flag, sizeof(flag)) == ESP_OK) {
+            xSemaphoreTake(s_state_mutex, portMAX_DELAY);
+            s_trigger.slot_ready = false;
+            xSemaphoreGive(s_state_mutex);
+        } else if (httpd_query_key_value(query, "off", flag, sizeof(flag)) == ESP_OK) {
+            trigger_parse("", &cond);
+            trigger_arm(&cond);
+        } else if (trigger_parse(query, &cond)) {
+            trigger_arm(&cond);
+            ESP_LOGI(TAG, "trigger: armed on %s", cond.spec);
+        } else {
+            return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "bad trigger condition");
+        }
+    }
 
-    ESP_LOGD(TAG,
-             "cycle subframes=%d bytes=%d gaps[s/m/l]=%d/%d/%d compact=[%s] decoded=%s status=%s",
-             cycle->subframes,
-             cycle->nbytes,
-             cycle->gap_short_count,
-             cycle->gap_mid_count,
-             cycle->gap_long_count,
-             compact_hex,
-             decoded,
-             status);
+    char body[384];
+    trigger_status_json(body, sizeof(body));
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_send(req, body, HTTPD_RESP_USE_STRLEN);
 }
 
-static int64_t effective_gap_us_from_timing(const timing_stats_t *ts)
+// GET /trigger.cap: the held capture in the capture stream format. The chunk
+// that starts at the trigger frame carries CAPTURE_FLAG_TRIGGER. The slot
+// buffer is only reused after this task releases it, so it is read unlocked.
+static esp_err_t http_trigger_cap_handler(httpd_req_t *req)
 {
-    int64_t gap_us = FRAME_GAP_US;
-    if (ts->clk_period_ema_us > 0) {
-        int64_t auto_gap_us = ts->clk_period_ema_us * AUTO_GAP_MULTIPLIER;
-        if (auto_gap_us < AUTO_GAP_MIN_US) {
-            auto_gap_us = AUTO_GAP_MIN_US;
+    xSemaphoreTake(s_state_mutex, portMAX_DELAY);
+    bool ready = s_trigger.slot_ready;
+    trigger_slot_t slot = s_trigger.slot;
+    xSemaphoreGive(s_state_mutex);
+    if (!ready) {
+        return httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "no capture");
+    }
+
+    uint8_t *chunk = malloc(CAPTURE_CHUNK_MAX);
+    if (!chunk) {
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "no memory");
+    }
+    httpd_resp_set_type(req, "application/octet-stream");
+    httpd_resp_set_hdr(req, "Content-Disposition", "attachment; filename=\"trigger.cap\"");
+
+    const uint8_t *buf = s_trigger_buf[slot.buf];
+    uint32_t seq = 0;
+    size_t used = 0;
+    esp_err_t err = ESP_OK;
+    for (uint32_t done = 0; done < slot.bytes && err == ESP_OK;) {
+        uint32_t pos = (slot.start + done) % TRIGGER_RING_BYTES;
+        uint16_t len = 0;
+        int64_t ts_us = 0;
+        trigger_rec_header(buf, pos, &len, &ts_us);
+        size_t body = len - TRIGGER_REC_HDR;
+        bool trig = (pos == slot.trig_pos);
+        if (used > 0 && (trig || used + body > CAPTURE_CHUNK_MAX)) {
+            capture_put_le(chunk + 16, used - CAPTURE_HDR_BYTES, 2);
+            err = httpd_resp_send_chunk(req, (const char *)chunk, (ssize_t)used);
+            used = 0;
         }
-        if (auto_gap_us > gap_us) {
-            gap_us = auto_gap_us;
+        trigger_ring_read(buf, (pos + TRIGGER_REC_HDR) % TRIGGER_RING_BYTES, chunk + (used ? used : CAPTURE_HDR_BYTES), body);
+        if (used == 0) {
+            // Base is the edge before this frame: its tag and nbits fit in two
+            // bytes, then comes the first delta.
+            uint32_t dt0 = 0;
+            const uint8_t *p = chunk + CAPTURE_HDR_BYTES + 2;
+            for (int shift = 0; shift < 35; shift += 7) {
+                dt0 |= (uint32_t)(*p & 0x7F) << shift;
+                if (!(*p++ & 0x80)) {
+                    break;
+                }
+            }
+            capture_put_header(chunk, trig ? CAPTURE_FLAG_TRIGGER : 0, seq++, ts_us - dt0, 0);
+            used = CAPTURE_HDR_BYTES;
         }
+        used += body;
+        done += len;
     }
-    return gap_us;
+    if (err == ESP_OK && used > 0) {
+        capture_put_le(chunk + 16, used - CAPTURE_HDR_BYTES, 2);
+        err = httpd_resp_send_chunk(req, (const char *)chunk, (ssize_t)used);
+    }
+    if (err == ESP_OK) {
+        err = httpd_resp_send_chunk(req, NULL, 0);
+    }
+    free(chunk);
+    return err;
 }
+#endif
 
-static void update_timing_stats(timing_stats_t *ts, int64_t dt_us, int64_t used_gap_us)
+// Streams are parked as async requests and fed by stream_task, so the
+// httpd task stays free for other clients.
+static esp_err_t http_stream_handler(httpd_req_t *req)
 {
-    if (dt_us <= 0) {
-        return;
+    xSemaphoreTake(s_stream_mutex, portMAX_DELAY);
+    int slot = -1;
+    for (int i = 0; i < CONFIG_SNIFFER_HTTPD_STREAM_CLIENTS; ++i) {
+        if (!s_stream_clients[i]) {
+            slot = i;
+            break;
+        }
     }
+    xSemaphoreGive(s_stream_mutex);
 
-    ts->dt_count++;
-    ts->dt_sum_us += (uint64_t)dt_us;
-
-    if (ts->dt_min_us == 0 || dt_us < ts->dt_min_us) {
-        ts->dt_min_us = dt_us;
+    if (slot < 0) {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        return httpd_resp_send(req, "too many streams", HTTPD_RESP_USE_STRLEN);
     }
-    if (dt_us > ts->dt_max_us) {
-        ts->dt_max_us = dt_us;
+
+    char event[STREAM_EVENT_MAX];
+    uint32_t seq = 0;
+    int len = build_stream_event(event, sizeof(event), &seq);
+    httpd_resp_set_type(req, "text/event-stream");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    if (httpd_resp_send_chunk(req, event, len) != ESP_OK) {
+        return ESP_FAIL;
     }
 
-    if (dt_us <= used_gap_us) {
-        if (ts->clk_period_ema_us == 0) {
-            ts->clk_period_ema_us = dt_us;
-        } else {
-            ts->clk_period_ema_us = ((ts->clk_period_ema_us * 15) + dt_us) / 16;
-        }
-    } else {
-        ts->long_gap_count++;
-        if (dt_us > ts->long_gap_max_us) {
-            ts->long_gap_max_us = dt_us;
-        }
-        ESP_LOGD(TAG, "gap candidate dt=%lldus (boundary, current_gap=%lldus)", (long long)dt_us, (long long)used_gap_us);
+    httpd_req_t *async_req = NULL;
+    if (httpd_req_async_handler_begin(req, &async_req) != ESP_OK) {
+        return ESP_FAIL;
     }
 
-    int64_t now_us = esp_timer_get_time();
-    if (ts->last_log_ts_us == 0) {
-        ts->last_log_ts_us = now_us;
-        return;
+    xSemaphoreTake(s_stream_mutex, portMAX_DELAY);
+    if (s_stream_clients[slot]) {
+        slot = -1;
+    } else {
+        s_stream_clients[slot] = async_req;
     }
+    xSemaphoreGive(s_stream_mutex);
 
-    if ((now_us - ts->last_log_ts_us) >= TIMING_LOG_PERIOD_US) {
-        uint64_t avg = ts->dt_count ? (ts->dt_sum_us / ts->dt_count) : 0;
-        ESP_LOGD(TAG,
-                 "timing dt_us min=%lld avg=%llu max=%lld ema=%lld gap=%lld long_gaps=%u long_max=%lld",
-                 (long long)ts->dt_min_us,
-                 (unsigned long long)avg,
-                 (long long)ts->dt_max_us,
-                 (long long)ts->clk_period_ema_us,
-                 (long long)effective_gap_us_from_timing(ts),
-                 ts->long_gap_count,
-                 (long long)ts->long_gap_max_us);
-        ts->dt_count = 0;
-        ts->dt_sum_us = 0;
-        ts->dt_min_us = 0;
-        ts->dt_max_us = 0;
-        ts->long_gap_count = 0;
-        ts->long_gap_max_us = 0;
-        ts->last_log_ts_us = now_us;
+    if (slot < 0) {
+        httpd_req_async_handler_complete(async_req);
+    } else {
+        ESP_LOGI(TAG, "stream client %d connected", slot);
     }
+    return ESP_OK;
 }
 
-static void sniffer_task(void *arg)
+static void stream_task(void *arg)
 {
     (void)arg;
-    bit_event_t ev;
-    uint8_t bits[MAX_FRAME_BITS] = {0};
-    int nbits = 0;
-    int64_t last_ts = 0;
-    timing_stats_t t = {0};
-    cycle_state_t cycle = {0};
+    uint32_t sent_seq = 0;
 
     while (1) {
-        if (xQueueReceive(s_bit_queue, &ev, pdMS_TO_TICKS(1000)) == pdTRUE) {
-            int64_t gap_us = effective_gap_us_from_timing(&t);
-            gap_kind_t gap_kind = GAP_NONE;
-            int64_t dt_us = 0;
-            if (last_ts > 0) {
-                dt_us = ev.ts_us - last_ts;
-                update_timing_stats(&t, dt_us, gap_us);
-                gap_us = effective_gap_us_from_timing(&t);
-                gap_kind = classify_gap_kind(dt_us);
-            }
-
-            if (nbits > 0 && (ev.ts_us - last_ts) > gap_us) {
-                handle_frame(bits, nbits);
-                if ((nbits % 8) == 0) {
-                    uint8_t frame_bytes[8] = {0};
-                    int nbytes = bits_to_bytes(bits, nbits, frame_bytes, (int)(sizeof(frame_bytes) / sizeof(frame_bytes[0])));
-                    cycle_add_subframe(&cycle, frame_bytes, nbytes, gap_kind, last_ts);
-                }
-
-                if (gap_kind == GAP_LONG) {
-                    handle_cycle_decode(&cycle);
-                    cycle_reset(&cycle);
-                }
-                nbits = 0;
-            }
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(STREAM_KEEPALIVE_MS));
 
-            if (nbits < MAX_FRAME_BITS) {
-                bits[nbits++] = ev.bit;
-            } else {
-                ESP_LOGW(TAG, "frame overflow, force flush bits=%d", nbits);
-                handle_frame(bits, nbits);
-                if ((nbits % 8) == 0) {
-                    uint8_t frame_bytes[8] = {0};
-                    int nbytes = bits_to_bytes(bits, nbits, frame_bytes, (int)(sizeof(frame_bytes) / sizeof(frame_bytes[0])));
-                    cycle_add_subframe(&cycle, frame_bytes, nbytes, GAP_NONE, last_ts);
-                }
-                nbits = 0;
-            }
-            last_ts = ev.ts_us;
-        } else if (nbits > 0) {
-            int64_t gap_us = effective_gap_us_from_timing(&t);
-            int64_t idle_us = esp_timer_get_time() - last_ts;
-            if (idle_us > gap_us) {
-                handle_frame(bits, nbits);
-                if ((nbits % 8) == 0) {
-                    uint8_t frame_bytes[8] = {0};
-                    int nbytes = bits_to_bytes(bits, nbits, frame_bytes, (int)(sizeof(frame_bytes) / sizeof(frame_bytes[0])));
-                    cycle_add_subframe(&cycle, frame_bytes, nbytes, GAP_NONE, last_ts);
-                }
-                nbits = 0;
+        uint32_t seq = 0;
+        int len = build_stream_event(s_stream_event, sizeof(s_stream_event), &seq);
+        if (seq == sent_seq) {
+            len = snprintf(s_stream_event, sizeof(s_stream_event), ": keepalive\n\n");
+        }
+        sent_seq = seq;
+
+        // One formatted event is written to every client; a slow client only
+        // delays this task, never the pipeline stages.
+        xSemaphoreTake(s_stream_mutex, portMAX_DELAY);
+        for (int i = 0; i < CONFIG_SNIFFER_HTTPD_STREAM_CLIENTS; ++i) {
+            httpd_req_t *req = s_stream_clients[i];
+            if (!req) {
+                continue;
             }
-            if (idle_us > PAUSE_LONG_US) {
-                handle_cycle_decode(&cycle);
-                cycle_reset(&cycle);
+            if (httpd_resp_send_chunk(req, s_stream_event, len) != ESP_OK) {
+                ESP_LOGI(TAG, "stream client %d gone", i);
+                httpd_sess_trigger_close(req->handle, httpd_req_to_sockfd(req));
+                httpd_req_async_handler_complete(req);
+                s_stream_clients[i] = NULL;
             }
         }
+        xSemaphoreGive(s_stream_mutex);
     }
 }
 
-static void IRAM_ATTR clk_isr_handler(void *arg)
+static void http_server_start(void)
 {
-    (void)arg;
-    bit_event_t ev;
-    ev.bit = (uint8_t)gpio_level_fast((gpio_num_t)DATA_GPIO);
-    ev.ts_us = esp_timer_get_time();
-
-    BaseType_t hp_task_woken = pdFALSE;
-    xQueueSendFromISR(s_bit_queue, &ev, &hp_task_woken);
-    if (hp_task_woken) {
-        portYIELD_FROM_ISR();
+    s_stream_mutex = xSemaphoreCreateMutex();
+    if (!s_stream_mutex) {
+        ESP_LOGE(TAG, "stream mutex allocation failed");
+        return;
     }
-}
 
-static bool ip4_addr_is_zero(const esp_ip4_addr_t *addr)
-{
-    return addr && (addr->addr == 0);
-}
+    httpd_config_t cfg = HTTPD_DEFAULT_CONFIG();
+    cfg.server_port = CONFIG_SNIFFER_HTTPD_PORT;
+    cfg.max_open_sockets = CONFIG_SNIFFER_HTTPD_STREAM_CLIENTS + 3;
+    cfg.lru_purge_enable = false;
+    cfg.send_wait_timeout = 1;
+    cfg.max_uri_handlers = 10;
 
-static void log_dns_servers(esp_netif_t *netif)
-{
-    if (!netif) {
+    httpd_handle_t server = NULL;
+    esp_err_t err = httpd_start(&server, &cfg);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "httpd_start failed: %s", esp_err_to_name(err));
         return;
     }
 
-    esp_netif_dns_info_t dns = {0};
-    char ipbuf[INET_ADDRSTRLEN] = {0};
-
-    if (esp_netif_get_dns_info(netif, ESP_NETIF_DNS_MAIN, &dns) == ESP_OK) {
-        esp_ip4addr_ntoa(&dns.ip.u_addr.ip4, ipbuf, sizeof(ipbuf));
-        ESP_LOGI(TAG, "dns main=%s", ipbuf);
+    const httpd_uri_t uris[] = {
+        {.uri = "/state", .method = HTTP_GET, .handler = http_state_handler},
+        {.uri = "/metrics", .method = HTTP_GET, .handler = http_metrics_handler},
+        {.uri = "/stream", .method = HTTP_GET, .handler = http_stream_handler},
+        {.uri = "/history", .method = HTTP_GET, .handler = http_history_handler},
+#if CONFIG_SNIFFER_ENABLE_RLOG
+        {.uri = "/log.bin", .method = HTTP_GET, .handler = http_log_handler},
+        {.uri = "/log.csv", .method = HTTP_GET, .handler = http_log_handler},
+#endif
+#if CONFIG_SNIFFER_ENABLE_TRIGGER
+        {.uri = "/trigger", .method = HTTP_GET, .handler = http_trigger_handler},
+        {.uri = "/trigger.cap", .method = HTTP_GET, .handler = http_trigger_cap_handler},
+#endif
+    };
+    for (size_t i = 0; i < sizeof(uris) / sizeof(uris[0]); ++i) {
+        httpd_register_uri_handler(server, &uris[i]);
     }
-    if (esp_netif_get_dns_info(netif, ESP_NETIF_DNS_BACKUP, &dns) == ESP_OK) {
-        esp_ip4addr_ntoa(&dns.ip.u_addr.ip4, ipbuf, sizeof(ipbuf));
-        ESP_LOGI(TAG, "dns backup=%s", ipbuf);
+
+    if (xTaskCreate(stream_task, "stream_task", 3072, NULL, 3, &s_stream_task) != pdPASS) {
+        ESP_LOGE(TAG, "stream task allocation failed");
+        s_stream_task = NULL;
     }
+    ESP_LOGI(TAG, "HTTP server on port %d", CONFIG_SNIFFER_HTTPD_PORT);
 }
+#endif
 
-static void ensure_dns_servers(esp_netif_t *netif)
+#if CONFIG_SNIFFER_ENABLE_TELEMETRY
+// Alerts fire once when a threshold is crossed and re-arm after it clears.
+static void telemetry_alert(bool firing, bool *armed, const char *text)
 {
-    if (!netif) {
+    if (!firing) {
+        *armed = true;
         return;
     }
-
-    esp_netif_dns_info_t dns_main = {0};
-    if (esp_netif_get_dns_info(netif, ESP_NETIF_DNS_MAIN, &dns_main) != ESP_OK) {
+    if (!*armed) {
         return;
     }
-
-    if (!ip4_addr_is_zero(&dns_main.ip.u_addr.ip4)) {
-        return;
+    *armed = false;
+    s_telemetry.alerts++;
+    ESP_LOGW(TAG, "%s", text);
+#if CONFIG_SNIFFER_ENABLE_MQTT
+    if (s_mqtt && s_mqtt_connected) {
+        char topic[MQTT_TOPIC_MAX];
+        mqtt_topic(topic, sizeof(topic), "alert");
+        esp_mqtt_client_publish(s_mqtt, topic, text, (int)strlen(text), 1, 0);
     }
-
-    ESP_LOGW(TAG, "DNS main server is empty, applying fallback DNS");
-
-    esp_netif_dns_info_t dns_fallback = {
-        .ip.type = ESP_IPADDR_TYPE_V4,
-    };
-
-    IP4_ADDR(&dns_fallback.ip.u_addr.ip4, 1, 1, 1, 1);
-    ESP_ERROR_CHECK_WITHOUT_ABORT(esp_netif_set_dns_info(netif, ESP_NETIF_DNS_MAIN, &dns_fallback));
-
-    IP4_ADDR(&dns_fallback.ip.u_addr.ip4, 8, 8, 8, 8);
-    ESP_ERROR_CHECK_WITHOUT_ABORT(esp_netif_set_dns_info(netif, ESP_NETIF_DNS_BACKUP, &dns_fallback));
+#endif
+#if CONFIG_SNIFFER_ENABLE_TELEGRAM
+    bool online = s_wifi_events && (xEventGroupGetBits(s_wifi_events) & WIFI_CONNECTED_BIT) != 0;
+    if (strlen(CONFIG_SNIFFER_TELEGRAM_CHAT_ID) > 0 && online) {
+        telegram_send_text(CONFIG_SNIFFER_TELEGRAM_CHAT_ID, text);
+    }
+#endif
 }
 
-static bool wait_dns_ready(uint32_t timeout_ms)
+static void telemetry_task(void *arg)
 {
-    const TickType_t delay = pdMS_TO_TICKS(250);
-    uint32_t elapsed = 0;
-    while (elapsed <= timeout_ms) {
-        struct addrinfo hints = {
-            .ai_family = AF_INET,
-            .ai_socktype = SOCK_STREAM,
-        };
-        struct addrinfo *res = NULL;
-        int err = getaddrinfo("api.telegram.org", "443", &hints, &res);
-        if (err == 0 && res) {
-            freeaddrinfo(res);
-            return true;
-        }
+    (void)arg;
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY
+    // Sized from the live task count; uxTaskGetSystemState() returns nothing
+    // at all when the array is too small.
+    static TaskStatus_t *status;
+    static telemetry_prev_t *prev;
+    static UBaseType_t cap;
+    static uint32_t prev_total;
+#endif
+    bool heap_armed = true;
+    bool cpu_armed = true;
 
-        if (res) {
-            freeaddrinfo(res);
+    while (1) {
+        telemetry_t snap = {0};
+        snap.internal_free = (uint32_t)heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+        snap.psram_free = (uint32_t)heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+        snap.largest = (uint32_t)heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+
+        char alert[96];
+        snprintf(alert,
+                 sizeof(alert),
+                 "alert: largest free block %u B < %d B",
+                 (unsigned)snap.largest,
+                 CONFIG_SNIFFER_ALERT_HEAP_LARGEST_B);
+        telemetry_alert(snap.largest < CONFIG_SNIFFER_ALERT_HEAP_LARGEST_B, &heap_armed, alert);
+
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY
+        UBaseType_t want = uxTaskGetNumberOfTasks() + TELEMETRY_TASK_HEADROOM;
+        if (want > cap) {
+            TaskStatus_t *grown_status = realloc(status, want * sizeof(*status));
+            telemetry_prev_t *grown_prev = realloc(prev, want * sizeof(*prev));
+            if (grown_status) {
+                status = grown_status;
+            }
+            if (grown_prev) {
+                memset(grown_prev + cap, 0, (want - cap) * sizeof(*prev));
+                prev = grown_prev;
+            }
+            if (grown_status && grown_prev) {
+                cap = want;
+            } else {
+                ESP_LOGW(TAG, "telemetry: no memory for %u task slots", (unsigned)want);
+            }
+        }
+        uint32_t total = 0;
+        UBaseType_t n = cap > 0 ? uxTaskGetSystemState(status, cap, &total) : 0;
+        if (n == 0 && cap > 0) {
+            ESP_LOGW(TAG, "telemetry: more than %u tasks, skipping this sample", (unsigned)cap);
+        }
+        uint32_t total_delta = (total - prev_total) * portNUM_PROCESSORS;
+        int busiest_pct = 0;
+        const char *busiest = "";
+        for (UBaseType_t i = 0; i < n; i++) {
+            const TaskStatus_t *st = &status[i];
+            telemetry_task_t spill;
+            telemetry_task_t *t = &spill;
+            if (snap.ntasks < TELEMETRY_MAX_TASKS) {
+                t = &snap.tasks[snap.ntasks++];
+            } else {
+                snap.more++;
+            }
+            memset(t, 0, sizeof(*t));
+            strncpy(t->name, st->pcTaskName, sizeof(t->name) - 1);
+            // ESP-IDF reports the high-water mark in bytes.
+            t->stack_free = st->usStackHighWaterMark;
+            t->cpu_pct = -1;
+
+            int slot = -1;
+            for (UBaseType_t j = 0; j < cap; j++) {
+                if (prev[j].handle == st->xHandle) {
+                    slot = j;
+                    break;
+                }
+                if (slot < 0 && prev[j].handle == NULL) {
+                    slot = j;
+                }
+            }
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+            if (slot >= 0 && prev[slot].handle == st->xHandle && prev_total != 0 && total_delta > 0) {
+                t->cpu_pct = (int16_t)(((uint64_t)(st->ulRunTimeCounter - prev[slot].runtime) * 100U) / total_delta);
+                if (strncmp(t->name, "IDLE", 4) != 0 && t->cpu_pct > busiest_pct) {
+                    busiest_pct = t->cpu_pct;
+                    busiest = t->name;
+                }
+            }
+#endif
+            if (slot >= 0) {
+                if (prev[slot].handle != st->xHandle) {
+                    prev[slot].armed = true;
+                }
+                prev[slot].handle = st->xHandle;
+                prev[slot].runtime = st->ulRunTimeCounter;
+                snprintf(alert,
+                         sizeof(alert),
+                         "alert: %s stack free %u B < %d B",
+                         t->name,
+                         (unsigned)t->stack_free,
+                         CONFIG_SNIFFER_ALERT_STACK_FREE_B);
+                telemetry_alert(t->stack_free < CONFIG_SNIFFER_ALERT_STACK_FREE_B, &prev[slot].armed, alert);
+            }
+        }
+        // Forget tasks that have exited so their slots can be reused.
+        for (UBaseType_t j = 0; j < cap; j++) {
+            bool alive = false;
+            for (UBaseType_t i = 0; i < n && !alive; i++) {
+                alive = (status[i].xHandle == prev[j].handle);
+            }
+            if (!alive) {
+                prev[j].handle = NULL;
+            }
         }
+        prev_total = total;
 
-        vTaskDelay(delay);
-        elapsed += 250;
-    }
-    return false;
-}
+        snprintf(alert, sizeof(alert), "alert: %s cpu %d%% > %d%%", busiest, busiest_pct, CONFIG_SNIFFER_ALERT_CPU_PCT);
+        telemetry_alert(busiest_pct > CONFIG_SNIFFER_ALERT_CPU_PCT, &cpu_armed, alert);
+#else
+        (void)cpu_armed;
+#endif
 
-static void wifi_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
-{
-    (void)arg;
+        snap.sampled_us = esp_timer_get_time();
+        xSemaphoreTake(s_state_mutex, portMAX_DELAY);
+        snap.alerts = s_telemetry.alerts;
+        s_telemetry = snap;
+        xSemaphoreGive(s_state_mutex);
 
-    if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
-        esp_wifi_connect();
-    } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
-        xEventGroupClearBits(s_wifi_events, WIFI_CONNECTED_BIT);
-        esp_wifi_connect();
-        ESP_LOGW(TAG, "WiFi disconnected, reconnecting");
-    } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
-        ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
-        ESP_LOGI(TAG,
-                 "sta ip: " IPSTR ", mask: " IPSTR ", gw: " IPSTR,
-                 IP2STR(&event->ip_info.ip),
-                 IP2STR(&event->ip_info.netmask),
-                 IP2STR(&event->ip_info.gw));
-        ensure_dns_servers(s_sta_netif);
-        log_dns_servers(s_sta_netif);
-        xEventGroupSetBits(s_wifi_events, WIFI_CONNECTED_BIT);
-        ESP_LOGI(TAG, "WiFi connected");
+        vTaskDelay(pdMS_TO_TICKS(CONFIG_SNIFFER_TELEMETRY_PERIOD_S * 1000));
     }
 }
+#endif
 
-static void wifi_init_sta(void)
+static void push_task(void *arg)
 {
-    s_wifi_events = xEventGroupCreate();
-
-    ESP_ERROR_CHECK(esp_netif_init());
-    ESP_ERROR_CHECK(esp_event_loop_create_default());
-    s_sta_netif = esp_netif_create_default_wifi_sta();
-    ESP_ERROR_CHECK(s_sta_netif ? ESP_OK : ESP_FAIL);
-
-    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
-    ESP_ERROR_CHECK(esp_wifi_init(&cfg));
-
-    ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &wifi_event_handler, NULL));
-    ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &wifi_event_handler, NULL));
-
-    wifi_config_t wifi_config = {0};
-    strncpy((char *)wifi_config.sta.ssid, WIFI_SSID, sizeof(wifi_config.sta.ssid) - 1);
-    strncpy((char *)wifi_config.sta.password, WIFI_PASS, sizeof(wifi_config.sta.password) - 1);
-    wifi_config.sta.threshold.authmode = WIFI_AUTH_WPA2_PSK;
-
-    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
-    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
-    ESP_ERROR_CHECK(esp_wifi_start());
+    (void)arg;
+    push_msg_t msg;
+#if CONFIG_SNIFFER_ENABLE_MQTT
+    const TickType_t wait = pdMS_TO_TICKS(CONFIG_SNIFFER_MQTT_BATCH_MS / 4 + 1);
+#elif CONFIG_SNIFFER_ENABLE_RLOG
+    const TickType_t wait = pdMS_TO_TICKS(10000);
+#else
+    const TickType_t wait = portMAX_DELAY;
+#endif
 
-    xEventGroupWaitBits(s_wifi_events, WIFI_CONNECTED_BIT, pdFALSE, pdTRUE, pdMS_TO_TICKS(15000));
+    while (1) {
+        bool got = (xQueueReceive(s_push_queue, &msg, wait) == pdTRUE);
+        if (got) {
+            ESP_LOGI(TAG, "push value=%s status=%s", msg.decoded, msg.status);
+#if CONFIG_SNIFFER_ENABLE_MQTT
+            mqtt_enqueue_reading(&msg);
+#endif
+#if CONFIG_SNIFFER_ENABLE_RLOG
+            rlog_append(&msg);
+#endif
+#if CONFIG_SNIFFER_ENABLE_PUSH
+            // Telegram is not buffered: a reading produced while offline is dropped here.
+            bool online = s_wifi_events && (xEventGroupGetBits(s_wifi_events) & WIFI_CONNECTED_BIT) != 0;
+            if (strlen(CONFIG_SNIFFER_TELEGRAM_CHAT_ID) > 0 && online &&
+                !telegram_send_text(CONFIG_SNIFFER_TELEGRAM_CHAT_ID, msg.decoded)) {
+                ESP_LOGW(TAG, "telegram push failed");
+            }
+#endif
+        }
+#if CONFIG_SNIFFER_ENABLE_MQTT
+        mqtt_service();
+#endif
+#if CONFIG_SNIFFER_ENABLE_RLOG
+        rlog_service();
+#endif
+    }
 }
 
 static void net_task(void *arg)
@@ -1163,7 +6775,7 @@ static void net_task(void *arg)
         return;
     }
 
-#if CONFIG_SNIFFER_ENABLE_TELEGRAM
+#if CONFIG_SNIFFER_ENABLE_TELEGRAM && !CONFIG_SNIFFER_ENABLE_MQTT && !CONFIG_SNIFFER_ENABLE_HTTPD
     if (strlen(CONFIG_SNIFFER_TELEGRAM_BOT_TOKEN) == 0) {
         ESP_LOGW(TAG, "Telegram token is empty; telegram bot disabled");
         vTaskDelete(NULL);
@@ -1174,7 +6786,37 @@ static void net_task(void *arg)
     wifi_init_sta();
     if (!wait_dns_ready(7000)) {
         ESP_LOGW(TAG, "DNS is not ready yet; Telegram requests may fail until DNS appears");
+    } else {
+        s_boot.dns_us = esp_timer_get_time();
+    }
+#if CONFIG_SNIFFER_ENABLE_OTA
+    // Prewarm the OTA hosts so /update does not start with a lookup.
+    char ota_host[DNS_HOST_MAX];
+    const char *rest = NULL;
+    uint32_t ota_addr = 0;
+    if (url_split_host(OTA_MANIFEST_URL, ota_host, sizeof(ota_host), &rest)) {
+        dns_cache_lookup(ota_host, &ota_addr);
+    }
+#endif
+    if (xTaskCreate(dns_refresh_task, "dns_task", 3072, NULL, 2, &s_dns_task) != pdPASS) {
+        ESP_LOGW(TAG, "DNS refresh task allocation failed");
+    }
+
+#if CONFIG_SNIFFER_ENABLE_MQTT
+    mqtt_start();
+#endif
+#if CONFIG_SNIFFER_ENABLE_HTTPD
+    http_server_start();
+#endif
+#if CONFIG_SNIFFER_ENABLE_PUSH
+    if (strlen(CONFIG_SNIFFER_TELEGRAM_CHAT_ID) == 0) {
+        ESP_LOGW(TAG, "Telegram chat id is empty; Telegram push disabled");
     }
+#endif
+
+#if CONFIG_SNIFFER_ENABLE_TELEGRAM
+    tg_cmd_init();
+#endif
 
     int64_t next_offset = telegram_load_next_offset();
     ESP_LOGI(TAG, "telegram next_offset=%lld", (long long)next_offset);
@@ -1184,7 +6826,20 @@ static void net_task(void *arg)
             continue;
         }
 
+        if (s_boot.first_poll_us == 0) {
+            s_boot.first_poll_us = esp_timer_get_time();
+            ESP_LOGI(TAG,
+                     "boot timing: wifi_start=%lld assoc=%lld ip=%lld dns=%lld first_poll=%lld ms (fast=%d static=%d)",
+                     (long long)(s_boot.wifi_start_us / 1000),
+                     (long long)(s_boot.assoc_us / 1000),
+                     (long long)(s_boot.got_ip_us / 1000),
+                     (long long)(s_boot.dns_us / 1000),
+                     (long long)(s_boot.first_poll_us / 1000),
+                     s_boot.fast_connect ? 1 : 0,
+                     s_boot.static_ip ? 1 : 0);
+        }
         telegram_poll_and_respond(&next_offset);
+        heap_track_sample();
     }
 }
 
@@ -1221,6 +6876,16 @@ void app_main(void)
         nvs_err = nvs_flash_init();
     }
     ESP_ERROR_CHECK(nvs_err);
+    glyph_table_init();
+    indicators_init();
+    net_guard_init();
+    dns_cache_init();
+
+    cJSON_Hooks json_hooks = {
+        .malloc_fn = json_arena_malloc,
+        .free_fn = json_arena_free,
+    };
+    cJSON_InitHooks(&json_hooks);
 
     ESP_LOGI(TAG, "sniffer start, clk=%d data=%d gap_us=%d", CLK_GPIO, DATA_GPIO, FRAME_GAP_US);
 
@@ -1236,7 +6901,31 @@ void app_main(void)
         return;
     }
 
+#if CONFIG_SNIFFER_ENABLE_RLOG
+    rlog_init();
+#endif
+#if PUSH_ENABLED
+    s_push_queue = xQueueCreate(PUSH_QUEUE_LEN, sizeof(push_msg_t));
+    if (!s_push_queue || xTaskCreate(push_task, "push_task", PUSH_TASK_STACK, NULL, 5, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "push task allocation failed");
+        s_push_queue = NULL;
+    }
+#endif
+
+#if CONFIG_SNIFFER_CAPTURE_STREAM
+    capture_init();
+#endif
+#if CONFIG_SNIFFER_ENABLE_TRIGGER
+    trigger_init();
+#endif
+
+#if CONFIG_SNIFFER_ENABLE_TELEMETRY
+    if (xTaskCreate(telemetry_task, "telemetry", TELEMETRY_TASK_STACK, NULL, 1, NULL) != pdPASS) {
+        ESP_LOGW(TAG, "telemetry task allocation failed");
+    }
+#endif
+
     sniffer_gpio_init();
-    xTaskCreate(sniffer_task, "sniffer_task", 4096, NULL, 8, NULL);
-    xTaskCreate(net_task, "net_task", 8192, NULL, 5, NULL);
+    pipeline_start();
+    xTaskCreate(net_task, "net_task", TELEGRAM_SEND_STACK, NULL, 5, NULL);
 }
@@ -87,7 +87,7 @@ if (-not (Test-Path -LiteralPath $releaseDir)) {
     throw "Release folder not found: $releaseDir. Run release-local.ps1 first."
 }
 
-$assets = Get-ChildItem -LiteralPath $releaseDir -File | Where-Object { $_.Name -match "\.bin$|^SHA256SUMS\.txt$" }
+$assets = Get-ChildItem -LiteralPath $releaseDir -File | Where-Object { $_.Name -match "\.bin$|^SHA256SUMS\.txt$|\.patch$|\.deflate$|^manifest\.json$" }
 if ($assets.Count -eq 0) {
     throw "No release assets found in $releaseDir"
 }
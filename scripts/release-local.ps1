@@ -47,6 +47,21 @@ function Get-EnvValueFromFile([string]$FilePath, [string]$Key) {
     return $null
 }
 
+function Get-AppDigest([string]$Path) {
+    # esptool appends the SHA-256 of the image as its last 32 bytes; the running
+    # app reports the same digest via esp_partition_get_sha256.
+    $bytes = [System.IO.File]::ReadAllBytes($Path)
+    return -join ($bytes[($bytes.Length - 32)..($bytes.Length - 1)] | ForEach-Object { $_.ToString("x2") })
+}
+
+function Get-PreviousReleaseDir([string]$FirmwareRoot, [string]$CurrentTag) {
+    $current = [version]($CurrentTag -replace "^v", "" -replace "[\-+].*$", "")
+    return Get-ChildItem -LiteralPath $FirmwareRoot -Directory |
+        Where-Object { $_.Name -match "^v[0-9]+(\.[0-9]+){1,3}$" -and [version]($_.Name -replace "^v", "") -lt $current } |
+        Sort-Object { [version]($_.Name -replace "^v", "") } |
+        Select-Object -Last 1
+}
+
 $repoRoot = Resolve-Path (Join-Path $PSScriptRoot "..")
 Set-Location $repoRoot
 
@@ -135,6 +150,62 @@ Invoke-Step "Generating checksums" {
     Copy-Item -LiteralPath $shaFile -Destination (Join-Path $latestDir "SHA256SUMS.txt") -Force
 }
 
+$appPath = Join-Path $releaseDir "sniffer_esp.bin"
+$patchPath = Join-Path $releaseDir "sniffer_esp.patch"
+$deflatePath = Join-Path $releaseDir "sniffer_esp.bin.deflate"
+$previousDir = Get-PreviousReleaseDir -FirmwareRoot (Join-Path $repoRoot "firmware") -CurrentTag $Tag
+
+Invoke-Step "Building delta patch" {
+    $latestPatch = Join-Path $latestDir "sniffer_esp.patch"
+    if (Test-Path -LiteralPath $latestPatch) {
+        Remove-Item -LiteralPath $latestPatch -Force
+    }
+    if (-not $previousDir) {
+        Write-Host "No previous release, full image only"
+        return
+    }
+    $previousApp = Join-Path $previousDir.FullName "sniffer_esp.bin"
+    python tools\ota_pack.py diff $previousApp $appPath -o $patchPath
+    if ($LASTEXITCODE -ne 0) {
+        throw "ota_pack.py diff failed"
+    }
+    $checkPath = Join-Path $env:TEMP "sniffer_esp.patched.bin"
+    python tools\ota_pack.py apply $previousApp $patchPath -o $checkPath
+    if ($LASTEXITCODE -ne 0) {
+        throw "ota_pack.py apply failed"
+    }
+    Remove-Item -LiteralPath $checkPath -Force
+    Copy-Item -LiteralPath $patchPath -Destination $latestPatch -Force
+}
+
+Invoke-Step "Compressing full image" {
+    python tools\ota_pack.py compress $appPath -o $deflatePath
+    if ($LASTEXITCODE -ne 0) {
+        throw "ota_pack.py compress failed"
+    }
+    python tools\ota_pack.py bench $deflatePath --rounds 1
+    Copy-Item -LiteralPath $deflatePath -Destination (Join-Path $latestDir "sniffer_esp.bin.deflate") -Force
+}
+
+Invoke-Step "Writing OTA manifest" {
+    # Read by the device before /update downloads anything (see ota_fetch_manifest).
+    $manifest = [ordered]@{
+        version      = ($Tag -replace "^v", "")
+        size         = (Get-Item -LiteralPath $appPath).Length
+        sha256       = (Get-FileHash -LiteralPath $appPath -Algorithm SHA256).Hash.ToLower()
+        app_sha256   = (Get-AppDigest -Path $appPath)
+        deflate_size = (Get-Item -LiteralPath $deflatePath).Length
+    }
+    if ($previousDir -and (Test-Path -LiteralPath $patchPath)) {
+        # The device only takes the patch when its running image is this base.
+        $manifest.patch_base = Get-AppDigest -Path (Join-Path $previousDir.FullName "sniffer_esp.bin")
+        $manifest.patch_size = (Get-Item -LiteralPath $patchPath).Length
+    }
+    $manifestPath = Join-Path $releaseDir "manifest.json"
+    $manifest | ConvertTo-Json -Compress | Set-Content -LiteralPath $manifestPath -Encoding ascii -NoNewline
+    Copy-Item -LiteralPath $manifestPath -Destination (Join-Path $latestDir "manifest.json") -Force
+}
+
 Invoke-Step "Committing artifacts and creating tag" {
     git add firmware
     git commit -m "Release ${Tag}: publish local firmware artifacts"
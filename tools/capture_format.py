@@ -0,0 +1,154 @@
+#!/usr/bin/env python3
+"""Reader for the sniffer raw capture stream (docs/capture-format.md).
+
+As a library:
+
+    from capture_format import read_frames
+    with open("bus.cap", "rb") as f:
+        for frame in read_frames(f):
+            print(frame.ts_us, frame.gap, frame.bits, frame.edges_us)
+
+As a tool, prints one line per frame (or per edge with --edges):
+
+    python tools/capture_format.py bus.cap --stats
+"""
+
+import argparse
+import struct
+import sys
+from collections import namedtuple
+
+MAGIC = 0x4353
+VERSION = 1
+REC_FRAME = 0x01
+FLAG_TRIGGER = 0x01
+GAP_TAGS = ["none", "short", "mid", "long"]
+
+HDR = struct.Struct("<HBBIQHH")
+
+Chunk = namedtuple("Chunk", "seq base_ts_us dropped payload flags", defaults=(0,))
+# ts_us: first edge; edges_us: absolute time of every edge; bits: 0/1 per edge;
+# trigger: the frame a trigger capture (/trigger.cap) fired on.
+Frame = namedtuple("Frame", "seq ts_us gap bits edges_us trigger", defaults=(False,))
+
+
+class FormatError(ValueError):
+    pass
+
+
+def read_chunks(f, stats=None):
+    """Yields Chunk tuples from a file-like object until EOF."""
+    while True:
+        hdr = f.read(HDR.size)
+        if not hdr:
+            return
+        if len(hdr) < HDR.size:
+            raise FormatError("truncated chunk header")
+        magic, version, flags, seq, base, length, dropped = HDR.unpack(hdr)
+        if magic != MAGIC:
+            raise FormatError("bad magic 0x%04X" % magic)
+        payload = f.read(length)
+        if len(payload) < length:
+            raise FormatError("truncated chunk payload")
+        if version != VERSION:
+            if stats is not None:
+                stats["skipped_chunks"] = stats.get("skipped_chunks", 0) + 1
+            continue
+        yield Chunk(seq, base, dropped, payload, flags)
+
+
+def _varint(buf, pos):
+    value = 0
+    shift = 0
+    while True:
+        if pos >= len(buf):
+            raise FormatError("truncated varint")
+        b = buf[pos]
+        pos += 1
+        value |= (b & 0x7F) << shift
+        if not b & 0x80:
+            return value, pos
+        shift += 7
+
+
+def parse_chunk(chunk):
+    """Yields Frame tuples from one chunk."""
+    buf = chunk.payload
+    pos = 0
+    ts = chunk.base_ts_us
+    trigger = bool(chunk.flags & FLAG_TRIGGER)
+    while pos < len(buf):
+        tag = buf[pos]
+        pos += 1
+        if tag & 0x0F != REC_FRAME:
+            return
+        nbits, pos = _varint(buf, pos)
+        edges = []
+        for _ in range(nbits):
+            dt, pos = _varint(buf, pos)
+            ts += dt
+            edges.append(ts)
+        nbytes = (nbits + 7) // 8
+        packed = buf[pos:pos + nbytes]
+        if len(packed) < nbytes:
+            raise FormatError("truncated frame bits")
+        pos += nbytes
+        bits = [(packed[i // 8] >> (7 - i % 8)) & 1 for i in range(nbits)]
+        yield Frame(chunk.seq, edges[0] if edges else ts, tag >> 4, bits, edges, trigger)
+        trigger = False
+
+
+def read_frames(f, stats=None):
+    """Yields every Frame in a capture file or stream, with optional counters."""
+    last_seq = None
+    for chunk in read_chunks(f, stats):
+        if stats is not None:
+            stats["chunks"] = stats.get("chunks", 0) + 1
+            stats["device_dropped"] = stats.get("device_dropped", 0) + chunk.dropped
+            if last_seq is not None and chunk.seq > last_seq + 1:
+                stats["lost_chunks"] = stats.get("lost_chunks", 0) + chunk.seq - last_seq - 1
+            if last_seq is not None and chunk.seq < last_seq:
+                stats["reboots"] = stats.get("reboots", 0) + 1
+        last_seq = chunk.seq
+        for frame in parse_chunk(chunk):
+            if stats is not None:
+                stats["frames"] = stats.get("frames", 0) + 1
+            yield frame
+
+
+def frame_hex(bits):
+    if len(bits) % 8:
+        return "".join(str(b) for b in bits)
+    return " ".join("%02X" % int("".join(str(b) for b in bits[i:i + 8]), 2) for i in range(0, len(bits), 8))
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("input", help="capture file from capture_recv.py or /trigger.cap ('-' for stdin)")
+    ap.add_argument("--edges", action="store_true", help="print every edge as 'ts_us bit'")
+    ap.add_argument("--stats", action="store_true", help="print a summary to stderr")
+    args = ap.parse_args()
+
+    f = sys.stdin.buffer if args.input == "-" else open(args.input, "rb")
+    stats = {}
+    try:
+        for fr in read_frames(f, stats):
+            if args.edges:
+                for ts, bit in zip(fr.edges_us, fr.bits):
+                    print("%d %d" % (ts, bit))
+            else:
+                print("%d %s bits=%d [%s]%s" % (fr.ts_us, GAP_TAGS[fr.gap & 3], len(fr.bits), frame_hex(fr.bits),
+                                                 " TRIGGER" if fr.trigger else ""))
+    except FormatError as e:
+        print("capture: %s" % e, file=sys.stderr)
+        return 1
+    finally:
+        if f is not sys.stdin.buffer:
+            f.close()
+    if args.stats:
+        print(" ".join("%s=%s" % kv for kv in sorted(stats.items())), file=sys.stderr)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,121 @@
+#!/usr/bin/env python3
+"""Collector for the sniffer raw capture stream.
+
+Set SNIFFER_CAPTURE_HOST to this machine and run, for UDP (default):
+
+    python tools/capture_recv.py --out bus.cap
+
+or, with SNIFFER_CAPTURE_TCP enabled on the device:
+
+    python tools/capture_recv.py --tcp --out bus.cap
+
+The file is the chunk stream as received (docs/capture-format.md); read it
+with tools/capture_format.py. Chunk loss in transit (seq gaps) and frames the
+device itself dropped are reported every --stats-s seconds.
+"""
+
+import argparse
+import socket
+import struct
+import sys
+import threading
+import time
+
+from capture_format import HDR, MAGIC
+
+
+class Sink:
+    def __init__(self, path):
+        self.f = open(path, "ab")
+        self.lock = threading.Lock()
+        self.counts = {"chunks": 0, "bytes": 0, "lost": 0, "dropped": 0, "bad": 0}
+        self.last_seq = {}
+
+    def chunk(self, peer, data):
+        if len(data) < HDR.size:
+            self.counts["bad"] += 1
+            return
+        magic, _version, _flags, seq, _base, length, dropped = HDR.unpack_from(data)
+        if magic != MAGIC or len(data) != HDR.size + length:
+            self.counts["bad"] += 1
+            return
+        with self.lock:
+            last = self.last_seq.get(peer)
+            if last is not None and seq > last + 1:
+                self.counts["lost"] += seq - last - 1
+            self.last_seq[peer] = seq
+            self.counts["chunks"] += 1
+            self.counts["bytes"] += len(data)
+            self.counts["dropped"] += dropped
+            self.f.write(data)
+            self.f.flush()
+
+
+def serve_udp(sink, port):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind(("", port))
+    while True:
+        data, peer = sock.recvfrom(2048)
+        sink.chunk(peer[0], data)
+
+
+def read_exact(conn, n):
+    buf = b""
+    while len(buf) < n:
+        part = conn.recv(n - len(buf))
+        if not part:
+            return None
+        buf += part
+    return buf
+
+
+def serve_tcp_client(sink, conn, peer):
+    print("capture: %s connected" % peer, file=sys.stderr, flush=True)
+    with conn:
+        while True:
+            hdr = read_exact(conn, HDR.size)
+            if hdr is None:
+                break
+            length = struct.unpack_from("<H", hdr, 16)[0]
+            payload = read_exact(conn, length)
+            if payload is None:
+                break
+            sink.chunk(peer, hdr + payload)
+    print("capture: %s disconnected" % peer, file=sys.stderr, flush=True)
+
+
+def serve_tcp(sink, port):
+    srv = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    srv.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    srv.bind(("", port))
+    srv.listen(4)
+    while True:
+        conn, peer = srv.accept()
+        threading.Thread(target=serve_tcp_client, args=(sink, conn, peer[0]), daemon=True).start()
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("--port", type=int, default=9999)
+    ap.add_argument("--tcp", action="store_true", help="accept TCP connections instead of UDP datagrams")
+    ap.add_argument("--out", default="capture.cap", help="file to append chunks to")
+    ap.add_argument("--stats-s", type=float, default=10, help="counter period (0 = off)")
+    args = ap.parse_args()
+
+    sink = Sink(args.out)
+    target = serve_tcp if args.tcp else serve_udp
+    threading.Thread(target=target, args=(sink, args.port), daemon=True).start()
+    print("capture: listening on %s :%d, writing %s" % ("tcp" if args.tcp else "udp", args.port, args.out), file=sys.stderr)
+
+    try:
+        while True:
+            time.sleep(args.stats_s if args.stats_s > 0 else 3600)
+            if args.stats_s > 0:
+                print("stats: " + " ".join("%s=%d" % kv for kv in sink.counts.items()), file=sys.stderr, flush=True)
+    except KeyboardInterrupt:
+        pass
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,389 @@
+#!/usr/bin/env python3
+"""Convert sniffer captures to and from logic-analyzer formats.
+
+Firmware capture (docs/capture-format.md) to PulseView:
+
+    python tools/capture_vcd.py to-vcd bus.cap -o bus.vcd
+    python tools/capture_vcd.py to-sr bus.cap -o bus.sr --samplerate 1000000
+    python tools/capture_vcd.py to-vcd --udp 9999 -o live.vcd      # live, Ctrl+C to stop
+
+Logic-analyzer capture to a (bit, ts_us) event file:
+
+    python tools/capture_vcd.py from-vcd la.vcd -o bus.events --clk CLK --data DATA
+    python tools/capture_vcd.py from-sr la.sr -o bus.events --clk D0 --data D1
+
+An event file has one "ts_us bit" line per sampling CLK edge, in time order.
+It is what `capture_format.py --edges` prints and what a host build of the
+sniffer_task frame logic reads in place of s_bit_queue. to-vcd/to-sr also
+accept event files (--events).
+
+Files written by to-vcd/to-sr record the absolute time of their first sample
+(a VCD `$comment origin_us N $end`, an `origin_us` key in the sigrok metadata),
+so from-vcd/from-sr give back the original timestamps. At 1 MHz and above the
+round trip is exact:
+
+    python tools/capture_vcd.py selftest
+
+Everything streams: memory use does not grow with capture length.
+"""
+
+import argparse
+import configparser
+import itertools
+import math
+import os
+import random
+import re
+import socket
+import sys
+import tempfile
+import zipfile
+
+from capture_format import HDR, parse_chunk, read_frames, Chunk, MAGIC
+
+CLK_HIGH_US = 2
+SR_CHUNK_SAMPLES = 4 * 1024 * 1024
+
+
+# ---------------------------------------------------------------- sources
+
+def edges_from_capture(frames):
+    """Yields (ts_us, bit, frame_start, frame_end) from capture Frames."""
+    for fr in frames:
+        last = len(fr.bits) - 1
+        for i, (ts, bit) in enumerate(zip(fr.edges_us, fr.bits)):
+            yield ts, bit, i == 0, i == last
+
+
+def edges_from_events(f):
+    for line in f:
+        line = line.strip()
+        if not line or line.startswith("#"):
+            continue
+        ts, bit = line.split()
+        yield int(ts), int(bit), False, False
+
+
+def frames_from_udp(port):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind(("", port))
+    while True:
+        data, _ = sock.recvfrom(2048)
+        if len(data) < HDR.size:
+            continue
+        magic, version, flags, seq, base, length, dropped = HDR.unpack_from(data)
+        if magic != MAGIC or version != 1 or len(data) != HDR.size + length:
+            continue
+        yield from parse_chunk(Chunk(seq, base, dropped, data[HDR.size:], flags))
+
+
+def open_edges(args):
+    if args.udp:
+        print("listening on udp :%d" % args.udp, file=sys.stderr)
+        return edges_from_capture(frames_from_udp(args.udp))
+    if args.events:
+        return edges_from_events(open(args.input, "r"))
+    f = sys.stdin.buffer if args.input == "-" else open(args.input, "rb")
+    return edges_from_capture(read_frames(f))
+
+
+# ---------------------------------------------------------------- writers
+
+def peek(edges):
+    """Returns (first ts_us or None, the same edges)."""
+    edges = iter(edges)
+    first = next(edges, None)
+    if first is None:
+        return None, iter(())
+    return first[0], itertools.chain((first,), edges)
+
+
+def write_vcd(edges, out):
+    # VCD time 0 is the first edge; origin_us maps it back to esp_timer time.
+    t0, edges = peek(edges)
+    out.write("$comment origin_us %d $end\n" % (t0 or 0))
+    out.write("$timescale 1us $end\n$scope module sniffer $end\n"
+              "$var wire 1 ! CLK $end\n$var wire 1 \" DATA $end\n$var wire 1 # FRAME $end\n"
+              "$upscope $end\n$enddefinitions $end\n")
+    now = [-1]
+
+    def at(t, changes):
+        if t != now[0]:
+            out.write("#%d\n" % t)
+            now[0] = t
+        out.write(changes)
+
+    data = 0
+    clk_fall = None
+    close_frame = False
+    count = 0
+    for ts, bit, start, end in edges:
+        if count == 0:
+            at(0, "0!\n0\"\n0#\n")
+        t = ts - t0
+        # The previous clock pulse ends before this edge, whatever its width.
+        if clk_fall is not None:
+            at(max(min(clk_fall, t - 1), now[0]), "0!\n" + ("0#\n" if close_frame else ""))
+        # DATA is set up one microsecond before the edge that samples it.
+        if bit != data:
+            at(max(t - 1, now[0]), "%d\"\n" % bit)
+            data = bit
+        at(t, "1!\n" + ("1#\n" if start else ""))
+        clk_fall = t + CLK_HIGH_US
+        close_frame = end
+        count += 1
+    if clk_fall is not None:
+        at(clk_fall, "0!\n" + ("0#\n" if close_frame else ""))
+    return count
+
+
+class SrWriter:
+    """sigrok session writer: 1 byte per sample, bit0 CLK, bit1 DATA, bit2 FRAME."""
+
+    def __init__(self, path, samplerate, origin_us=0):
+        self.zip = zipfile.ZipFile(path, "w", zipfile.ZIP_DEFLATED)
+        self.per_us = samplerate / 1e6
+        self.samplerate = samplerate
+        self.origin_us = origin_us  # esp_timer time of sample 0
+        self.buf = bytearray()
+        self.chunk = 0
+        self.pos = 0  # samples emitted so far
+        self.level = 0
+
+    def hold_until(self, sample):
+        n = sample - self.pos
+        if n <= 0:
+            return
+        self.pos = sample
+        while n > 0:
+            take = min(n, SR_CHUNK_SAMPLES - len(self.buf))
+            self.buf += bytes((self.level,)) * take
+            n -= take
+            if len(self.buf) >= SR_CHUNK_SAMPLES:
+                self.flush()
+
+    def set(self, sample, level):
+        self.hold_until(sample)
+        self.level = level
+
+    def flush(self):
+        if self.buf:
+            self.chunk += 1
+            self.zip.writestr("logic-1-%d" % self.chunk, bytes(self.buf))
+            self.buf = bytearray()
+
+    def close(self):
+        self.hold_until(self.pos + 1)
+        self.flush()
+        meta = ("[global]\nsigrok version=0.5.2\n\n[device 1]\ncapturefile=logic-1\ntotal probes=3\n"
+                "samplerate=%d Hz\ntotal analog=0\nprobe1=CLK\nprobe2=DATA\nprobe3=FRAME\nunitsize=1\n"
+                "origin_us=%d\n" % (self.samplerate, self.origin_us))
+        self.zip.writestr("version", "2")
+        self.zip.writestr("metadata", meta)
+        self.zip.close()
+
+
+def write_sr(edges, path, samplerate):
+    # Sample 0 holds the idle levels before the first edge, so the origin is
+    # one sample (rounded up to whole microseconds) ahead of it.
+    t0, edges = peek(edges)
+    pad_us = math.ceil(1e6 / samplerate)
+    origin = (t0 or 0) - pad_us
+    w = SrWriter(path, samplerate, origin)
+    count = 0
+    frame = 0
+    high = max(1, int(CLK_HIGH_US * w.per_us))
+    for ts, bit, start, end in edges:
+        s = int(round((ts - origin) * w.per_us))
+        if start:
+            frame = 4
+        # Close the previous pulse if it would run into this edge.
+        w.set(max(s - 1, w.pos), frame | (bit << 1))
+        w.set(s, frame | (bit << 1) | 1)
+        if end:
+            frame = 0
+        w.set(s + high, frame | (bit << 1))
+        count += 1
+    w.close()
+    return count
+
+
+# ---------------------------------------------------------------- readers
+
+_TIMESCALE = {"s": 1e6, "ms": 1e3, "us": 1.0, "ns": 1e-3, "ps": 1e-6, "fs": 1e-9}
+
+
+def events_from_vcd(f, clk_name, data_name, falling):
+    """Yields (ts_us, bit) on each sampling edge of CLK in a VCD file."""
+    ids = {}
+    scale = 1.0
+    header = []
+    for line in f:
+        header.append(line)
+        if "$enddefinitions" in line:
+            break
+    text = " ".join(header)
+    m = re.search(r"\$timescale\s+(\d+)\s*(\w+)\s+\$end", text)
+    if m:
+        scale = int(m.group(1)) * _TIMESCALE[m.group(2)]
+    m = re.search(r"\$comment\s+origin_us\s+(-?\d+)\s+\$end", text)
+    origin = int(m.group(1)) if m else 0
+    for m in re.finditer(r"\$var\s+\w+\s+(\d+)\s+(\S+)\s+(\S+)", text):
+        ids.setdefault(m.group(3), m.group(2))
+    names = list(ids)
+    clk = ids.get(clk_name) or (ids[names[0]] if names else None)
+    data = ids.get(data_name) or (ids[names[1]] if len(names) > 1 else None)
+    if clk is None or data is None:
+        raise SystemExit("VCD needs a clock and a data signal (found: %s)" % ", ".join(names))
+
+    t = 0
+    levels = {clk: None, data: 0}
+    want = "0" if falling else "1"
+    for line in f:
+        for tok in line.split():
+            if tok[0] == "#":
+                t = int(tok[1:])
+                continue
+            if tok[0] in "01xXzZ" and len(tok) > 1:
+                value, ident = tok[0], tok[1:]
+            else:
+                continue
+            if ident == data:
+                levels[data] = 1 if value == "1" else 0
+            elif ident == clk:
+                if value == want and levels[clk] is not None and levels[clk] != value:
+                    yield origin + int(round(t * scale)), levels[data]
+                levels[clk] = value
+
+
+def events_from_sr(path, clk_name, data_name, falling):
+    """Yields (ts_us, bit) from a sigrok session, one chunk in memory at a time."""
+    z = zipfile.ZipFile(path)
+    meta = configparser.ConfigParser()
+    meta.read_string(z.read("metadata").decode())
+    dev = meta["device 1"]
+    rate_text = dev["samplerate"].split()
+    mult = {"Hz": 1, "kHz": 1e3, "MHz": 1e6, "GHz": 1e9}
+    samplerate = float(rate_text[0]) * mult.get(rate_text[1] if len(rate_text) > 1 else "Hz", 1)
+    unitsize = int(dev.get("unitsize", "1"))
+    origin = int(dev.get("origin_us", "0"))
+    probes = {dev[k]: int(k[5:]) - 1 for k in dev if k.startswith("probe")}
+    clk_bit = probes.get(clk_name, 0)
+    data_bit = probes.get(data_name, 1)
+    if unitsize != 1 and max(clk_bit, data_bit) >= 8:
+        raise SystemExit("only the first 8 probes are supported")
+    prefix = dev.get("capturefile", "logic-1")
+    chunks = sorted((n for n in z.namelist() if n.startswith(prefix + "-")), key=lambda n: int(n.rsplit("-", 1)[1]))
+
+    clk_table = bytes(1 if (i >> clk_bit) & 1 else 0 for i in range(256))
+    pattern = b"\x01\x00" if falling else b"\x00\x01"
+    us_per_sample = 1e6 / samplerate
+    base = 0
+    prev_clk = None
+    for name in chunks:
+        raw = z.read(name)
+        if unitsize != 1:
+            raw = raw[::unitsize]  # low byte of each sample
+        clk = raw.translate(clk_table)
+        # An edge straddling two chunks.
+        if prev_clk is not None and clk and bytes((prev_clk, clk[0])) == pattern:
+            yield origin + int(round(base * us_per_sample)), (raw[0] >> data_bit) & 1
+        i = clk.find(pattern)
+        while i >= 0:
+            yield origin + int(round((base + i + 1) * us_per_sample)), (raw[i + 1] >> data_bit) & 1
+            i = clk.find(pattern, i + 1)
+        if clk:
+            prev_clk = clk[-1]
+        base += len(raw)
+
+
+def write_events(events, out):
+    n = 0
+    for ts, bit in events:
+        out.write("%d %d\n" % (ts, bit))
+        n += 1
+    return n
+
+
+# ---------------------------------------------------------------- selftest
+
+def selftest(n=5000, seed=1):
+    """Events -> VCD/sr -> events must give back the same (ts_us, bit) pairs."""
+    rng = random.Random(seed)
+    ts = 10 ** 12 + rng.randrange(10 ** 6)
+    events = []
+    for _ in range(n):
+        ts += rng.choice((rng.randint(3, 400), rng.randint(2000, 60000)))
+        events.append((ts, rng.randint(0, 1)))
+    edges = [(t, b, False, False) for t, b in events]
+    tmp = tempfile.mkdtemp()
+    failed = 0
+    vcd = os.path.join(tmp, "t.vcd")
+    with open(vcd, "w") as out:
+        write_vcd(edges, out)
+    with open(vcd, "r") as f:
+        got = list(events_from_vcd(f, "CLK", "DATA", False))
+    failed += report("vcd", events, got)
+    for rate in (1000000, 4000000):
+        sr = os.path.join(tmp, "t%d.sr" % rate)
+        write_sr(edges, sr, rate)
+        failed += report("sr@%dHz" % rate, events, list(events_from_sr(sr, "CLK", "DATA", False)))
+    return failed
+
+
+def report(name, want, got):
+    bad = sum(1 for a, b in zip(want, got) if a != b) + abs(len(want) - len(got))
+    first = next((i for i, (a, b) in enumerate(zip(want, got)) if a != b), None)
+    print("%-12s %d edges, %d mismatched%s" % (name, len(got), bad,
+          "" if first is None else " (first at #%d: want %s got %s)" % (first, want[first], got[first])))
+    return 1 if bad else 0
+
+
+# ---------------------------------------------------------------- main
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = ap.add_subparsers(dest="cmd", required=True)
+    for name in ("to-vcd", "to-sr"):
+        p = sub.add_parser(name)
+        p.add_argument("input", nargs="?", default="-", help="capture file ('-' = stdin)")
+        p.add_argument("-o", "--output", required=True)
+        p.add_argument("--events", action="store_true", help="input is an event file, not a capture")
+        p.add_argument("--udp", type=int, help="read a live capture stream on this UDP port instead")
+        if name == "to-sr":
+            p.add_argument("--samplerate", type=int, default=1000000, help="Hz (default 1 MHz)")
+    for name in ("from-vcd", "from-sr"):
+        p = sub.add_parser(name)
+        p.add_argument("input")
+        p.add_argument("-o", "--output", default="-")
+        p.add_argument("--clk", default="CLK", help="clock signal/probe name (default: first)")
+        p.add_argument("--data", default="DATA", help="data signal/probe name (default: second)")
+        p.add_argument("--falling", action="store_true", help="sample on the falling CLK edge")
+    sub.add_parser("selftest", help="round-trip random events through VCD and sigrok files")
+    args = ap.parse_args()
+
+    if args.cmd == "selftest":
+        return 1 if selftest() else 0
+
+    try:
+        if args.cmd == "to-vcd":
+            with open(args.output, "w", buffering=1 << 20) as out:
+                n = write_vcd(open_edges(args), out)
+        elif args.cmd == "to-sr":
+            n = write_sr(open_edges(args), args.output, args.samplerate)
+        else:
+            if args.cmd == "from-vcd":
+                events = events_from_vcd(open(args.input, "r", buffering=1 << 20), args.clk, args.data, args.falling)
+            else:
+                events = events_from_sr(args.input, args.clk, args.data, args.falling)
+            out = sys.stdout if args.output == "-" else open(args.output, "w", buffering=1 << 20)
+            n = write_events(events, out)
+            out.flush()
+    except KeyboardInterrupt:
+        return 0
+    print("%d edges" % n, file=sys.stderr)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
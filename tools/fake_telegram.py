@@ -0,0 +1,273 @@
+#!/usr/bin/env python3
+"""Local stand-in for the Telegram Bot API, for soak tests of the polling code.
+
+Serves getUpdates (long poll, offset/timeout honoured) and sendMessage on
+plain HTTP. Point the firmware at it with
+
+    Telegram Bot API base URL = http://<host-ip>:8081
+
+then, for example, send /status every 5 s and log heap figures from the
+device's HTTP server once a minute:
+
+    python tools/fake_telegram.py --every 5 --cmd /status --cmd "/history 1h" \\
+        --metrics http://<device-ip>/metrics --sample-s 60 --csv soak.csv
+
+Failure injection for the backoff / circuit-breaker code:
+
+    python tools/fake_telegram.py --fail-rate 0.3            # 30% answered 502
+    python tools/fake_telegram.py --rate-limit 20/60         # 429 + retry_after
+    python tools/fake_telegram.py --outage 120:300           # connections dropped
+                                                             # from t=120 s for 300 s
+
+Request counters are printed every --stats-s seconds, so the device's retry
+rate during an outage is visible directly.
+
+Lines typed on stdin are delivered as messages too. The CSV tracks
+heap.largest / heap.largest_min (fragmentation) and json_arena usage over
+the run; a largest_min that keeps falling over days means something still
+fragments the internal heap.
+"""
+
+import argparse
+import csv
+import itertools
+import json
+import random
+import sys
+import threading
+import time
+import urllib.request
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from urllib.parse import parse_qs, urlparse
+
+
+class Bot:
+    def __init__(self, chat_id):
+        self.chat_id = chat_id
+        self.cond = threading.Condition()
+        self.updates = []
+        self.next_id = 1
+        self.sent = 0
+        self.polls = 0
+
+    def push(self, text):
+        with self.cond:
+            self.updates.append({
+                "update_id": self.next_id,
+                "message": {
+                    "message_id": self.next_id,
+                    "date": int(time.time()),
+                    "chat": {"id": self.chat_id, "type": "private"},
+                    "text": text,
+                },
+            })
+            self.next_id += 1
+            self.cond.notify_all()
+
+    def get_updates(self, offset, timeout):
+        deadline = time.monotonic() + timeout
+        with self.cond:
+            self.polls += 1
+            # Telegram drops everything below offset once it is confirmed.
+            self.updates = [u for u in self.updates if u["update_id"] >= offset]
+            while not self.updates:
+                left = deadline - time.monotonic()
+                if left <= 0:
+                    break
+                self.cond.wait(left)
+            return list(self.updates)
+
+
+class Faults:
+    def __init__(self, fail_rate, rate_limit, outage):
+        self.fail_rate = fail_rate
+        self.limit = None
+        if rate_limit:
+            n, window = rate_limit.split("/")
+            self.limit = (int(n), float(window))
+        self.outage = None
+        if outage:
+            start, length = outage.split(":")
+            self.outage = (float(start), float(length))
+        self.start = time.monotonic()
+        self.window_start = self.start
+        self.window_count = 0
+        self.lock = threading.Lock()
+        self.counts = {"req": 0, "ok": 0, "5xx": 0, "429": 0, "dropped": 0}
+
+    def check(self):
+        """Returns None, "drop", or an (status, retry_after) tuple."""
+        now = time.monotonic()
+        with self.lock:
+            self.counts["req"] += 1
+            t = now - self.start
+            if self.outage and self.outage[0] <= t < self.outage[0] + self.outage[1]:
+                self.counts["dropped"] += 1
+                return "drop"
+            if self.limit:
+                n, window = self.limit
+                if now - self.window_start >= window:
+                    self.window_start = now
+                    self.window_count = 0
+                self.window_count += 1
+                if self.window_count > n:
+                    self.counts["429"] += 1
+                    return (429, max(1, int(self.window_start + window - now + 0.999)))
+            if self.fail_rate and random.random() < self.fail_rate:
+                self.counts["5xx"] += 1
+                return (502, 0)
+            self.counts["ok"] += 1
+            return None
+
+
+def make_handler(bot, faults, quiet):
+    class Handler(BaseHTTPRequestHandler):
+        protocol_version = "HTTP/1.1"
+
+        def log_message(self, fmt, *args):
+            if not quiet:
+                sys.stderr.write("http: " + fmt % args + "\n")
+
+        def reply(self, obj, status=200):
+            body = json.dumps(obj).encode()
+            self.send_response(status)
+            self.send_header("Content-Type", "application/json")
+            self.send_header("Content-Length", str(len(body)))
+            self.end_headers()
+            self.wfile.write(body)
+
+        def inject(self):
+            fault = faults.check()
+            if fault is None:
+                return False
+            if fault == "drop":
+                self.close_connection = True
+                return True
+            status, retry_after = fault
+            body = {"ok": False, "error_code": status, "description": "injected"}
+            if status == 429:
+                body["description"] = "Too Many Requests: retry after %d" % retry_after
+                body["parameters"] = {"retry_after": retry_after}
+            self.reply(body, status)
+            return True
+
+        def method(self):
+            parts = urlparse(self.path).path.split("/")
+            return parts[2] if len(parts) > 2 and parts[1].startswith("bot") else ""
+
+        def do_GET(self):
+            if self.inject():
+                return
+            if self.method() != "getUpdates":
+                self.reply({"ok": False, "description": "Not Found"}, 404)
+                return
+            q = parse_qs(urlparse(self.path).query)
+            offset = int(q.get("offset", ["0"])[0])
+            timeout = int(q.get("timeout", ["0"])[0])
+            self.reply({"ok": True, "result": bot.get_updates(offset, timeout)})
+
+        def do_POST(self):
+            length = int(self.headers.get("Content-Length", "0"))
+            raw = self.rfile.read(length) if length else b"{}"
+            if self.inject():
+                return
+            if self.method() != "sendMessage":
+                self.reply({"ok": False, "description": "Not Found"}, 404)
+                return
+            msg = json.loads(raw or b"{}")
+            bot.sent += 1
+            print("%s <- %s" % (time.strftime("%H:%M:%S"), msg.get("text", "").replace("\n", " | ")), flush=True)
+            self.reply({"ok": True, "result": {"message_id": bot.sent, "text": msg.get("text", "")}})
+
+    return Handler
+
+
+def scripted(bot, cmds, every):
+    for cmd in itertools.cycle(cmds):
+        time.sleep(every)
+        bot.push(cmd)
+
+
+def report(faults, period):
+    prev = dict(faults.counts)
+    while True:
+        time.sleep(period)
+        cur = dict(faults.counts)
+        print("stats: " + " ".join("%s=%d" % (k, cur[k] - prev[k]) for k in cur) + " (last %gs)" % period,
+              file=sys.stderr, flush=True)
+        prev = cur
+
+
+def sampler(url, period, path, bot):
+    fields = ["t_s", "uptime_ms", "free", "min_free", "largest", "largest_min", "arena_peak", "arena_overflows", "polls", "sent"]
+    start = time.monotonic()
+    with open(path, "w", newline="") as f:
+        out = csv.writer(f)
+        out.writerow(fields)
+        while True:
+            try:
+                with urllib.request.urlopen(url, timeout=10) as resp:
+                    m = json.load(resp)
+                heap = m.get("heap", {})
+                arena = m.get("json_arena", {})
+                out.writerow([
+                    int(time.monotonic() - start),
+                    m.get("uptime_ms"),
+                    heap.get("free"),
+                    heap.get("min_free"),
+                    heap.get("largest"),
+                    heap.get("largest_min"),
+                    arena.get("peak"),
+                    arena.get("overflows"),
+                    bot.polls,
+                    bot.sent,
+                ])
+                f.flush()
+            except (OSError, ValueError) as e:
+                print("metrics: %s" % e, file=sys.stderr)
+            time.sleep(period)
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("--port", type=int, default=8081)
+    ap.add_argument("--chat-id", type=int, default=1, help="chat id of injected messages (match SNIFFER_TELEGRAM_CHAT_ID)")
+    ap.add_argument("--cmd", action="append", default=[], help="command to send periodically (repeatable)")
+    ap.add_argument("--every", type=float, default=0, help="seconds between scripted commands")
+    ap.add_argument("--metrics", help="device /metrics URL to sample")
+    ap.add_argument("--sample-s", type=float, default=60)
+    ap.add_argument("--csv", default="soak.csv")
+    ap.add_argument("--fail-rate", type=float, default=0, help="fraction of requests answered 502")
+    ap.add_argument("--rate-limit", help="N/S: allow N requests per S seconds, then 429 with retry_after")
+    ap.add_argument("--outage", help="START:LEN: drop connections from START s for LEN s")
+    ap.add_argument("--stats-s", type=float, default=10, help="request counter period (0 = off)")
+    ap.add_argument("--quiet", action="store_true", help="do not log every HTTP request")
+    args = ap.parse_args()
+
+    bot = Bot(args.chat_id)
+    faults = Faults(args.fail_rate, args.rate_limit, args.outage)
+    server = ThreadingHTTPServer(("", args.port), make_handler(bot, faults, args.quiet))
+    threading.Thread(target=server.serve_forever, daemon=True).start()
+    print("fake Telegram API on :%d" % args.port, file=sys.stderr)
+
+    if args.stats_s > 0:
+        threading.Thread(target=report, args=(faults, args.stats_s), daemon=True).start()
+    if args.cmd and args.every > 0:
+        threading.Thread(target=scripted, args=(bot, args.cmd, args.every), daemon=True).start()
+    if args.metrics:
+        threading.Thread(target=sampler, args=(args.metrics, args.sample_s, args.csv, bot), daemon=True).start()
+
+    try:
+        for line in sys.stdin:
+            if line.strip():
+                bot.push(line.strip())
+        while True:
+            time.sleep(3600)
+    except KeyboardInterrupt:
+        pass
+    server.shutdown()
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,360 @@
+#!/usr/bin/env python3
+"""Build and check delta and compressed OTA artifacts for sniffer_esp.bin.
+
+    python tools/ota_pack.py diff firmware/v1.0.5/sniffer_esp.bin build/sniffer_esp.bin -o sniffer_esp.patch
+    python tools/ota_pack.py apply firmware/v1.0.5/sniffer_esp.bin sniffer_esp.patch -o new.bin
+    python tools/ota_pack.py verify-chain firmware
+    python tools/ota_pack.py compress build/sniffer_esp.bin -o sniffer_esp.bin.deflate
+    python tools/ota_pack.py bench sniffer_esp.bin.deflate
+
+verify-chain walks firmware/vX folders in version order, builds the vX -> vX+1
+patch, applies it and compares the result with the sha256 published in
+vX+1/SHA256SUMS.txt. Exit status is non-zero if any step fails.
+
+Patch layout (see ota_apply_patch in main/main.c), little-endian:
+
+    magic "SDP1", old_size u32, new_size u32, flags u32,
+    old_sha256[32], new_sha256[32], raw deflate stream (wbits -12)
+
+The deflated stream is a sequence of bsdiff-style ops:
+
+    add_len varint, copy_len varint, seek zigzag-varint,
+    add_len bytes added (mod 256) to the old image at the cursor,
+    copy_len literal bytes,
+    then the old cursor moves by add_len + seek.
+
+sniffer_esp.bin.deflate is the full image as a bare raw deflate stream with
+the same 4 KB window, so the device reuses one inflater for both.
+
+bench replays the device's streaming loop (1 KB reads, output drained from a
+4 KB circular window) and prints throughput, peak host allocations during the
+loop and the fixed RAM the device needs for it.
+"""
+
+import argparse
+import hashlib
+import os
+import re
+import struct
+import sys
+import time
+import tracemalloc
+import zlib
+
+MAGIC = b"SDP1"
+HDR = struct.Struct("<4sIII32s32s")
+WBITS = -12
+KEY = 16
+STRIDE = 4
+# Stop extending an approximate match after this many bytes without gain.
+SLACK = 64
+# Device-side streaming buffers (OTA_INFLATE_* in main/main.c) and the size of
+# miniz's tinfl_decompressor, which holds the Huffman tables.
+INFLATE_IN_BYTES = 1024
+INFLATE_DICT_BYTES = 1 << -WBITS
+TINFL_STATE_BYTES = 11000
+
+
+def varint(v):
+    out = bytearray()
+    while v >= 0x80:
+        out.append((v & 0x7F) | 0x80)
+        v >>= 7
+    out.append(v)
+    return bytes(out)
+
+
+def zigzag(v):
+    return (v << 1) ^ (v >> 63) if v < 0 else v << 1
+
+
+def read_varint(buf, pos):
+    v = 0
+    shift = 0
+    while True:
+        b = buf[pos]
+        pos += 1
+        v |= (b & 0x7F) << shift
+        if not b & 0x80:
+            return v, pos
+        shift += 7
+
+
+def unzigzag(v):
+    return (v >> 1) ^ -(v & 1)
+
+
+def build_index(old):
+    index = {}
+    for j in range(0, len(old) - KEY + 1, STRIDE):
+        index.setdefault(old[j:j + KEY], j)
+    return index
+
+
+def extend(old, new, i, j):
+    """Length of the approximate match old[j:] ~ new[i:], bsdiff scoring."""
+    n = min(len(new) - i, len(old) - j)
+    score = 0
+    best = 0
+    best_len = 0
+    k = 0
+    while k < n:
+        # Skip exact runs in slices, they dominate between changed relocations.
+        run = 0
+        while k + run + 32 <= n and new[i + k + run:i + k + run + 32] == old[j + k + run:j + k + run + 32]:
+            run += 32
+        if run:
+            k += run
+            score += run
+        else:
+            if new[i + k] == old[j + k]:
+                score += 1
+            k += 1
+        if 2 * score - k > best:
+            best = 2 * score - k
+            best_len = k
+        elif k - best_len > SLACK:
+            break
+    return best_len
+
+
+def find_segments(old, new):
+    """Aligned (new_start, length, old_start) runs, in new order."""
+    index = build_index(old)
+    segments = []
+    i = 0
+    gap_start = 0
+    offset = 0
+    while i + KEY <= len(new):
+        key = new[i:i + KEY]
+        j = i + offset
+        if not (0 <= j <= len(old) - KEY and old[j:j + KEY] == key):
+            j = index.get(key)
+            if j is None:
+                i += 1
+                continue
+        while i > gap_start and j > 0 and new[i - 1] == old[j - 1]:
+            i -= 1
+            j -= 1
+        length = extend(old, new, i, j)
+        if length < KEY:
+            i += 1
+            continue
+        segments.append((i, length, j))
+        offset = j - i
+        i += length
+        gap_start = i
+    return segments
+
+
+def diff(old, new):
+    segments = find_segments(old, new)
+    body = bytearray()
+    new_pos = 0
+    # Leading literal bytes before the first match ride on an empty add op.
+    pending = [(0, 0)]
+    for new_start, length, old_start in segments:
+        add_len, add_old = pending[-1]
+        copy_len = new_start - (new_pos + add_len)
+        seek = old_start - (add_old + add_len)
+        body += varint(add_len) + varint(copy_len) + varint(zigzag(seek))
+        body += bytes((new[new_pos + k] - old[add_old + k]) & 0xFF for k in range(add_len))
+        body += new[new_pos + add_len:new_start]
+        new_pos = new_start
+        pending.append((length, old_start))
+    add_len, add_old = pending[-1]
+    copy_len = len(new) - (new_pos + add_len)
+    body += varint(add_len) + varint(copy_len) + varint(0)
+    body += bytes((new[new_pos + k] - old[add_old + k]) & 0xFF for k in range(add_len))
+    body += new[new_pos + add_len:]
+
+    packed = deflate(bytes(body))
+    hdr = HDR.pack(MAGIC, len(old), len(new), 0, hashlib.sha256(old).digest(), hashlib.sha256(new).digest())
+    return hdr + packed
+
+
+def deflate(data):
+    comp = zlib.compressobj(9, zlib.DEFLATED, WBITS, 9)
+    return comp.compress(data) + comp.flush()
+
+
+def inflate_streaming(packed, sink):
+    """Inflates like the device does; returns the number of output bytes."""
+    d = zlib.decompressobj(WBITS)
+    total = 0
+    for off in range(0, len(packed), INFLATE_IN_BYTES):
+        chunk = packed[off:off + INFLATE_IN_BYTES]
+        while chunk:
+            out = d.decompress(chunk, INFLATE_DICT_BYTES)
+            chunk = d.unconsumed_tail
+            total += len(out)
+            sink(out)
+    out = d.flush()
+    total += len(out)
+    sink(out)
+    if not d.eof:
+        raise ValueError("truncated deflate stream")
+    return total
+
+
+def apply(old, patch):
+    magic, old_size, new_size, _flags, old_sha, new_sha = HDR.unpack_from(patch)
+    if magic != MAGIC:
+        raise ValueError("not a patch")
+    if len(old) < old_size or hashlib.sha256(old[:old_size]).digest() != old_sha:
+        raise ValueError("patch base does not match the old image")
+    body = zlib.decompressobj(WBITS).decompress(patch[HDR.size:])
+    out = bytearray()
+    pos = 0
+    old_pos = 0
+    while len(out) < new_size:
+        add_len, pos = read_varint(body, pos)
+        copy_len, pos = read_varint(body, pos)
+        seek, pos = read_varint(body, pos)
+        out += bytes((body[pos + k] + old[old_pos + k]) & 0xFF for k in range(add_len))
+        pos += add_len
+        out += body[pos:pos + copy_len]
+        pos += copy_len
+        old_pos += add_len + unzigzag(seek)
+    if len(out) != new_size or hashlib.sha256(out).digest() != new_sha:
+        raise ValueError("patched image hash mismatch")
+    return bytes(out)
+
+
+def published_sha(folder, name="sniffer_esp.bin"):
+    with open(os.path.join(folder, "SHA256SUMS.txt")) as f:
+        for line in f:
+            parts = line.split()
+            if len(parts) == 2 and parts[1] == name:
+                return parts[0].lower()
+    return None
+
+
+def release_dirs(root):
+    def key(name):
+        return [int(x) for x in re.findall(r"\d+", name)]
+
+    names = [n for n in os.listdir(root) if re.match(r"^v\d+(\.\d+)+$", n)]
+    return [os.path.join(root, n) for n in sorted(names, key=key)]
+
+
+def read(path):
+    with open(path, "rb") as f:
+        return f.read()
+
+
+def cmd_diff(args):
+    patch = diff(read(args.old), read(args.new))
+    with open(args.output, "wb") as f:
+        f.write(patch)
+    print("%s: %d bytes (%.1f%% of %d)" % (args.output, len(patch), 100.0 * len(patch) / os.path.getsize(args.new),
+                                           os.path.getsize(args.new)))
+    return 0
+
+
+def cmd_apply(args):
+    out = apply(read(args.old), read(args.patch))
+    with open(args.output, "wb") as f:
+        f.write(out)
+    print("%s: %d bytes, sha256 %s" % (args.output, len(out), hashlib.sha256(out).hexdigest()))
+    return 0
+
+
+def cmd_compress(args):
+    data = read(args.image)
+    packed = deflate(data)
+    if zlib.decompress(packed, WBITS) != data:
+        raise SystemExit("round-trip mismatch")
+    with open(args.output, "wb") as f:
+        f.write(packed)
+    print("%s: %d -> %d bytes (%.1f%%)" % (args.output, len(data), len(packed), 100.0 * len(packed) / len(data)))
+    return 0
+
+
+def cmd_bench(args):
+    packed = read(args.packed)
+    digest = hashlib.sha256()
+
+    elapsed = None
+    for _ in range(args.rounds):
+        t0 = time.perf_counter()
+        size = inflate_streaming(packed, digest.update)
+        dt = time.perf_counter() - t0
+        elapsed = dt if elapsed is None else min(elapsed, dt)
+
+    # Separate pass: tracing slows the loop down.
+    tracemalloc.start()
+    inflate_streaming(packed, lambda out: None)
+    _, peak = tracemalloc.get_traced_memory()
+    tracemalloc.stop()
+
+    device_ram = TINFL_STATE_BYTES + INFLATE_DICT_BYTES + INFLATE_IN_BYTES
+    print("image:        %d bytes, packed %d bytes (%.1f%%)" % (size, len(packed), 100.0 * len(packed) / size))
+    print("host inflate: %.1f MB/s (best of %d), peak %d bytes allocated in loop" %
+          (size / elapsed / 1e6, args.rounds, peak))
+    print("device RAM:   %d bytes (tinfl %d + window %d + input %d)" %
+          (device_ram, TINFL_STATE_BYTES, INFLATE_DICT_BYTES, INFLATE_IN_BYTES))
+    if args.link_kbps:
+        bps = args.link_kbps * 1000 / 8
+        print("at %d kbit/s:  raw %.1f s, packed %.1f s" % (args.link_kbps, size / bps, len(packed) / bps))
+    return 0
+
+
+def cmd_verify_chain(args):
+    dirs = release_dirs(args.root)
+    failed = 0
+    for prev, cur in zip(dirs, dirs[1:]):
+        old = read(os.path.join(prev, "sniffer_esp.bin"))
+        new = read(os.path.join(cur, "sniffer_esp.bin"))
+        expected = published_sha(cur)
+        try:
+            patch = diff(old, new)
+            got = hashlib.sha256(apply(old, patch)).hexdigest()
+            ok = expected is not None and got == expected
+            detail = "%d bytes (%.1f%%)" % (len(patch), 100.0 * len(patch) / len(new))
+        except ValueError as e:
+            ok = False
+            detail = str(e)
+        failed += 0 if ok else 1
+        print("%-8s -> %-8s %s %s" % (os.path.basename(prev), os.path.basename(cur), "ok  " if ok else "FAIL", detail))
+    print("%d patches, %d failed" % (max(len(dirs) - 1, 0), failed))
+    return 1 if failed else 0
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = ap.add_subparsers(dest="cmd", required=True)
+
+    p = sub.add_parser("diff", help="build a patch from old to new image")
+    p.add_argument("old")
+    p.add_argument("new")
+    p.add_argument("-o", "--output", required=True)
+    p.set_defaults(fn=cmd_diff)
+
+    p = sub.add_parser("apply", help="apply a patch to the old image")
+    p.add_argument("old")
+    p.add_argument("patch")
+    p.add_argument("-o", "--output", required=True)
+    p.set_defaults(fn=cmd_apply)
+
+    p = sub.add_parser("compress", help="raw deflate a full image for compressed OTA")
+    p.add_argument("image")
+    p.add_argument("-o", "--output", required=True)
+    p.set_defaults(fn=cmd_compress)
+
+    p = sub.add_parser("bench", help="device-style streaming inflate: throughput and RAM")
+    p.add_argument("packed")
+    p.add_argument("--rounds", type=int, default=5)
+    p.add_argument("--link-kbps", type=int, default=0, help="also estimate download time on this link")
+    p.set_defaults(fn=cmd_bench)
+
+    p = sub.add_parser("verify-chain", help="round-trip every consecutive release pair")
+    p.add_argument("root", nargs="?", default="firmware")
+    p.set_defaults(fn=cmd_verify_chain)
+
+    args = ap.parse_args()
+    return args.fn(args)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,325 @@
+#!/usr/bin/env python3
+"""Read the sniffer reading log (rlog partition) on the host.
+
+Input is either a raw partition image:
+
+    esptool.py read_flash 0x310000 0xF0000 rlog.img
+    python tools/rlog_dump.py rlog.img > readings.csv
+
+or a record stream downloaded from the device (GET /log.bin), with --records.
+
+    python tools/rlog_dump.py --selftest
+
+builds an image with wrapped sectors, a half-written sector and corrupted
+records, and checks that it decodes to the expected readings.
+
+    python tools/rlog_dump.py --bench 20000 --rate 1 --flush-s 600
+
+runs the firmware's append algorithm (page batching, timed partial-page
+flushes, sector erases) over a simulated partition and reports write and erase
+amplification and the estimated flash busy time, without touching a device.
+
+Layout (see rlog_* in main/main.c): 4096-byte sectors, slot 0 holds the
+sector header, slots 1..255 hold 16-byte records, all little-endian:
+
+    header: magic u32 "RLG1", sector_seq u32, first_seq u32, boot u16, crc u16
+    record: seq u32, uptime_ms u32, boot u16, value i16, rank u8, flags u8, crc u16
+
+crc is CRC-16/CCITT-FALSE over the preceding 14 bytes.
+"""
+
+import argparse
+import csv
+import io
+import random
+import struct
+import sys
+
+SECTOR_BYTES = 4096
+RECORD_BYTES = 16
+SECTOR_SLOTS = SECTOR_BYTES // RECORD_BYTES
+MAGIC = 0x31474C52
+FLAG_HAS_VALUE = 0x01
+FLAG_CORRECTED = 0x02
+PAGE_BYTES = 256
+PAGE_RECORDS = PAGE_BYTES // RECORD_BYTES
+RANK_TAGS = ["unknown", "partial", "single", "mux", "ok"]
+
+HDR = struct.Struct("<IIIHH")
+REC = struct.Struct("<IIHhBBH")
+
+
+def crc16_ccitt(data):
+    crc = 0xFFFF
+    for b in data:
+        crc ^= b << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if (crc & 0x8000) else (crc << 1)
+            crc &= 0xFFFF
+    return crc
+
+
+def parse_record(raw):
+    """Returns a record dict, None for an erased slot, or "bad" on CRC error."""
+    if raw == b"\xff" * RECORD_BYTES:
+        return None
+    seq, uptime_ms, boot, value, rank, flags, crc = REC.unpack(raw)
+    if crc != crc16_ccitt(raw[:14]):
+        return "bad"
+    return {
+        "seq": seq,
+        "boot": boot,
+        "uptime_ms": uptime_ms,
+        "value": value if flags & FLAG_HAS_VALUE else None,
+        "status": "fixed" if flags & FLAG_CORRECTED else (RANK_TAGS[rank] if rank < len(RANK_TAGS) else str(rank)),
+    }
+
+
+def read_image(data, stats):
+    """Yields records from a partition image, oldest sector first."""
+    sectors = []
+    for i in range(len(data) // SECTOR_BYTES):
+        base = i * SECTOR_BYTES
+        hdr = data[base:base + RECORD_BYTES]
+        magic, sector_seq, first_seq, boot, crc = HDR.unpack(hdr)
+        if magic != MAGIC or crc != crc16_ccitt(hdr[:14]):
+            stats["empty_sectors"] += 1
+            continue
+        sectors.append((sector_seq, i))
+    stats["sectors"] = len(sectors)
+
+    for _, i in sorted(sectors):
+        base = i * SECTOR_BYTES
+        for slot in range(1, SECTOR_SLOTS):
+            rec = parse_record(data[base + slot * RECORD_BYTES:base + (slot + 1) * RECORD_BYTES])
+            if rec is None:
+                stats["erased_slots"] += 1
+            elif rec == "bad":
+                stats["crc_errors"] += 1
+            else:
+                yield rec
+
+
+def read_records(data, stats):
+    for off in range(0, len(data) - RECORD_BYTES + 1, RECORD_BYTES):
+        rec = parse_record(data[off:off + RECORD_BYTES])
+        if rec == "bad":
+            stats["crc_errors"] += 1
+        elif rec is not None:
+            yield rec
+
+
+def dump(reader, data, stats, out, since=0):
+    """Writes the CSV and returns the record count."""
+    w = csv.writer(out, lineterminator="\n")
+    w.writerow(["seq", "boot", "uptime_ms", "value", "status"])
+    count = 0
+    last_seq = None
+    for rec in reader(data, stats):
+        gap = last_seq is not None and rec["seq"] != last_seq + 1
+        last_seq = rec["seq"]
+        if rec["seq"] < since:
+            continue
+        if gap:
+            stats["seq_gaps"] = stats.get("seq_gaps", 0) + 1
+        w.writerow([rec["seq"], rec["boot"], rec["uptime_ms"], "" if rec["value"] is None else rec["value"], rec["status"]])
+        count += 1
+    stats["records"] = count
+    return count
+
+
+# ------------------------------------------------------- writer model
+
+def make_record(seq, uptime_ms, boot, value, rank, flags):
+    raw = struct.pack("<IIHhBB", seq, uptime_ms, boot, value, rank, flags)
+    return raw + struct.pack("<H", crc16_ccitt(raw))
+
+
+class RlogWriter:
+    """The append path of main.c (rlog_append_locked, rlog_flush_locked,
+    rlog_open_sector_locked) over an in-memory partition image."""
+
+    def __init__(self, nsectors, boot=1):
+        self.img = bytearray(b"\xff" * (nsectors * SECTOR_BYTES))
+        self.nsectors = nsectors
+        self.boot = boot
+        self.next_seq = 1
+        self.sector_seq = 0
+        self.cur = -1
+        self.slot = self.flushed = SECTOR_SLOTS
+        self.pending_since = None
+        self.stats = {"appended": 0, "program_ops": 0, "bytes_programmed": 0, "erases": 0}
+
+    def _open_sector(self):
+        self.cur = (self.cur + 1) % self.nsectors
+        self.sector_seq += 1
+        base = self.cur * SECTOR_BYTES
+        self.img[base:base + SECTOR_BYTES] = b"\xff" * SECTOR_BYTES
+        self.stats["erases"] += 1
+        hdr = struct.pack("<IIIH", MAGIC, self.sector_seq, self.next_seq, self.boot)
+        self.page = bytearray(b"\xff" * PAGE_BYTES)
+        self.page[:RECORD_BYTES] = hdr + struct.pack("<H", crc16_ccitt(hdr))
+        self.flushed = 0
+        self.slot = 1
+
+    def flush(self):
+        if self.flushed >= self.slot:
+            return
+        page_first = (self.flushed // PAGE_RECORDS) * PAGE_RECORDS
+        off = self.cur * SECTOR_BYTES + self.flushed * RECORD_BYTES
+        data = self.page[(self.flushed - page_first) * RECORD_BYTES:(self.slot - page_first) * RECORD_BYTES]
+        self.img[off:off + len(data)] = data
+        self.stats["program_ops"] += 1
+        self.stats["bytes_programmed"] += len(data)
+        self.flushed = self.slot
+        self.pending_since = None
+        if self.slot % PAGE_RECORDS == 0:
+            self.page = bytearray(b"\xff" * PAGE_BYTES)
+
+    def append(self, uptime_ms, value, rank, flags):
+        """Appends one record; returns (sector, slot, seq)."""
+        if self.slot >= SECTOR_SLOTS:
+            self._open_sector()
+        seq = self.next_seq
+        self.next_seq += 1
+        at = (self.cur, self.slot, seq)
+        i = (self.slot % PAGE_RECORDS) * RECORD_BYTES
+        self.page[i:i + RECORD_BYTES] = make_record(seq, uptime_ms & 0xFFFFFFFF, self.boot, value, rank, flags)
+        self.slot += 1
+        self.stats["appended"] += 1
+        if self.pending_since is None:
+            self.pending_since = uptime_ms
+        if self.slot % PAGE_RECORDS == 0:
+            self.flush()
+        return at
+
+    def service(self, now_ms, flush_ms):
+        """rlog_service: writes a partial page that has waited flush_ms."""
+        if self.pending_since is not None and now_ms - self.pending_since >= flush_ms:
+            self.flush()
+
+
+def bench(nrecords, nsectors, rate_hz, flush_s, page_ms, erase_ms):
+    """Sustained append on the host: amplification and estimated flash time."""
+    w = RlogWriter(nsectors)
+    for i in range(nrecords):
+        now_ms = int(i * 1000 / rate_hz)
+        w.service(now_ms, flush_s * 1000)
+        w.append(now_ms, i % 1000, 4, FLAG_HAS_VALUE)
+    w.flush()
+
+    st = w.stats
+    payload = nrecords * RECORD_BYTES
+    busy_ms = st["program_ops"] * page_ms + st["erases"] * erase_ms
+    stats = {"sectors": 0, "empty_sectors": 0, "erased_slots": 0, "crc_errors": 0}
+    kept = sum(1 for _ in read_image(bytes(w.img), stats))
+    result = {
+        "records": nrecords,
+        "kept": kept,
+        "program_ops": st["program_ops"],
+        "bytes_programmed": st["bytes_programmed"],
+        "erases": st["erases"],
+        "write_amp": "%.3f" % (st["bytes_programmed"] / payload),
+        "erase_amp": "%.2f" % (st["erases"] * SECTOR_BYTES / payload),
+        "flash_busy_ms": "%.0f" % busy_ms,
+        "max_rate": "%.0f" % (nrecords * 1000 / busy_ms if busy_ms else 0),
+    }
+    print(" ".join("%s=%s" % kv for kv in result.items()))
+    # Everything still in the ring must decode; older sectors were recycled.
+    want = min(nrecords, (nsectors - 1) * (SECTOR_SLOTS - 1) + (w.slot - 1))
+    return 0 if kept == want and stats["crc_errors"] == 0 else 1
+
+
+# ---------------------------------------------------------------- selftest
+
+def make_image(nsectors, nrecords, rng):
+    """Writes records with RlogWriter; returns (image, records)."""
+    w = RlogWriter(nsectors)
+    written = []
+    for seq in range(1, nrecords + 1):
+        flags = FLAG_HAS_VALUE if seq % 5 else 0
+        if seq % 7 == 0:
+            flags |= FLAG_CORRECTED
+        fields = (1000 * seq, rng.randint(-500, 500), 4, flags)
+        sector, slot, _ = w.append(*fields)
+        written.append((sector, slot, seq, fields[0], w.boot) + fields[1:])
+    w.flush()
+    return w.img, written
+
+
+def selftest():
+    rng = random.Random(7)
+    nsectors = 6
+    # Wraps the ring twice and leaves the newest sector half full.
+    nrecords = (SECTOR_SLOTS - 1) * nsectors * 2 + 100
+    img, written = make_image(nsectors, nrecords, rng)
+    # Only the newest nsectors - 1 full sectors and the open one survive.
+    written = [r for r in written if r[2] > nrecords - (SECTOR_SLOTS - 1) * (nsectors - 1) - 100]
+    corrupt = [rng.choice(written) for _ in range(3)]
+    for sector, slot, *_ in corrupt:
+        img[sector * SECTOR_BYTES + slot * RECORD_BYTES + 5] ^= 0x10
+    bad = {(c[0], c[1]) for c in corrupt}
+    want = [r for r in written if (r[0], r[1]) not in bad]
+    want.sort(key=lambda r: r[2])
+
+    failed = 0
+    stats = {"sectors": 0, "empty_sectors": 0, "erased_slots": 0, "crc_errors": 0}
+    out = io.StringIO()
+    dump(read_image, bytes(img), stats, out)
+    rows = list(csv.reader(io.StringIO(out.getvalue())))[1:]
+    got = [int(r[0]) for r in rows]
+    checks = [
+        ("records", got == [r[2] for r in want]),
+        ("values", all(row[3] == ("" if not r[7] & FLAG_HAS_VALUE else str(r[5])) for row, r in zip(rows, want))),
+        ("fixed", all((row[4] == "fixed") == bool(r[7] & FLAG_CORRECTED) for row, r in zip(rows, want))),
+        ("crc_errors", stats["crc_errors"] == len(bad)),
+        ("erased", stats["erased_slots"] == SECTOR_SLOTS - 1 - 100),
+        ("seq_gaps", stats.get("seq_gaps", 0) == len(bad)),
+    ]
+    stream = b"".join(make_record(*r[2:]) for r in want)
+    stats2 = {"crc_errors": 0}
+    dump(read_records, stream, stats2, io.StringIO(), since=want[10][2])
+    checks.append(("stream", stats2["records"] == len(want) - 10))
+    for name, ok in checks:
+        print("%-10s %s" % (name, "ok" if ok else "FAILED"))
+        failed += 0 if ok else 1
+    print("%d records over %d sectors, %d corrupted" % (len(got), nsectors, len(bad)))
+    return 1 if failed else 0
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("input", nargs="?", help="partition image, or /log.bin stream with --records")
+    ap.add_argument("--records", action="store_true", help="input is a bare record stream (GET /log.bin)")
+    ap.add_argument("--since", type=int, default=0, help="skip records with seq below this")
+    ap.add_argument("--stats", action="store_true", help="print a summary to stderr")
+    ap.add_argument("--selftest", action="store_true", help="decode a generated image and check the result")
+    ap.add_argument("--bench", type=int, metavar="N", help="simulate appending N records and report amplification")
+    ap.add_argument("--sectors", type=int, default=0xF0000 // SECTOR_BYTES, help="partition size for --bench, in sectors")
+    ap.add_argument("--rate", type=float, default=1.0, help="readings per second for --bench")
+    ap.add_argument("--flush-s", type=float, default=600, help="partial page flush interval for --bench (SNIFFER_RLOG_FLUSH_S)")
+    ap.add_argument("--page-ms", type=float, default=0.7, help="flash page program time for --bench")
+    ap.add_argument("--erase-ms", type=float, default=45, help="flash sector erase time for --bench")
+    args = ap.parse_args()
+
+    if args.selftest:
+        return selftest()
+    if args.bench:
+        return bench(args.bench, args.sectors, args.rate, args.flush_s, args.page_ms, args.erase_ms)
+    if not args.input:
+        ap.error("input is required")
+
+    with open(args.input, "rb") as f:
+        data = f.read()
+
+    stats = {"sectors": 0, "empty_sectors": 0, "erased_slots": 0, "crc_errors": 0, "seq_gaps": 0}
+    reader = read_records if args.records else read_image
+    dump(reader, data, stats, sys.stdout, args.since)
+
+    if args.stats:
+        print(" ".join("%s=%s" % kv for kv in stats.items()), file=sys.stderr)
+    return 1 if stats["crc_errors"] else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())